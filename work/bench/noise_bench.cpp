@@ -0,0 +1,145 @@
+// Microbenchmark for the terrain noise kernels. Prints the cost per sample of fBm over a row-major grid, the same
+// way PerlinNoise::createMesh evaluates it, for the old sin/cos gradients and for each batch kernel (Perlin and simplex
+// side by side), then for every basis and fractal type of the templated pipeline (unrolled for this octave count and
+// with the runtime loop).
+//
+// Usage: noise_bench [resolution] [octaves] [scale]
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+// project
+#include "noise_batch.hpp"
+#include "noise_pipeline.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+// The gradient noise as it was before the lookup table: hash each corner into an angle and call cos/sin on it.
+static vec2 trigGradient(vec2 v) {
+	unsigned n = unsigned(int(v.x)) * 17u + unsigned(int(v.y)) * 57u;
+	n = (n << 13) ^ n;
+	float num = ((n * (n * n * 255179u + 98712751u) + 1576546427u) & 2147483647u) / 2147483647.0f;
+	float angle = num * two_pi<float>();
+	return vec2(cos(angle), sin(angle));
+}
+
+static float trigPerlinNoise(vec2 pos) {
+	vec2 gridPos = floor(pos);
+	vec2 posFrac = pos - gridPos;
+	vec2 smooth = posFrac * posFrac * (3.0f - 2.0f * posFrac);
+	float bl = dot(trigGradient(gridPos), posFrac);
+	float br = dot(trigGradient(gridPos + vec2(1, 0)), posFrac - vec2(1, 0));
+	float tl = dot(trigGradient(gridPos + vec2(0, 1)), posFrac - vec2(0, 1));
+	float tr = dot(trigGradient(gridPos + vec2(1, 1)), posFrac - vec2(1, 1));
+	return mix(mix(bl, br, smooth.x), mix(tl, tr, smooth.x), smooth.y);
+}
+
+static float trigFractalNoise(const FractalParams &params, vec2 pos) {
+	float noiseHeight = 0.0f;
+	float maxHeight = 0.0f;
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	for (int oct = 0; oct < params.octaves; oct++) {
+		noiseHeight += trigPerlinNoise((pos + params.octaveOffsets[oct]) * params.scale * frequency) * amplitude;
+		maxHeight += amplitude;
+		amplitude *= params.persistence;
+		frequency *= params.lacunarity;
+	}
+	return noiseHeight / maxHeight * params.height;
+}
+
+
+int main(int argc, char **argv) {
+	int resolution = argc > 1 ? std::max(2, atoi(argv[1])) : 500;
+	int octaves = argc > 2 ? std::max(1, atoi(argv[2])) : 6;
+	float scale = argc > 3 ? float(atof(argv[3])) : 0.2f;
+	float meshScale = 10.0f;
+
+	// Seeded the same way as PerlinNoise.
+	mt19937 randomiser(0);
+	uniform_int_distribution<int> distribution(0, 10000);
+	vector<vec2> octaveOffsets(octaves);
+	for (vec2 &offset : octaveOffsets) {
+		offset = vec2(distribution(randomiser), distribution(randomiser));
+	}
+	FractalParams params;
+	params.octaveOffsets = octaveOffsets.data();
+	params.octaves = octaves;
+	params.scale = scale;
+
+	vector<float> rowX(resolution), rowZ(resolution), heights(resolution), dx(resolution), dz(resolution);
+	for (int j = 0; j < resolution; j++) {
+		rowZ[j] = (-1.0f + 2.0f * j / (resolution - 1.0f)) * meshScale;
+	}
+
+	// Best of a few runs over the whole grid, one row at a time.
+	double checksum = 0.0;
+	auto measure = [&](const char *name, const function<void()> &row) {
+		double best = 1e30;
+		for (int run = 0; run < 3; run++) {
+			auto start = chrono::steady_clock::now();
+			for (int i = 0; i < resolution; i++) {
+				fill(rowX.begin(), rowX.end(), (-1.0f + 2.0f * i / (resolution - 1.0f)) * meshScale);
+				row();
+				checksum += heights[i % resolution];
+			}
+			best = std::min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+		}
+		double perSample = best / (double(resolution) * resolution);
+		printf("%-32s %8.1f ns/sample %8.1f M samples/s\n", name, perSample, 1e3 / perSample);
+	};
+
+	printf("%dx%d grid, %d octaves, scale %.2f (best SIMD level: %s)\n", resolution, resolution, octaves, scale, simdLevelName(detectSimdLevel()));
+	measure("sin/cos gradients, scalar", [&]() {
+		for (int j = 0; j < resolution; j++) heights[j] = trigFractalNoise(params, vec2(rowX[j], rowZ[j]));
+	});
+	measure("table gradients, scalar", [&]() {
+		for (int j = 0; j < resolution; j++) heights[j] = fractalNoise(params, vec2(rowX[j], rowZ[j]));
+	});
+	for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 }) {
+		if (level > detectSimdLevel()) break;
+		for (NoiseBasis basis : { NoiseBasis::Perlin, NoiseBasis::Simplex }) {
+			FractalParams variant = params;
+			variant.basis = basis;
+			char name[64];
+			snprintf(name, sizeof(name), "%s batch %s", noiseBasisName(basis), simdLevelName(level));
+			measure(name, [&]() { fractalNoiseBatch(variant, rowX.data(), rowZ.data(), resolution, heights.data(), level); });
+			snprintf(name, sizeof(name), "%s batch %s + gradient", noiseBasisName(basis), simdLevelName(level));
+			measure(name, [&]() { fractalNoiseDerivBatch(variant, rowX.data(), rowZ.data(), resolution, heights.data(), dx.data(), dz.data(), level); });
+		}
+	}
+
+	for (NoiseBasis basis : { NoiseBasis::Perlin, NoiseBasis::Value, NoiseBasis::Simplex }) {
+		for (FractalType fractal : { FractalType::Fbm, FractalType::Ridged, FractalType::Billow }) {
+			FractalParams variant = params;
+			variant.basis = basis;
+			variant.fractal = fractal;
+			FractalKernel unrolled = fractalKernel(variant);
+			variant.octaves = unrolledOctaves + 1; // Past the table, so this picks the runtime loop.
+			FractalKernel looped = fractalKernel(variant);
+			variant.octaves = octaves;
+			char name[64];
+			snprintf(name, sizeof(name), "%s %s, unrolled", noiseBasisName(basis), fractalTypeName(fractal));
+			measure(name, [&]() { unrolled(variant, rowX.data(), rowZ.data(), resolution, heights.data(), dx.data(), dz.data()); });
+			snprintf(name, sizeof(name), "%s %s, loop", noiseBasisName(basis), fractalTypeName(fractal));
+			measure(name, [&]() { looped(variant, rowX.data(), rowZ.data(), resolution, heights.data(), dx.data(), dz.data()); });
+		}
+	}
+
+	// Printed so the work can't be optimised away.
+	printf("checksum %.3f\n", checksum);
+	return 0;
+}
@@ -0,0 +1,238 @@
+// Benchmark for the whole terrain build, the same work PerlinNoise::createMesh does before the GL uploads, over a
+// sweep of resolutions and octave counts. Reports the time of each stage and the peak memory of each configuration,
+// and can write the results as CSV or JSON to track regressions. Runs headless on the core library.
+//
+// Usage: terrain_bench [--resolutions 10,100,500] [--octaves 1,4,10] [--threads N] [--repeats N]
+//                      [--erosion droplets] [--normal-map texelsPerCell] [--csv file] [--json file] [--help]
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// project
+#include "grid_indices.hpp"
+#include "noise_batch.hpp"
+#include "parallel.hpp"
+#include "terrain_generator.hpp"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+
+
+// Peak resident memory of the process in MB. On Linux the peak is reset before each configuration (resetPeakMemory),
+// elsewhere it is the peak since the process started.
+static void resetPeakMemory() {
+#if defined(__linux__)
+	if (FILE *file = fopen("/proc/self/clear_refs", "w")) {
+		fputs("5", file);
+		fclose(file);
+	}
+#endif
+}
+
+static double peakMemoryMB() {
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+	return 0.0;
+#else
+#if defined(__linux__)
+	// VmHWM follows the reset above, ru_maxrss doesn't.
+	if (FILE *file = fopen("/proc/self/status", "r")) {
+		char line[256];
+		long kilobytes = -1;
+		while (fgets(line, sizeof(line), file)) {
+			if (strncmp(line, "VmHWM:", 6) == 0) kilobytes = atol(line + 6);
+		}
+		fclose(file);
+		if (kilobytes >= 0) return kilobytes / 1024.0;
+	}
+#endif
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+	return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes on macOS, kilobytes elsewhere.
+#else
+	return usage.ru_maxrss / 1024.0;
+#endif
+#endif
+}
+
+
+static const char *usage =
+	"usage: terrain_bench [options]\n"
+	"  --resolutions 10,100,500  grid resolutions to sweep\n"
+	"  --octaves 1,4,10          octave counts to sweep\n"
+	"  --threads N               worker threads (default: hardware concurrency)\n"
+	"  --repeats N               runs per configuration, the fastest is reported (default 3)\n"
+	"  --erosion droplets        erode with this many droplets (default off)\n"
+	"  --normal-map texels       bake a normal map with this many texels per cell (default off)\n"
+	"  --csv file                write the results as CSV\n"
+	"  --json file               write the results as JSON\n"
+	"  --help, -h                print this and exit\n";
+
+
+static vector<int> parseList(const char *text) {
+	vector<int> values;
+	stringstream stream(text);
+	string item;
+	while (getline(stream, item, ',')) {
+		if (!item.empty()) values.push_back(atoi(item.c_str()));
+	}
+	return values;
+}
+
+
+// One configuration, with the stage times of its fastest run.
+struct Result {
+	int resolution = 0;
+	int octaves = 0;
+	TerrainTimings timings;
+	double triangles = 0.0; // Index buffer for the grid, the CPU part of buildGridMesh.
+	double total = 0.0;
+	double peakMemory = 0.0;
+};
+
+
+int main(int argc, char **argv) {
+	vector<int> resolutions = { 10, 50, 100, 250, 500, 1000, 2000 };
+	vector<int> octaveCounts = { 1, 2, 4, 6, 8, 10 };
+	int threads = 0;
+	int repeats = 3;
+	int droplets = 0; // Erosion is off unless a droplet count is given.
+	int texelsPerCell = 0; // The same for the baked normal map.
+	string csvPath, jsonPath;
+	const vector<string> options = { "--resolutions", "--octaves", "--threads", "--repeats", "--erosion", "--normal-map",
+									 "--csv", "--json" };
+	for (int i = 1; i < argc; i += 2) {
+		string option = argv[i];
+		if (option == "--help" || option == "-h") {
+			fputs(usage, stdout);
+			return 0;
+		}
+		// The name is checked before the value, so a mistyped last option isn't reported as missing its value.
+		if (find(options.begin(), options.end(), option) == options.end()) {
+			fprintf(stderr, "unknown option %s\n%s", argv[i], usage);
+			return 1;
+		}
+		if (i + 1 == argc) {
+			fprintf(stderr, "missing value for option %s\n", argv[i]);
+			return 1;
+		}
+		const char *value = argv[i + 1];
+		if (option == "--resolutions") resolutions = parseList(value);
+		else if (option == "--octaves") octaveCounts = parseList(value);
+		else if (option == "--threads") threads = atoi(value);
+		else if (option == "--repeats") repeats = std::max(1, atoi(value));
+		else if (option == "--erosion") droplets = atoi(value);
+		else if (option == "--normal-map") texelsPerCell = atoi(value);
+		else if (option == "--csv") csvPath = value;
+		else jsonPath = value;
+	}
+	setParallelThreadCount(threads);
+
+	printf("%d threads, SIMD %s, best of %d runs (times in ms)\n", parallelThreadCount(),
+		   simdLevelName(detectSimdLevel()), repeats);
+	printf("%6s %4s %9s %9s %9s %9s %9s %9s %9s %9s %9s %9s\n", "res", "oct", "noise", "erosion", "normals", "range",
+		   "field", "vertices", "indices", "normalmap", "total", "peak MB");
+
+	vector<Result> results;
+	for (int resolution : resolutions) {
+		for (int octaves : octaveCounts) {
+			if (resolution < 2 || octaves < 1) continue;
+			Result result;
+			result.resolution = resolution;
+			result.octaves = octaves;
+			result.total = 1e30;
+			resetPeakMemory();
+
+			for (int run = 0; run < repeats; run++) {
+				// A fresh generator each run, so the octave layer cache never skips the noise. Same defaults as the GUI.
+				TerrainGenerator generator;
+				TerrainBuild build;
+				build.key.seed = 0;
+				build.key.octaves = octaves;
+				build.key.resolution = resolution;
+				build.key.persistence = 0.4f;
+				build.key.lacunarity = 2.0f;
+				build.key.scale = 0.2f;
+				build.key.height = 8.0f;
+				build.key.meshScale = 10.0f;
+				build.useCache = false;
+				build.waterLevel = 0.4f;
+				build.erosion.enabled = droplets > 0;
+				build.erosion.droplets = droplets;
+				build.key.erosion = build.erosion.hash();
+				build.normalMap.enabled = texelsPerCell > 0;
+				build.normalMap.texelsPerCell = texelsPerCell;
+				generator.build(build);
+
+				auto start = chrono::steady_clock::now();
+				vector<unsigned int> indices = gridIndices(resolution, resolution, GridTopology::Triangles);
+				double triangles = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+				const TerrainTimings &t = build.timings;
+				double total = t.noise + t.erosion + t.normals + t.heightRange + t.heightfield + t.vertices + triangles +
+					t.normalMap;
+				if (total < result.total) {
+					result.timings = t;
+					result.triangles = triangles;
+					result.total = total;
+				}
+			}
+			result.peakMemory = peakMemoryMB();
+			results.push_back(result);
+
+			const TerrainTimings &t = result.timings;
+			printf("%6d %4d %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f %9.1f\n", resolution, octaves, t.noise,
+				   t.erosion, t.normals, t.heightRange, t.heightfield, t.vertices, result.triangles, t.normalMap,
+				   result.total, result.peakMemory);
+			fflush(stdout);
+		}
+	}
+
+	if (!csvPath.empty()) {
+		ofstream csv(csvPath);
+		csv << "resolution,octaves,threads,noise_ms,erosion_ms,normals_ms,height_range_ms,heightfield_ms,vertices_ms,indices_ms,normal_map_ms,total_ms,peak_mb\n";
+		for (const Result &r : results) {
+			const TerrainTimings &t = r.timings;
+			csv << r.resolution << ',' << r.octaves << ',' << parallelThreadCount() << ',' << t.noise << ',' << t.erosion << ',' << t.normals
+				<< ',' << t.heightRange << ',' << t.heightfield << ',' << t.vertices << ',' << r.triangles << ','
+				<< t.normalMap << ',' << r.total << ',' << r.peakMemory << '\n';
+		}
+	}
+
+	if (!jsonPath.empty()) {
+		ofstream json(jsonPath);
+		json << "{\n  \"threads\": " << parallelThreadCount() << ",\n  \"simd\": \"" << simdLevelName(detectSimdLevel())
+			 << "\",\n  \"repeats\": " << repeats << ",\n  \"results\": [\n";
+		for (size_t i = 0; i < results.size(); i++) {
+			const Result &r = results[i];
+			const TerrainTimings &t = r.timings;
+			json << "    {\"resolution\": " << r.resolution << ", \"octaves\": " << r.octaves
+				 << ", \"noise_ms\": " << t.noise << ", \"erosion_ms\": " << t.erosion << ", \"normals_ms\": " << t.normals
+				 << ", \"height_range_ms\": " << t.heightRange << ", \"heightfield_ms\": " << t.heightfield
+				 << ", \"vertices_ms\": " << t.vertices << ", \"indices_ms\": " << r.triangles << ", \"normal_map_ms\": " << t.normalMap
+				 << ", \"total_ms\": " << r.total << ", \"peak_mb\": " << r.peakMemory << "}"
+				 << (i + 1 < results.size() ? "," : "") << "\n";
+		}
+		json << "  ]\n}\n";
+	}
+	return 0;
+}
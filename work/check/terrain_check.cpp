@@ -0,0 +1,219 @@
+// Checks of the GL-free core library for behaviour a change could break without anything failing to build. Each
+// check prints what it found and the process exits non-zero if any failed. Registered with CTest, one test per check.
+//
+// Usage: terrain_check [check...]   (all checks when none are named)
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "heightfield_cache.hpp"
+#include "noise_batch.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace fs = std::filesystem;
+
+
+// Empty directory under the system temp directory, removed again when the check is done.
+class ScratchDirectory {
+public:
+	explicit ScratchDirectory(const string &name) {
+		error_code error;
+		fs::path temp = fs::temp_directory_path(error);
+		m_path = (error ? fs::path(".") : temp) / ("cgra_terrain_check_" + name);
+		fs::remove_all(m_path, error);
+		fs::create_directories(m_path, error);
+	}
+
+	~ScratchDirectory() {
+		error_code error;
+		fs::remove_all(m_path, error);
+	}
+
+	string path() const { return m_path.string(); }
+
+private:
+	fs::path m_path;
+};
+
+
+static HeightfieldKey cacheKey(int seed, int resolution) {
+	HeightfieldKey key;
+	key.seed = seed;
+	key.resolution = resolution;
+	return key;
+}
+
+static void cacheData(int resolution, vector<float> &heights, vector<vec3> &normals) {
+	size_t vertexCount = size_t(resolution) * resolution;
+	heights.resize(vertexCount);
+	normals.resize(vertexCount);
+	for (size_t i = 0; i < vertexCount; i++) {
+		heights[i] = float(i % 97) * 0.25f;
+		normals[i] = vec3(float(i % 13), 1.0f, float(i % 7));
+	}
+}
+
+
+// Store then load at even and odd resolutions (the heights alone are then not a whole number of 8 byte words), a
+// corrupted file is a miss, and going over the size limit removes the least recently used file.
+static bool checkHeightCache() {
+	ScratchDirectory directory("height_cache");
+	HeightfieldCache cache(directory.path());
+	bool passed = true;
+
+	for (int resolution : { 100, 101, 2, 3 }) {
+		vector<float> heights, loadedHeights;
+		vector<vec3> normals, loadedNormals;
+		cacheData(resolution, heights, normals);
+		HeightfieldKey key = cacheKey(0, resolution);
+		bool matched = cache.store(key, heights, normals) && cache.load(key, loadedHeights, loadedNormals) &&
+			loadedHeights == heights && loadedNormals == normals;
+		printf("  round trip at resolution %d: %s\n", resolution, matched ? "ok" : "FAILED");
+		passed &= matched;
+	}
+
+	{
+		HeightfieldKey key = cacheKey(0, 101);
+		FILE *file = fopen(cache.path(key).c_str(), "r+b");
+		bool corrupted = file != nullptr && fseek(file, -5, SEEK_END) == 0 && fputc(0x5a, file) != EOF;
+		if (file != nullptr) fclose(file);
+		vector<float> heights;
+		vector<vec3> normals;
+		bool rejected = corrupted && !cache.load(key, heights, normals);
+		printf("  corrupted file rejected: %s\n", rejected ? "ok" : "FAILED");
+		passed &= rejected;
+	}
+
+	{
+		// Room for two files at resolution 64. Write times are set a minute apart, so the order doesn't depend on
+		// the file system's timestamp resolution.
+		ScratchDirectory limitDirectory("height_cache_limit");
+		HeightfieldCache limited(limitDirectory.path());
+		vector<float> heights, loadedHeights;
+		vector<vec3> normals, loadedNormals;
+		cacheData(64, heights, normals);
+		uintmax_t fileBytes = 0;
+		for (int seed = 0; seed < 3; seed++) {
+			HeightfieldKey key = cacheKey(seed, 64);
+			limited.store(key, heights, normals);
+			error_code error;
+			if (seed == 0) {
+				fileBytes = fs::file_size(limited.path(key), error);
+				limited.maxBytes = 2 * fileBytes;
+			}
+			fs::last_write_time(limited.path(key), fs::file_time_type::clock::now() - chrono::minutes(3 - seed), error);
+		}
+		bool evicted = fileBytes > 0 && !fs::exists(limited.path(cacheKey(0, 64))) &&
+			limited.load(cacheKey(1, 64), loadedHeights, loadedNormals) &&
+			limited.load(cacheKey(2, 64), loadedHeights, loadedNormals);
+		printf("  least recently used file removed over the limit: %s\n", evicted ? "ok" : "FAILED");
+		passed &= evicted;
+	}
+	return passed;
+}
+
+
+// The batch kernels against the scalar fractalNoise they vectorise, for every basis and fractal, the instruction sets
+// this CPU has and a few octave counts. The vector kernels use polynomial sin/cos, so they only match to rounding.
+static bool checkNoiseBatch() {
+	const float tolerance = 1e-5f;
+	vector<vec2> octaveOffsets;
+	for (int oct = 0; oct < 10; oct++) {
+		octaveOffsets.push_back(vec2(137.0f * oct - 611.0f, 53.0f * oct + 29.0f));
+	}
+
+	// A row of an odd count, so every kernel also runs its scalar tail, crossing many lattice cells and both signs.
+	const int count = 517;
+	vector<float> xs(count), zs(count);
+	for (int k = 0; k < count; k++) {
+		xs[k] = -40.0f + k * 0.173f;
+		zs[k] = 12.5f - k * 0.061f;
+	}
+
+	bool passed = true;
+	for (int level = 0; level <= int(detectSimdLevel()); level++) {
+		float heightError = 0.0f, gradientError = 0.0f;
+		for (NoiseBasis basis : { NoiseBasis::Perlin, NoiseBasis::Value, NoiseBasis::Simplex }) {
+			for (FractalType fractal : { FractalType::Fbm, FractalType::Ridged, FractalType::Billow }) {
+				for (int octaves : { 1, 6, 10 }) {
+					FractalParams params;
+					params.basis = basis;
+					params.fractal = fractal;
+					params.octaveOffsets = octaveOffsets.data();
+					params.octaves = octaves;
+
+					vector<float> heights(count), derivHeights(count), dx(count), dz(count);
+					fractalNoiseBatch(params, xs.data(), zs.data(), count, heights.data(), SimdLevel(level));
+					fractalNoiseDerivBatch(params, xs.data(), zs.data(), count, derivHeights.data(), dx.data(), dz.data(),
+										   SimdLevel(level));
+					for (int k = 0; k < count; k++) {
+						vec2 gradient;
+						float height = fractalNoise(params, vec2(xs[k], zs[k]));
+						float derivHeight = fractalNoise(params, vec2(xs[k], zs[k]), gradient);
+						heightError = std::max({ heightError, abs(heights[k] - height), abs(derivHeights[k] - derivHeight) });
+						gradientError = std::max({ gradientError, abs(dx[k] - gradient.x), abs(dz[k] - gradient.y) });
+					}
+				}
+			}
+		}
+		bool matched = heightError <= tolerance && gradientError <= tolerance;
+		printf("  %s: largest difference %.2g in heights, %.2g in gradients: %s\n", simdLevelName(SimdLevel(level)),
+			   heightError, gradientError, matched ? "ok" : "FAILED");
+		passed &= matched;
+	}
+	return passed;
+}
+
+
+struct Check {
+	const char *name;
+	function<bool()> run;
+};
+
+
+int main(int argc, char **argv) {
+	const vector<Check> checks = {
+		{ "height_cache", checkHeightCache },
+		{ "noise_batch", checkNoiseBatch },
+	};
+
+	vector<const Check*> selected;
+	for (int i = 1; i < argc; i++) {
+		const Check *found = nullptr;
+		for (const Check &check : checks) {
+			if (strcmp(check.name, argv[i]) == 0) found = &check;
+		}
+		if (found == nullptr) {
+			fprintf(stderr, "unknown check %s\n", argv[i]);
+			return 1;
+		}
+		selected.push_back(found);
+	}
+	if (selected.empty()) {
+		for (const Check &check : checks) selected.push_back(&check);
+	}
+
+	int failed = 0;
+	for (const Check *check : selected) {
+		printf("%s\n", check->name);
+		bool passed = check->run();
+		printf("%s: %s\n", check->name, passed ? "passed" : "FAILED");
+		failed += passed ? 0 : 1;
+	}
+	return failed == 0 ? 0 : 1;
+}
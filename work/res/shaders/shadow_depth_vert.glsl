@@ -12,8 +12,47 @@ layout(location = 6) in vec4 aInstanceMatrix3;
 uniform mat4 uLightSpaceMatrix;
 uniform bool uUseInstancing;
 
+// CDLOD terrain patches, same placement as terrain_vert.glsl.
+uniform bool uLodEnabled;
+uniform sampler2D uLodHeightMap;
+uniform vec4 uLodNode;
+uniform vec2 uLodMorph;
+uniform vec3 uLodEye;
+uniform vec2 uLodTerrain;
+
+// Compact terrain, same vertex pulling as terrain_vert.glsl.
+uniform bool uCompactEnabled;
+uniform sampler2D uCompactHeightMap;
+uniform vec4 uCompactGrid;
+
 out vec2 vTexCoord;
 
+float lodHeight(vec2 xz) {
+    vec2 uv = clamp((xz / uLodTerrain.x + 1.0) * 0.5, 0.0, 1.0);
+    vec2 texel = (uv * (uLodTerrain.y - 1.0) + 0.5) / uLodTerrain.y;
+    return texture(uLodHeightMap, texel.yx).r;
+}
+
+vec3 lodPosition(vec3 patchPos) {
+    vec2 grid = patchPos.xz * uLodNode.w;
+    vec2 xz = uLodNode.xy + patchPos.xz * uLodNode.z;
+    float eyeDistance = length(uLodEye - vec3(xz.x, lodHeight(xz), xz.y));
+    float morph = clamp((eyeDistance - uLodMorph.x) / (uLodMorph.y - uLodMorph.x), 0.0, 1.0);
+    grid -= fract(grid * 0.5) * 2.0 * morph;
+    xz = uLodNode.xy + grid / uLodNode.w * uLodNode.z;
+    return vec3(xz.x, lodHeight(xz), xz.y);
+}
+
+vec3 compactPosition() {
+    int quads = int(uCompactGrid.z);
+    int patches = int(uCompactGrid.w);
+    ivec2 patchOrigin = ivec2(gl_InstanceID / patches, gl_InstanceID % patches) * quads;
+    ivec2 local = ivec2(gl_VertexID / (quads + 1), gl_VertexID % (quads + 1));
+    ivec2 vertex = min(patchOrigin + local, ivec2(int(uCompactGrid.y) - 1));
+    vec2 xz = (-1.0 + 2.0 * vec2(vertex) / (uCompactGrid.y - 1.0)) * uCompactGrid.x;
+    return vec3(xz.x, texelFetch(uCompactHeightMap, vertex.yx, 0).r, xz.y);
+}
+
 void main() {
     vTexCoord = aTexCoord;
 
@@ -28,6 +67,7 @@ void main() {
         gl_Position = uLightSpaceMatrix * instanceMatrix * vec4(aPosition, 1.0);
     } else {
         // Non-instanced (terrain)
-        gl_Position = uLightSpaceMatrix * vec4(aPosition, 1.0);
+        vec3 position = uLodEnabled ? lodPosition(aPosition) : (uCompactEnabled ? compactPosition() : aPosition);
+        gl_Position = uLightSpaceMatrix * vec4(position, 1.0);
     }
 }
@@ -24,6 +24,10 @@ uniform bool uUsePCF;
 uniform bool useFog;
 uniform bool linearFog;
 uniform float fogDensity;
+// Normals baked from the noise at a finer grid than the mesh (see terrain_normal_map.hpp), used instead of the
+// interpolated vertex normal.
+uniform bool uBakedNormals;
+uniform sampler2D uBakedNormalMap;
 
 
 // viewspace data (this must match the output of the fragment shader)
@@ -81,14 +85,14 @@ float orenNayarDiffuse(vec3 normDir, vec3 lightDir, vec3 viewDir) {
 }
 
 
-vec3 calculateNormal(vec3 normalMap) {
+vec3 calculateNormal(vec3 normalMap, vec3 normal, vec3 tangent, vec3 bitangent) {
 	// Map normal map to [-1, 1] range in tangent space.
 	vec3 normalTangentSpace = normalize(normalMap * 2.0 - 1.0);
 
 	// Build TBN matrix to transform from tangent space to view space.
-	vec3 T = normalize(f_in.tangent);
-	vec3 B = normalize(f_in.bitangent);
-	vec3 N = normalize(f_in.normal);
+	vec3 T = normalize(tangent);
+	vec3 B = normalize(bitangent);
+	vec3 N = normalize(normal);
 	mat3 TBN = mat3(T, B, N);
 
 	// Transform the normal from tangent space to view space
@@ -97,6 +101,16 @@ vec3 calculateNormal(vec3 normalMap) {
 }
 
 
+// Baked normal at the terrain uv of this fragment. Texels are stored with x along the rows, hence the yx, and the
+// outer texels sit on the mesh edges.
+vec3 bakedNormal() {
+	float size = float(textureSize(uBakedNormalMap, 0).x);
+	vec2 texel = (f_in.textureCoord * (size - 1.0f) + 0.5f) / size;
+	vec2 packed = texture(uBakedNormalMap, texel.yx).rg * 2.0f - 1.0f;
+	return normalize(vec3(packed.x, sqrt(max(0.0f, 1.0f - dot(packed, packed))), packed.y));
+}
+
+
 float calculateShadow(vec4 lightSpacePos, vec3 normal, vec3 lightDir) {
 	// Perform perspective divide
 	vec3 projCoords = lightSpacePos.xyz / lightSpacePos.w;
@@ -178,6 +192,19 @@ float calculateFog() {
 
 
 void main() {
+	// Vertex normal and tangent frame, or the same frame around the baked normal (as terrain_vert.glsl builds it).
+	vec3 globalNormal = f_in.globalNormal;
+	vec3 normal = f_in.normal;
+	vec3 tangent = f_in.tangent;
+	vec3 bitangent = f_in.bitangent;
+	if (uBakedNormals) {
+		globalNormal = bakedNormal();
+		vec3 globalTangent = normalize(vec3(1.0f, 0.0f, 0.0f) - globalNormal.x * globalNormal);
+		normal = (uModelViewMatrix * vec4(globalNormal, 0.0f)).xyz;
+		tangent = (uModelViewMatrix * vec4(globalTangent, 0.0f)).xyz;
+		bitangent = (uModelViewMatrix * vec4(cross(globalNormal, globalTangent), 0.0f)).xyz;
+	}
+
 	// Getting height proportion to map texture color based on terrain height.
 	float minHeight = heightRange.x;
 	float maxHeight = heightRange.y;
@@ -192,8 +219,8 @@ void main() {
 	for (int i = 0; i < numTextures; i++) {
 		// Weight for how close the current height is to the middle of the textures band.
 		float weight = max(1.0 - abs(scaledHeight - i - 0.5f), 0.0f);
-		textureColor += triplanarSample(uTextures[i], f_in.globalPos, f_in.globalNormal) * weight;
-		normalMap += triplanarSample(uNormalMaps[i], f_in.globalPos, f_in.globalNormal) * weight;
+		textureColor += triplanarSample(uTextures[i], f_in.globalPos, globalNormal) * weight;
+		normalMap += triplanarSample(uNormalMaps[i], f_in.globalPos, globalNormal) * weight;
 		totalWeight += weight;
 	}
 	// Normalize so the sum of contributions is 1 (solid texture to avoid light/dark patches).
@@ -204,7 +231,7 @@ void main() {
 	float ambientStrength = 0.15f;
 	vec3 ambient = ambientStrength * lightColor * textureColor;
 
-	vec3 normDir = calculateNormal(normalMap);
+	vec3 normDir = calculateNormal(normalMap, normal, tangent, bitangent);
 	vec3 viewDir = normalize(-f_in.position);
 	vec3 lightDir = normalize(-lightDirection);
 	vec3 halfAngle = normalize(lightDir + viewDir);
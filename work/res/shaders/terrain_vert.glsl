@@ -6,6 +6,22 @@ uniform mat4 uModelViewMatrix;
 uniform mat4 uLightSpaceMatrix;
 uniform vec4 uClipPlane;
 
+// CDLOD patch placement (see TerrainLod). When enabled, aPosition is a point on a flat [0, 1] patch grid.
+uniform bool uLodEnabled;
+uniform sampler2D uLodHeightMap;
+uniform vec4 uLodNode; // Node origin (xz), node size and patch quads per edge.
+uniform vec2 uLodMorph; // Distance range over which vertices morph to the coarser grid.
+uniform vec3 uLodEye;
+uniform vec2 uLodTerrain; // Mesh scale and heightmap resolution.
+
+// Compact terrain (see TerrainCompact). There are no vertex attributes, the grid vertex comes from gl_VertexID in the
+// patch and gl_InstanceID picks the patch.
+uniform bool uCompactEnabled;
+uniform sampler2D uCompactHeightMap;
+uniform sampler2D uCompactNormalMap;
+uniform bool uCompactNormals; // Packed xz normals, otherwise they come from the neighbouring heights.
+uniform vec4 uCompactGrid; // Mesh scale, heightmap resolution, patch quads and patches per row.
+
 // mesh data
 layout(location = 0) in vec3 aPosition;
 layout(location = 1) in vec3 aNormal;
@@ -25,32 +41,102 @@ out VertexData {
 
 out float gl_ClipDistance[1];
 
+// Terrain uv (0 to 1 across the mesh) of a world xz position.
+vec2 lodTexCoord(vec2 xz) {
+	return clamp((xz / uLodTerrain.x + 1.0f) * 0.5f, 0.0f, 1.0f);
+}
+
+// Bilinear height between the terrain vertices. The heightmap is stored with x along its rows, hence the yx.
+float lodHeight(vec2 xz) {
+	vec2 texel = (lodTexCoord(xz) * (uLodTerrain.y - 1.0f) + 0.5f) / uLodTerrain.y;
+	return texture(uLodHeightMap, texel.yx).r;
+}
+
+// Places the patch vertex in the node, morphing odd grid vertices onto their coarser neighbours with distance.
+vec3 lodPosition(vec3 patchPos) {
+	vec2 grid = patchPos.xz * uLodNode.w;
+	vec2 xz = uLodNode.xy + patchPos.xz * uLodNode.z;
+	float eyeDistance = length(uLodEye - vec3(xz.x, lodHeight(xz), xz.y));
+	float morph = clamp((eyeDistance - uLodMorph.x) / (uLodMorph.y - uLodMorph.x), 0.0f, 1.0f);
+	grid -= fract(grid * 0.5f) * 2.0f * morph;
+	xz = uLodNode.xy + grid / uLodNode.w * uLodNode.z;
+	return vec3(xz.x, lodHeight(xz), xz.y);
+}
+
+// Central difference over one heightmap cell, like the CPU normals.
+vec3 lodNormal(vec2 xz) {
+	float cell = 2.0f * uLodTerrain.x / (uLodTerrain.y - 1.0f);
+	float dx = lodHeight(xz + vec2(cell, 0)) - lodHeight(xz - vec2(cell, 0));
+	float dz = lodHeight(xz + vec2(0, cell)) - lodHeight(xz - vec2(0, cell));
+	return normalize(vec3(-dx, 2.0f * cell, -dz));
+}
+
+// Grid vertex (i, j) drawn by this invocation, clamped onto the grid for patches hanging over its far edges.
+ivec2 compactVertex() {
+	int quads = int(uCompactGrid.z);
+	int patches = int(uCompactGrid.w);
+	ivec2 patchOrigin = ivec2(gl_InstanceID / patches, gl_InstanceID % patches) * quads;
+	ivec2 local = ivec2(gl_VertexID / (quads + 1), gl_VertexID % (quads + 1));
+	return min(patchOrigin + local, ivec2(int(uCompactGrid.y) - 1));
+}
+
+// Heights are stored with x along the rows, hence the yx.
+float compactHeight(ivec2 vertex) {
+	return texelFetch(uCompactHeightMap, clamp(vertex, ivec2(0), ivec2(int(uCompactGrid.y) - 1)).yx, 0).r;
+}
+
+vec3 compactNormal(ivec2 vertex) {
+	if (uCompactNormals) {
+		vec2 packed = texelFetch(uCompactNormalMap, vertex.yx, 0).rg;
+		return normalize(vec3(packed.x, sqrt(max(0.0f, 1.0f - dot(packed, packed))), packed.y));
+	}
+	float cell = 2.0f * uCompactGrid.x / (uCompactGrid.y - 1.0f);
+	float dx = compactHeight(vertex + ivec2(1, 0)) - compactHeight(vertex - ivec2(1, 0));
+	float dz = compactHeight(vertex + ivec2(0, 1)) - compactHeight(vertex - ivec2(0, 1));
+	return normalize(vec3(-dx, 2.0f * cell, -dz));
+}
+
 void main() {
+	vec3 position = aPosition;
+	vec3 normal = aNormal;
+	vec2 texCoord = aTexCoord;
+	if (uLodEnabled) {
+		position = lodPosition(aPosition);
+		normal = lodNormal(position.xz);
+		texCoord = lodTexCoord(position.xz);
+	} else if (uCompactEnabled) {
+		ivec2 vertex = compactVertex();
+		texCoord = vec2(vertex) / (uCompactGrid.y - 1.0f);
+		vec2 xz = (-1.0f + 2.0f * texCoord) * uCompactGrid.x;
+		position = vec3(xz.x, compactHeight(vertex), xz.y);
+		normal = compactNormal(vertex);
+	}
+
 	// Send untransformed global position for texture mapping based on height proportion.
-	v_out.globalPos = aPosition;
-	v_out.globalNormal = aNormal; // Need the global normal for triplanar sampling.
+	v_out.globalPos = position;
+	v_out.globalNormal = normal; // Need the global normal for triplanar sampling.
 
 	// transform vertex data to viewspace
-	v_out.position = (uModelViewMatrix * vec4(aPosition, 1)).xyz;
-	v_out.normal = normalize((uModelViewMatrix * vec4(aNormal, 0)).xyz);
-	v_out.textureCoord = aTexCoord;
+	v_out.position = (uModelViewMatrix * vec4(position, 1)).xyz;
+	v_out.normal = normalize((uModelViewMatrix * vec4(normal, 0)).xyz);
+	v_out.textureCoord = texCoord;
 
     // Tangent on the x-axis for grid-based heightmap terrain.
     vec3 tangent = vec3(1.0f, 0.0f, 0.0f);
 
     // Lecture: need proper orthogonal basis for TBN matrix
-    tangent = normalize(tangent - dot(tangent, aNormal) * aNormal);
-    vec3 bitangent = cross(aNormal, tangent);
+    tangent = normalize(tangent - dot(tangent, normal) * normal);
+    vec3 bitangent = cross(normal, tangent);
 
     // lecture: "Consider using a (tangent, bitangent and normal) TBN matrix structure for transformations"
     v_out.tangent = normalize((uModelViewMatrix * vec4(tangent, 0.0)).xyz);
     v_out.bitangent = normalize((uModelViewMatrix * vec4(bitangent, 0.0)).xyz);
 
 	// Calculate light space position for shadow mapping
-	v_out.lightSpacePos = uLightSpaceMatrix * vec4(aPosition, 1.0);
+	v_out.lightSpacePos = uLightSpaceMatrix * vec4(position, 1.0);
 
-	gl_ClipDistance[0] = dot(vec4(aPosition, 1.0), uClipPlane);
+	gl_ClipDistance[0] = dot(vec4(position, 1.0), uClipPlane);
 
     // Set the screenspace position (needed for converting to fragment data)
-    gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(aPosition, 1.0f);
+    gl_Position = uProjectionMatrix * uModelViewMatrix * vec4(position, 1.0f);
 }
\ No newline at end of file
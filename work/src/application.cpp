@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <memory>
 
 // glm
 #include <glm/gtc/constants.hpp>
@@ -103,21 +104,23 @@ Application::Application(GLFWwindow *window) : m_window(window) {
 
     // Create water model
     m_water = Water();
+    m_water.loadTextures();
     m_water.shader = waterShader;
     // Make the terrain and water have the same resolution
     m_water.meshResolution = m_terrain.meshResolution;
-    m_water.createMesh();
 
     // Initialize trees with bark shader
     m_trees.shader = bark_shader;
     m_trees.loadTextures();
     m_trees.setTreeType(3);
-    m_trees.generateTreesOnTerrain(&m_terrain);
+
+	// Every node starts dirty, so the first update creates the water mesh, where trees can grow, and the trees.
+	buildSceneGraph();
+	m_scene.update();
 
     // Set terrain and water texture params after trees are generated to prevent visual bugs.
     m_terrain.setShaderParams();
     m_water.setShaderParams();
-	m_terrain.createHeightMap(m_water.waterHeightProp);
 
     // Build skybox shader
     shader_builder sb_skybox;
@@ -409,8 +412,9 @@ void Application::renderScene(const mat4& view, const mat4& proj, const mat4& li
 	glUniform1f(glGetUniformLocation(m_terrain.shader, "fogDensity"), fogDensity);
 	glUniform4fv(glGetUniformLocation(m_terrain.shader, "uClipPlane"), 1, value_ptr(clipPlane));
 
-	// Draw terrain
+	// Draw terrain (the reflection and refraction passes can use a coarser LOD)
 	m_terrain.lightColor = activeLightColor;
+	m_terrain.lodBias = skipWater ? m_water_lod_bias : 0.0f;
 	m_terrain.draw(view, proj, lightSpaceMatrix, m_shadow_map_texture, m_enable_shadows, m_use_pcf);
 
 	// Fog for leaves
@@ -492,6 +496,20 @@ void Application::renderScene(const mat4& view, const mat4& proj, const mat4& li
 
 void Application::render() {
 
+	// Swap in terrain that finished generating since the last frame, before anything draws it.
+	m_regeneration.applyFinished();
+	// Tree species built in the background go into the cache, and the slots waiting on them pick them up.
+	if (m_trees.applyFinishedSpecies()) {
+		m_scene.markDirty(m_nodes.treeSpecies);
+	}
+	// Then recompute whatever it or the GUI made out of date.
+	m_scene.update();
+
+	// Stream world tiles around the camera before any pass draws the terrain.
+	if (m_terrain.worldMode) {
+		updateWorld();
+	}
+
 	// 1st pass: Shadow map (must be first so reflections/refractions can use it)
 
 	// Only render shadows when sun is above horizon
@@ -666,6 +684,9 @@ void Application::render() {
             * rotate(mat4(1), m_yaw, vec3(0, 1, 0));
     }
 
+	// Brush the terrain under the cursor before anything else draws it this frame.
+	sculptTerrain(view, proj);
+
 	// helpful draw options
 	if (m_show_grid) drawGrid(view, proj);
 	if (m_show_axis) drawAxis(view, proj);
@@ -786,33 +807,166 @@ void Application::renderGUI() {
 	}
 
     ImGui::Separator();
-	bool meshNeedsUpdate = false;
     if (ImGui::CollapsingHeader("Terrain Generation", ImGuiTreeNodeFlags_DefaultOpen)) {
 		// Temporary UI control of noise to be replaced with the node-based UI. Regenerates model when parameters changed.
 		ImGui::SliderInt("Seed", &m_terrain.noiseSeed, 0, 100, "%.0f");
-		ImGui::SliderFloat("Persistence", &m_terrain.noisePersistence, 0.01f, 0.8f, "%.2f", 0.5f);
+		// Persistence and height only reweight the cached noise octaves, so they regenerate live while dragging.
+		bool rebuild = false;
+		bool reweighted = ImGui::SliderFloat("Persistence", &m_terrain.noisePersistence, 0.01f, 0.8f, "%.2f", 0.5f);
 		ImGui::SliderFloat("Lacunarity", &m_terrain.noiseLacunarity, 1.0f, 4.0f, "%.2f", 2.0f);
 		ImGui::SliderFloat("Noise Scale", &m_terrain.noiseScale, 0.01f, 2.0f, "%.2f", 3.0f);
 		ImGui::SliderInt("Octaves", &m_terrain.noiseOctaves, 1, 10, "%.0f");
-		ImGui::SliderFloat("Mesh Height", &m_terrain.meshHeight, 0.1f, 100.0f, "%.1f", 3.0f);
+		// Noise type of each octave, and how the octaves are shaped before they are summed.
+		const char* noiseBases[] = { "Perlin", "Value", "Simplex" };
+		int noiseBasis = int(m_terrain.noiseBasis);
+		if (ImGui::Combo("Noise Basis", &noiseBasis, noiseBases, 3)) {
+			m_terrain.noiseBasis = NoiseBasis(noiseBasis);
+		}
+		const char* fractalTypes[] = { "fBm", "Ridged", "Billow" };
+		int noiseFractal = int(m_terrain.noiseFractal);
+		if (ImGui::Combo("Fractal Type", &noiseFractal, fractalTypes, 3)) {
+			m_terrain.noiseFractal = FractalType(noiseFractal);
+		}
+		reweighted |= ImGui::SliderFloat("Mesh Height", &m_terrain.meshHeight, 0.1f, 100.0f, "%.1f", 3.0f);
 		// Water is the same size and resolution as the terrain.
 		if (ImGui::SliderFloat("Mesh Size", &m_terrain.meshScale, 2.0f, 500.0f, "%.1f", 4.0f)) {
 			m_water.meshScale = m_terrain.meshScale; // Water is the same size as the terrain.
 		}
-		if (ImGui::SliderInt("Mesh Resolution", &m_terrain.meshResolution, 10, 500, "%.0f")) {
+		// The compact mesh has no vertex buffer, so it allows a finer grid.
+		int maxResolution = m_terrain.compactMesh ? 1024 : 500;
+		if (ImGui::SliderInt("Mesh Resolution", &m_terrain.meshResolution, 10, maxResolution, "%.0f")) {
 			m_water.meshResolution = m_terrain.meshResolution;
 		}
 		ImGui::SliderFloat("Texture Size", &m_terrain.textureScale, 1.0f, 200.0f, "%.1f");
+		// Both grids are indexed, strips just need fewer indices per quad.
+		bool useStrips = m_terrain.meshTopology == GridTopology::Strips;
+		if (ImGui::Checkbox("Triangle Strips", &useStrips)) {
+			m_terrain.meshTopology = useStrips ? GridTopology::Strips : GridTopology::Triangles;
+			m_water.meshTopology = m_terrain.meshTopology;
+		}
+		// World mode streams tiles of the same noise around the camera instead of one fixed size mesh.
+		if (ImGui::Checkbox("World Mode", &m_terrain.worldMode) && !m_terrain.worldMode) {
+			// Put the water back over the single mesh.
+			m_water.meshCentre = vec2(0.0f);
+			m_water.meshExtent = 0.0f;
+			m_scene.markDirty(m_nodes.waterMesh);
+		}
+		if (m_terrain.worldMode) {
+			TerrainChunks &chunks = m_terrain.worldChunks();
+			ImGui::SliderFloat("Tile Size", &chunks.tileSize, 5.0f, 200.0f, "%.1f", 2.0f);
+			ImGui::SliderInt("Tile Resolution", &chunks.tileResolution, 9, 257, "%.0f");
+			ImGui::SliderInt("View Radius", &chunks.viewRadius, 1, 32, "%.0f");
+			ImGui::SliderInt("Tile Budget (MB)", &chunks.memoryBudgetMB, 16, 2048, "%.0f");
+			ImGui::Text("Tiles: %d loaded, %d pending, radius %d, %.1f MB", chunks.residentTiles(), chunks.pendingTiles(),
+						chunks.effectiveRadius(), chunks.residentBytes() / (1024.0f * 1024.0f));
+		} else {
+			// Distance-based LOD keeps the triangle count roughly constant however large the mesh is.
+			ImGui::Checkbox("Level of Detail", &m_terrain.useLod);
+			if (m_terrain.useLod) {
+				ImGui::SliderFloat("LOD Distance", &m_terrain.lod.detailDistance, 1.0f, 8.0f, "%.1f");
+				ImGui::SliderFloat("Water LOD Bias", &m_water_lod_bias, 0.0f, 3.0f, "%.1f");
+				ImGui::SliderFloat("Shadow LOD Bias", &m_shadow_lod_bias, 0.0f, 3.0f, "%.1f");
+				ImGui::Text("LOD: %d levels, %d nodes, %d triangles", m_terrain.lod.levelCount(),
+							m_terrain.lod.selectedNodes(), m_terrain.lod.triangleCount());
+			}
+			// The compact mesh is drawn from textures alone, so much larger resolutions fit in GPU memory.
+			rebuild |= ImGui::Checkbox("Compact Mesh", &m_terrain.compactMesh);
+			if (m_terrain.compactMesh) {
+				rebuild |= ImGui::Checkbox("16 Bit Heights", &m_terrain.compact.halfHeights);
+				rebuild |= ImGui::Checkbox("Packed Normals", &m_terrain.compact.packedNormals);
+				float vertexCount = float(m_terrain.meshResolution) * m_terrain.meshResolution;
+				ImGui::Text("Compact: %d bytes/vertex, %.2f MB (vertex buffer %.2f MB)", m_terrain.compact.bytesPerVertex(),
+							vertexCount * m_terrain.compact.bytesPerVertex() / (1024.0f * 1024.0f),
+							vertexCount * sizeof(mesh_vertex) / (1024.0f * 1024.0f));
+			} else {
+				// Flat areas and the terrain under the water are drawn with fewer, larger triangles.
+				rebuild |= ImGui::Checkbox("Simplify Mesh", &m_terrain.simplify.enabled);
+				if (m_terrain.simplify.enabled) {
+					SimplifySettings &simplify = m_terrain.simplify;
+					bool resimplify = ImGui::SliderFloat("Max Error", &simplify.maxError, 0.001f, 1.0f, "%.3f", 3.0f);
+					resimplify |= ImGui::SliderFloat("Underwater Error", &simplify.underwaterError, 0.001f, 4.0f, "%.3f", 3.0f);
+					if (resimplify) {
+						m_scene.markDirty(m_nodes.simplifiedMesh);
+					}
+					float gridTriangles = 2.0f * (m_terrain.meshResolution - 1) * (m_terrain.meshResolution - 1);
+					int triangles = m_terrain.terrain.index_count / 3;
+					ImGui::Text("Simplified: %d triangles (%.1f%% of the grid)", triangles, 100.0f * triangles / gridTriangles);
+				}
+			}
+			// Lighting from a normal map of the noise finer than the mesh, so a coarser mesh shades like a fine one.
+			rebuild |= ImGui::Checkbox("Baked Normal Map", &m_terrain.normalMap.enabled);
+			if (m_terrain.normalMap.enabled) {
+				rebuild |= ImGui::SliderInt("Texels per Cell", &m_terrain.normalMap.texelsPerCell, 1, 8);
+				int size = normalMapSize(m_terrain.meshResolution, m_terrain.normalMap.texelsPerCell);
+				ImGui::Text(m_terrain.erosion.enabled ? "Normal map: off while eroding" : "Normal map: %d x %d", size, size);
+			}
+		}
 
-		// Generates the mesh and shaders for terrain and water.
-		if (ImGui::Button("Generate")) {
-			meshNeedsUpdate = true;
-			m_terrain.createMesh();
-			m_terrain.setShaderParams();
-			m_terrain.createHeightMap(m_water.waterHeightProp);
-			m_water.createMesh();
-			m_water.setShaderParams();
-			m_trees.regenerateOnTerrain(&m_terrain);
+		// Erosion runs on the generated heights, so every change rebuilds the terrain.
+		bool eroded = false;
+		if (ImGui::TreeNode("Erosion")) {
+			ErosionSettings &erosion = m_terrain.erosion;
+			eroded |= ImGui::Checkbox("Enable Erosion", &erosion.enabled);
+			if (erosion.enabled) {
+				eroded |= ImGui::SliderInt("Droplets", &erosion.droplets, 0, 1000000);
+				eroded |= ImGui::SliderInt("Droplet Lifetime", &erosion.lifetime, 1, 100);
+				eroded |= ImGui::SliderInt("Erosion Radius", &erosion.radius, 1, 8);
+				eroded |= ImGui::SliderFloat("Inertia", &erosion.inertia, 0.0f, 0.5f, "%.3f");
+				eroded |= ImGui::SliderFloat("Sediment Capacity", &erosion.capacity, 0.5f, 16.0f, "%.1f");
+				eroded |= ImGui::SliderFloat("Erode Rate", &erosion.erodeRate, 0.0f, 1.0f, "%.2f");
+				eroded |= ImGui::SliderFloat("Deposit Rate", &erosion.depositRate, 0.0f, 1.0f, "%.2f");
+				eroded |= ImGui::SliderFloat("Evaporation", &erosion.evaporation, 0.0f, 0.1f, "%.3f");
+				eroded |= ImGui::SliderInt("Thermal Iterations", &erosion.thermalIterations, 0, 200);
+				eroded |= ImGui::SliderFloat("Talus Angle", &erosion.talusAngle, 10.0f, 60.0f, "%.0f deg");
+			}
+			ImGui::TreePop();
+		}
+
+		// Brush edits of the drawn terrain with the left mouse button. Only the brushed area is updated on the GPU.
+		if (!m_terrain.worldMode && ImGui::TreeNode("Sculpt")) {
+			ImGui::Checkbox("Sculpt Mode", &m_sculptMode);
+			BrushSettings &brush = m_terrain.brush;
+			const char* brushModes[] = { "Raise", "Lower", "Smooth", "Flatten" };
+			int brushMode = int(brush.mode);
+			if (ImGui::Combo("Brush", &brushMode, brushModes, 4)) {
+				brush.mode = BrushMode(brushMode);
+			}
+			ImGui::SliderFloat("Brush Radius", &brush.radius, 0.1f, 50.0f, "%.2f", 2.0f);
+			ImGui::SliderFloat("Brush Strength", &brush.strength, 0.1f, 20.0f, "%.1f", 2.0f);
+			ImGui::Text("Generating the terrain again replaces the edits.");
+			ImGui::TreePop();
+		}
+
+		// Terrain generated before with the same settings is loaded from disk instead of evaluating the noise.
+		ImGui::Checkbox("Height Cache", &m_terrain.useHeightCache);
+		if (m_terrain.useHeightCache) {
+			ImGui::SameLine();
+			ImGui::Text(m_terrain.loadedFromCache ? "(loaded from cache)" : "(generated)");
+		}
+
+		// Generates the mesh and shaders for terrain and water. The terrain is built in the background and the old one
+		// keeps drawing until it is ready, then the water and trees follow it before the next frame.
+		bool generate = ImGui::Button("Generate");
+		if (m_regeneration.busy()) {
+			ImGui::SameLine();
+			if (m_terrain.erosion.enabled) {
+				ImGui::ProgressBar(m_terrain.buildProgress->load(), ImVec2(-1, 0), "Eroding");
+			} else {
+				ImGui::Text("Regenerating...");
+			}
+		}
+		if (generate || reweighted || eroded || rebuild) {
+			// Intermediate slider values aren't worth writing to the cache.
+			bool dragged = reweighted || eroded;
+			auto build = make_shared<TerrainBuild>(m_terrain.beginBuild(m_water.waterHeightProp, generate || !dragged));
+			m_regeneration.submit([this, build]() -> RegenerationQueue::Apply {
+				m_terrain.buildTerrain(*build);
+				return [this, build]() {
+					m_terrain.applyTerrain(*build);
+					m_terrain.setShaderParams();
+					m_scene.markDirty(m_nodes.terrain);
+				};
+			});
 		}
 
 		// Texture chooser.
@@ -837,50 +991,57 @@ void Application::renderGUI() {
 		}
 	}
 
-    // L-System parameters that affect mesh generation
+    // L-System parameters. Each only marks what it changes: the L-system settings rebuild the tree mesh, placement
+    // moves the trees, and the leaf settings only move the leaves.
     ImGui::Separator();
     if (ImGui::CollapsingHeader("L-System Parameters")) {
 		// Tree placement parameters
 		if (ImGui::SliderInt("Tree Count", &m_trees.treeCount, 0, 200)) {
-			m_trees.regenerateOnTerrain(&m_terrain);
+			m_scene.markDirty(m_nodes.treeTransforms);
 		}
 
-		if (ImGui::SliderFloat("Branch Angle", &m_trees.lSystem.angle, 10.0f, 45.0f, "%.1f")) {
-			meshNeedsUpdate = true;
-		}
-		if (ImGui::SliderInt("Iterations", &m_trees.lSystem.iterations, 1, 5)) {
-			meshNeedsUpdate = true;
+		// The forest mixes several species, and the settings below edit one of them. Species built before come
+		// from the cache, so switching back to an earlier setting or tree type is instant.
+		bool meshChanged = false;
+		int speciesCount = m_trees.speciesCount();
+		if (ImGui::SliderInt("Species", &speciesCount, 1, TreeGenerator::maxSpecies)) {
+			m_trees.setSpeciesCount(speciesCount);
+			meshChanged = true;
 		}
-		if (ImGui::SliderFloat("Step Length", &m_trees.lSystem.stepLength, 0.1f, 2.0f, "%.2f")) {
-			meshNeedsUpdate = true;
+		if (speciesCount > 1) {
+			ImGui::SliderInt("Edit Species", &m_trees.editedSpecies, 0, speciesCount - 1);
 		}
 
+		LSystem &lSystem = m_trees.lSystem();
+		meshChanged |= ImGui::SliderFloat("Branch Angle", &lSystem.angle, 10.0f, 45.0f, "%.1f");
+		// Up to 8 iterations for hero trees, fewer for rules that would pass the segment budget sooner.
+		meshChanged |= ImGui::SliderInt("Iterations", &lSystem.iterations, 1, m_trees.maxIterations());
+		meshChanged |= ImGui::SliderFloat("Step Length", &lSystem.stepLength, 0.1f, 2.0f, "%.2f");
+
 		// Tree type selection
 		const char* treeTypes[] = {"Simple", "Bushy", "Willow", "3D Tree"};
-		if (ImGui::Combo("Tree Type", &m_treeType, treeTypes, 4)) {
-			m_trees.setTreeType(m_treeType);
-			meshNeedsUpdate = true;
+		int treeType = m_trees.treeType();
+		if (ImGui::Combo("Tree Type", &treeType, treeTypes, 4)) {
+			m_trees.setTreeType(treeType);
+			meshChanged = true;
 		}
 
-		if (ImGui::SliderFloat("Branch Taper", &m_trees.branchTaper, 0.5f, 1.0f, "%.2f")) {
-			meshNeedsUpdate = true;
-		}
-
-		if (ImGui::SliderFloat("Initial Radius", &m_trees.lSystem.initialRadius, 0.01f, 0.5f, "%.3f")) {
-			meshNeedsUpdate = true;
+		meshChanged |= ImGui::SliderFloat("Branch Taper", &lSystem.branchTaper, 0.5f, 1.0f, "%.2f");
+		meshChanged |= ImGui::SliderFloat("Initial Radius", &lSystem.initialRadius, 0.01f, 0.5f, "%.3f");
+		if (meshChanged) {
+			m_scene.markDirty(m_nodes.treeSpecies);
 		}
+		ImGui::Text("Segments per tree: %llu", (unsigned long long)m_trees.segmentCount());
+		ImGui::Text("Cached species: %d of %d%s", m_trees.cachedSpecies(), TreeGenerator::speciesCacheSize,
+					m_trees.buildingSpecies() ? " (building)" : "");
 
 		// Placement parameters that don't affect mesh
-		bool placementNeedsUpdate = false;
-
-		if (ImGui::SliderFloat("Min Scale", &m_trees.minTreeScale, 0.2f, 1.0f, "%.2f")) {
-			placementNeedsUpdate = true;
-		}
-		if (ImGui::SliderFloat("Max Scale", &m_trees.maxTreeScale, 1.0f, 6.0f, "%.2f")) {
-			placementNeedsUpdate = true;
-		}
-		if (ImGui::Checkbox("Random Rotation", &m_trees.randomRotation)) {
-			placementNeedsUpdate = true;
+		bool placementChanged = false;
+		placementChanged |= ImGui::SliderFloat("Min Scale", &m_trees.minTreeScale, 0.2f, 1.0f, "%.2f");
+		placementChanged |= ImGui::SliderFloat("Max Scale", &m_trees.maxTreeScale, 1.0f, 6.0f, "%.2f");
+		placementChanged |= ImGui::Checkbox("Random Rotation", &m_trees.randomRotation);
+		if (placementChanged) {
+			m_scene.markDirty(m_nodes.treeTransforms);
 		}
 
 		ImGui::Separator();
@@ -889,29 +1050,29 @@ void Application::renderGUI() {
 		if (ImGui::Checkbox("Render Leaves", &m_trees.renderLeaves)) {
 			// Just visual toggle
 		}
-		if (ImGui::SliderFloat("Leaf Size", &m_trees.leafSize, 0.1f, 1.0f, "%.2f")) {
-			meshNeedsUpdate = true;
-		}
-		if (ImGui::SliderFloat("Leaf Offset", &m_trees.leafOffset, 0.0f, 1.0f, "%.2f")) {
-			meshNeedsUpdate = true;
+		bool leavesChanged = false;
+		leavesChanged |= ImGui::SliderFloat("Leaf Size", &m_trees.leafSize, 0.1f, 1.0f, "%.2f");
+		leavesChanged |= ImGui::SliderFloat("Leaf Offset", &m_trees.leafOffset, 0.0f, 1.0f, "%.2f");
+		if (leavesChanged) {
+			m_scene.markDirty(m_nodes.leafTransforms);
 		}
 
-		// Apply updates
-		if (meshNeedsUpdate) {
-			m_trees.markMeshDirty();
-			m_trees.regenerateOnTerrain(&m_terrain);
-		} else if (placementNeedsUpdate) {
-			m_trees.regenerateOnTerrain(&m_terrain);
+		// What the last change recomputed, out of every node of the scene graph.
+		const vector<string> &updated = m_scene.lastUpdated();
+		string names;
+		for (const string &name : updated) {
+			names += (names.empty() ? "" : ", ") + name;
 		}
+		ImGui::TextWrapped("Last scene update: %d of %d nodes%s%s", int(updated.size()), m_scene.size(),
+						   names.empty() ? "" : ": ", names.c_str());
 	}
 
 	ImGui::Separator();
     if (ImGui::CollapsingHeader("Water Parameters")) {
+		// The water plane and the heightmap don't depend on the level, only where trees grow and the simplified mesh.
 		if (ImGui::SliderFloat("Water Height", &m_water.waterHeightProp, 0.0f, 0.9f)) {
-			m_water.createMesh();
-			m_water.setShaderParams();
-			m_terrain.createHeightMap(m_water.waterHeightProp);
-			m_trees.regenerateOnTerrain(&m_terrain);
+			m_scene.markDirty(m_nodes.placementMask);
+			m_scene.markDirty(m_nodes.simplifiedMesh);
 		}
 		ImGui::SliderFloat("Water Opacity", &m_water.waterAlpha, 0.0f, 1.0f);
 		ImGui::SliderFloat("Water Speed", &m_water.waterSpeed, 0.0f, 0.15f);
@@ -1094,8 +1255,40 @@ void Application::renderGUI() {
 }
 
 
+// Applies the sculpting brush where the cursor ray hits the terrain, for as long as the left button is held down.
+void Application::sculptTerrain(const mat4 &view, const mat4 &proj) {
+	bool brushing = m_sculptMode && m_leftMouseDown && !m_terrain.worldMode;
+	if (!brushing) {
+		if (m_sculptStroke) {
+			m_sculptStroke = false;
+			// The edited heights move the ground trees can grow on.
+			m_scene.markDirty(m_nodes.placementMask);
+			m_scene.markDirty(m_nodes.simplifiedMesh);
+		}
+		return;
+	}
+
+	// Ray through the cursor, in the terrain's model space.
+	vec2 ndc(2.0f * m_mousePosition.x / m_windowsize.x - 1.0f, 1.0f - 2.0f * m_mousePosition.y / m_windowsize.y);
+	mat4 inverseViewProj = inverse(proj * view * m_terrain.modelTransform);
+	vec4 nearPoint = inverseViewProj * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProj * vec4(ndc, 1.0f, 1.0f);
+	vec3 origin = vec3(nearPoint) / nearPoint.w;
+	vec3 direction = normalize(vec3(farPoint) / farPoint.w - origin);
+	vec3 hit;
+	if (!m_terrain.heightfield.raycast(origin, direction, hit)) return;
+
+	vec2 position(hit.x, hit.z);
+	if (!m_sculptStroke) {
+		m_sculptStroke = true;
+		m_terrain.beginSculpt(position);
+	}
+	m_terrain.sculpt(position, ImGui::GetIO().DeltaTime);
+}
+
+
 void Application::cursorPosCallback(double xpos, double ypos) {
-	if (m_leftMouseDown) {
+	if (m_leftMouseDown && !m_sculptMode) {
 		vec2 whsize = m_windowsize / 2.0f;
 
 		// clamp the pitch to [-pi/2, pi/2]
@@ -1219,6 +1412,46 @@ void Application::updateLightFromSun() {
 	m_terrain.lightColor = getSunColor(m_sunElevation) * m_sunIntensity;
 }
 
+void Application::updateWorld() {
+	m_terrain.updateWorld(cameraPosition);
+
+	// Keep the water plane under the loaded tiles. It moves in steps of its own grid spacing so the waves don't swim.
+	TerrainChunks &chunks = m_terrain.worldChunks();
+	float extent = chunks.tileSize * (chunks.effectiveRadius() + 1);
+	float spacing = 2.0f * extent / (m_water.meshResolution - 1);
+	vec2 centre = round(vec2(cameraPosition.x, cameraPosition.z) / spacing) * spacing;
+	if (centre != m_water.meshCentre || extent != m_water.meshExtent) {
+		m_water.meshCentre = centre;
+		m_water.meshExtent = extent;
+		m_water.createMesh();
+	}
+}
+
+// Nodes in dependency order. The terrain build makes the noise field, mesh, height range, heightmap and tree
+// eligibility together in the background, with caches of its own (see TerrainGenerator), so it is one node here that
+// is marked when a build is applied. The water level and sculpting change the eligibility and the simplified mesh,
+// neither of which the water plane or the heightmap depend on.
+void Application::buildSceneGraph() {
+	m_nodes.terrain = m_scene.add("terrain", nullptr);
+	m_nodes.waterMesh = m_scene.add("water mesh", [this]() {
+		m_water.createMesh();
+		m_water.setShaderParams();
+	}, { m_nodes.terrain });
+	m_nodes.placementMask = m_scene.add("placement mask", [this]() {
+		m_terrain.setWaterLevel(m_water.waterHeightProp);
+	});
+	m_nodes.simplifiedMesh = m_scene.add("simplified mesh", [this]() { m_terrain.simplifyMesh(); });
+	m_nodes.treeSpecies = m_scene.add("tree species", [this]() { m_trees.updateSpecies(); });
+	m_nodes.treeTransforms = m_scene.add("tree transforms", [this]() { m_trees.placeTrees(m_terrain.heightfield); },
+										 { m_nodes.terrain, m_nodes.placementMask });
+	m_nodes.leafTransforms = m_scene.add("leaf transforms", [this]() { m_trees.placeLeaves(); },
+										 { m_nodes.treeTransforms, m_nodes.treeSpecies });
+	m_nodes.treeInstances = m_scene.add("tree instances", [this]() { m_trees.uploadTreeInstances(); },
+										{ m_nodes.treeTransforms, m_nodes.treeSpecies });
+	m_nodes.leafInstances = m_scene.add("leaf instances", [this]() { m_trees.uploadLeafInstances(); },
+										{ m_nodes.leafTransforms });
+}
+
 glm::mat4 Application::getLightSpaceMatrix() const {
 	// Calculate sun direction from angles
 	float azimuthRad = radians(m_sunAzimuth);
@@ -1229,12 +1462,18 @@ glm::mat4 Application::getLightSpaceMatrix() const {
 	sunDirection.y = sin(elevationRad);
 	sunDirection.z = cos(elevationRad) * sin(azimuthRad);
 
-	vec3 lightPos = normalize(sunDirection) * 250.0f;
-
 	// Orthographic projection covering the terrain
 	// Adjust size based on sun elevation (larger when sun is low for longer shadows)
 	float elevationFactor = std::max(0.3f, abs(sin(elevationRad)));
 	float orthoSize = m_terrain.meshScale * 1.5f / elevationFactor;
+
+	// The shadow map follows the camera in world mode, moving in whole texels so the edges don't shimmer.
+	vec3 centre(0.0f);
+	if (m_terrain.worldMode) {
+		float texelSize = 2.0f * orthoSize / m_shadow_map_size;
+		centre = vec3(round(cameraPosition.x / texelSize) * texelSize, 0.0f, round(cameraPosition.z / texelSize) * texelSize);
+	}
+	vec3 lightPos = centre + normalize(sunDirection) * 250.0f;
 	mat4 lightProjection = glm::ortho(
 		-orthoSize, orthoSize,
 		-orthoSize, orthoSize,
@@ -1244,7 +1483,7 @@ glm::mat4 Application::getLightSpaceMatrix() const {
 	// Look from light position toward scene center
 	mat4 lightView = glm::lookAt(
 		lightPos,
-		vec3(0.0f, 0.0f, 0.0f),  // Look at origin
+		centre,  // Look at origin (or the camera in world mode)
 		vec3(0.0f, 1.0f, 0.0f)   // Up vector
 	);
 
@@ -1288,21 +1527,15 @@ void Application::renderShadowMap() {
 	// render terrain
 	glUniform1i(glGetUniformLocation(m_shadow_depth_shader, "uUseInstancing"), 0);
 	glUniform1i(glGetUniformLocation(m_shadow_depth_shader, "uRenderingLeaves"), 0);
-	m_terrain.terrain.draw();
+	m_terrain.drawGeometry(m_shadow_depth_shader, lightSpaceMatrix, cameraPosition, m_shadow_lod_bias);
 
 	// render trees
 	if (!m_trees.treeTransforms.empty()) {
 		glUniform1i(glGetUniformLocation(m_shadow_depth_shader, "uUseInstancing"), 1);
 		glUniform1i(glGetUniformLocation(m_shadow_depth_shader, "uRenderingLeaves"), 0);
 
-		// Bind tree mesh VAO (with instance attributes already set up)
-		glBindVertexArray(m_trees.treeMesh.vao);
-		glDrawElementsInstanced(GL_TRIANGLES,
-							   m_trees.treeMesh.index_count,
-							   GL_UNSIGNED_INT,
-							   0,
-							   m_trees.treeTransforms.size());
-		glBindVertexArray(0);
+		// One call per species, each VAO with its instance attributes already set up
+		m_trees.drawTreeInstances();
 	}
 
 	// render leaves
@@ -1318,13 +1551,7 @@ void Application::renderShadowMap() {
 		// Disable culling for leaves
 		glDisable(GL_CULL_FACE);
 
-		glBindVertexArray(m_trees.leafMesh.vao);
-		glDrawElementsInstanced(GL_TRIANGLES,
-							   m_trees.leafMesh.index_count,
-							   GL_UNSIGNED_INT,
-							   0,
-							   m_trees.leafTransforms.size());
-		glBindVertexArray(0);
+		m_trees.drawLeafInstances();
 
 		glEnable(GL_CULL_FACE);
 	}
@@ -11,6 +11,8 @@
 #include "perlin_noise.hpp"
 #include "tree_generator.hpp"
 #include "water.hpp"
+#include "regeneration.hpp"
+#include "derived_graph.hpp"
 
 
 // Basic model that holds the shader, mesh and transform for drawing.
@@ -44,6 +46,10 @@ private:
 	bool m_leftMouseDown = false;
 	glm::vec2 m_mousePosition;
 
+	// Terrain sculpting. In sculpt mode the left mouse button paints with the brush instead of turning the camera.
+	bool m_sculptMode = false;
+	bool m_sculptStroke = false; // Whether the brush is on the terrain.
+
 	// drawing flags
 	bool m_show_axis = false;
 	bool m_show_grid = false;
@@ -53,7 +59,15 @@ private:
 	PerlinNoise m_terrain;
 	TreeGenerator m_trees;
 	Water m_water;
-	int m_treeType = 3;
+	RegenerationQueue m_regeneration; // Terrain rebuilds in the background. Declared after the scene it writes to, so it stops first.
+
+	// What the scene derives from the terrain and the GUI settings. A change marks the nodes it affects dirty and
+	// render() recomputes just those before the frame draws (see buildSceneGraph for the dependencies).
+	DerivedGraph m_scene;
+	struct SceneNodes {
+		DerivedGraph::Node terrain, waterMesh, placementMask, simplifiedMesh, treeSpecies, treeTransforms, leafTransforms,
+			treeInstances, leafInstances;
+	} m_nodes;
 
 	// First person camera movement.
 	glm::vec3 cameraPosition{ 0.0f, 20.0f, 0.0f };
@@ -80,6 +94,7 @@ private:
 	int m_shadow_map_size = 4096;
 	bool m_enable_shadows = true;
 	bool m_use_pcf = true;
+	float m_shadow_lod_bias = 1.0f; // Terrain LOD levels coarser than the main view.
 
 	// Fog
 	bool useFog = true;
@@ -98,6 +113,7 @@ private:
 	bool m_enable_water_reflections = true;
 	float m_water_wave_strength = 0.03f;
 	float m_water_reflection_blend = 0.7f;
+	float m_water_lod_bias = 1.0f; // Terrain LOD levels coarser than the main view.
 
 	// Lens flare post-processing
 	GLuint m_scene_fbo = 0;
@@ -154,6 +170,9 @@ private:
 
 	// Helper functions
 	void updateLightFromSun();
+	void updateWorld();
+	void buildSceneGraph();
+	void sculptTerrain(const glm::mat4 &view, const glm::mat4 &proj);
 	glm::vec3 getSunColor(float elevation);
 	glm::vec3 getSkyColor(float elevation);
 	void renderShadowMap();
@@ -15,8 +15,15 @@ namespace cgra {
 		if (vao == 0) return;
 		// bind our VAO which sets up all our buffers and data for us
 		glBindVertexArray(vao);
+		if (primitive_restart) {
+			glEnable(GL_PRIMITIVE_RESTART);
+			glPrimitiveRestartIndex(restart_index);
+		}
 		// tell opengl to draw our VAO using the draw mode and how many verticies to render
 		glDrawElements(mode, index_count, GL_UNSIGNED_INT, 0);
+		if (primitive_restart) {
+			glDisable(GL_PRIMITIVE_RESTART);
+		}
 	}
 
 	void gl_mesh::destroy() {
@@ -28,6 +35,11 @@ namespace cgra {
 
 
 	gl_mesh mesh_builder::build() const {
+		return build_mesh(vertices, indices, mode);
+	}
+
+
+	gl_mesh build_mesh(const std::vector<mesh_vertex> &vertices, const std::vector<GLuint> &indices, GLenum mode) {
 
 		gl_mesh m;
 		glGenVertexArrays(1, &m.vao); // VAO stores information about how the buffers are set up
@@ -76,4 +88,32 @@ namespace cgra {
 
 		return m;
 	}
+
+
+	gl_mesh build_mesh(const std::vector<mesh_vertex> &vertices, GLuint shared_ibo, int index_count, GLenum mode) {
+
+		gl_mesh m;
+		glGenVertexArrays(1, &m.vao);
+		glGenBuffers(1, &m.vbo);
+		glBindVertexArray(m.vao);
+
+		// same interleaved layout as above
+		glBindBuffer(GL_ARRAY_BUFFER, m.vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(mesh_vertex), vertices.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, pos)));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, norm)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(mesh_vertex), (void *)(offsetof(mesh_vertex, uv)));
+
+		// the VAO remembers the shared IBO, but m.ibo stays 0 so destroy() leaves it alone
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, shared_ibo);
+
+		m.index_count = index_count;
+		m.mode = mode;
+		glBindVertexArray(0);
+
+		return m;
+	}
 }
\ No newline at end of file
@@ -10,6 +10,7 @@
 
 // project
 #include <opengl.hpp>
+#include "cgra_vertex.hpp"
 
 
 
@@ -26,6 +27,7 @@ namespace cgra {
 		GLuint ibo = 0;
 		GLenum mode = 0; // mode to draw in, eg: GL_TRIANGLES
 		int index_count = 0; // how many indicies to draw (no primitives)
+		bool primitive_restart = false; // restart strips at restart_index while drawing
 
 		// calls the draw function on mesh data
 		void draw();
@@ -35,11 +37,16 @@ namespace cgra {
 	};
 
 
-	struct mesh_vertex {
-		glm::vec3 pos{0};
-		glm::vec3 norm{0};
-		glm::vec2 uv{0};
-	};
+	// uploads vertex and index data into a new gl_mesh (what mesh_builder::build uses)
+	// useful when the data is already in vectors and copying it into a mesh_builder would be wasteful
+	gl_mesh build_mesh(const std::vector<mesh_vertex> &vertices, const std::vector<GLuint> &indices, GLenum mode = GL_TRIANGLES);
+	inline gl_mesh build_mesh(const mesh_data &data, GLenum mode = GL_TRIANGLES) {
+		return build_mesh(data.vertices, data.indices, mode);
+	}
+
+	// same as above but draws through an existing index buffer shared by several meshes (eg: terrain tiles)
+	// the caller owns shared_ibo, destroy() on the returned mesh does not delete it
+	gl_mesh build_mesh(const std::vector<mesh_vertex> &vertices, GLuint shared_ibo, int index_count, GLenum mode = GL_TRIANGLES);
 
 
 	// Mesh builder object used to create an mesh by taking vertex and index information
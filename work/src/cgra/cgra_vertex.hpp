@@ -0,0 +1,31 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+
+namespace cgra {
+
+	// Vertex layout shared by every mesh (see gl_mesh for the attribute locations).
+	// Kept apart from cgra_mesh.hpp so geometry can be generated without including OpenGL.
+	struct mesh_vertex {
+		glm::vec3 pos{0};
+		glm::vec3 norm{0};
+		glm::vec2 uv{0};
+	};
+
+
+	// index value that ends the current strip when a mesh uses primitive restart
+	const unsigned int restart_index = 0xFFFFFFFF;
+
+
+	// vertices and indices of a mesh before it is uploaded (see build_mesh)
+	struct mesh_data {
+		std::vector<mesh_vertex> vertices;
+		std::vector<unsigned int> indices;
+	};
+}
@@ -0,0 +1,48 @@
+// std
+#include <cassert>
+
+// project
+#include "derived_graph.hpp"
+
+using namespace std;
+
+
+DerivedGraph::Node DerivedGraph::add(const string &name, Recompute recompute, initializer_list<Node> inputs) {
+	Node node = int(m_nodes.size());
+	for (Node input : inputs) {
+		assert(input >= 0 && input < node);
+		m_nodes[input].outputs.push_back(node);
+	}
+	m_nodes.push_back(NodeData{ name, move(recompute), {} });
+	return node;
+}
+
+
+// Everything below a dirty node is already dirty, so the walk stops at nodes that are.
+void DerivedGraph::markDirty(Node node) {
+	vector<Node> stack{ node };
+	while (!stack.empty()) {
+		NodeData &data = m_nodes[stack.back()];
+		stack.pop_back();
+		if (data.dirty) continue;
+		data.dirty = true;
+		stack.insert(stack.end(), data.outputs.begin(), data.outputs.end());
+	}
+}
+
+
+// Nodes are stored in dependency order, so one pass sees every input before the nodes that use it.
+int DerivedGraph::update() {
+	vector<string> updated;
+	for (NodeData &data : m_nodes) {
+		if (!data.dirty) continue;
+		data.dirty = false;
+		if (data.recompute) data.recompute();
+		updated.push_back(data.name);
+	}
+	int count = int(updated.size());
+	if (count > 0) {
+		m_lastUpdated = move(updated);
+	}
+	return count;
+}
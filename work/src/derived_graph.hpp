@@ -0,0 +1,44 @@
+#pragma once
+
+// std
+#include <functional>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+
+// Data derived from other data (meshes from heights, transforms from placement, buffers from transforms), each node
+// with the function that recomputes it. A change marks the node it affects dirty, which marks everything derived
+// from it as well, and update() recomputes the dirty nodes once each, inputs first. Several changes in the same
+// frame share one recompute, and nodes not downstream of a change are left alone.
+class DerivedGraph {
+public:
+	using Node = int;
+	using Recompute = std::function<void()>;
+
+	// Adds a node computed from inputs. Inputs must already be in the graph, so nodes are added in dependency order
+	// (and the graph can't have cycles). New nodes start dirty. An empty recompute is a node whose data is produced
+	// elsewhere, marking it dirty only passes the change on.
+	Node add(const std::string &name, Recompute recompute, std::initializer_list<Node> inputs = {});
+	// Marks node and every node derived from it for recomputing.
+	void markDirty(Node node);
+	bool dirty(Node node) const { return m_nodes[node].dirty; }
+	// Recomputes the dirty nodes in dependency order. Recompute functions shouldn't mark nodes dirty.
+	// Returns how many nodes ran.
+	int update();
+
+	int size() const { return int(m_nodes.size()); }
+	const std::string &name(Node node) const { return m_nodes[node].name; }
+	// Names of the nodes recomputed by the last update that recomputed any, in the order they ran.
+	const std::vector<std::string> &lastUpdated() const { return m_lastUpdated; }
+
+private:
+	struct NodeData {
+		std::string name;
+		Recompute recompute;
+		std::vector<Node> outputs; // Nodes with this one as an input.
+		bool dirty = true;
+	};
+	std::vector<NodeData> m_nodes; // In dependency order.
+	std::vector<std::string> m_lastUpdated;
+};
@@ -0,0 +1,337 @@
+// std
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <random>
+
+// glm
+#include <glm/gtc/constants.hpp>
+
+// project
+#include "erosion.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+namespace {
+	// Number of droplet rounds. Each round moves the tile grid, so the tile edges don't leave seams.
+	const int erosionRounds = 4;
+
+	// The murmur3 finaliser, for seeding the per tile random generators.
+	uint32_t mix32(uint32_t h) {
+		h ^= h >> 16;
+		h *= 0x85ebca6bu;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	uint32_t combine(uint32_t a, uint32_t b) {
+		return mix32(a ^ (b + 0x9e3779b9u + (a << 6) + (a >> 2)));
+	}
+
+	// Uniform float in [0, 1) from the generator's raw bits (the std distributions differ between libraries).
+	float unitFloat(mt19937 &rng) {
+		return (rng() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	// Vertices within radius of a droplet, weighted by how close they are (the weights sum to 1).
+	struct Brush {
+		vector<int> di, dj;
+		vector<float> weight;
+	};
+
+	Brush makeBrush(int radius) {
+		Brush brush;
+		float total = 0.0f;
+		for (int di = -radius; di <= radius; di++) {
+			for (int dj = -radius; dj <= radius; dj++) {
+				float weight = radius - sqrt(float(di * di + dj * dj));
+				if (weight <= 0.0f) continue;
+				brush.di.push_back(di);
+				brush.dj.push_back(dj);
+				brush.weight.push_back(weight);
+				total += weight;
+			}
+		}
+		for (float &weight : brush.weight) {
+			weight /= total;
+		}
+		return brush;
+	}
+
+	// Vertex rectangle [i0, i1) x [j0, j1).
+	struct Region {
+		int i0, i1, j0, j1;
+	};
+
+	// Bilinear height (z) and its gradient (x along i, y along j) at a grid position.
+	vec3 heightAndGradient(const float *map, int resolution, vec2 pos) {
+		int i = int(pos.x);
+		int j = int(pos.y);
+		vec2 f = pos - vec2(i, j);
+		int index = i * resolution + j;
+		float h00 = map[index];
+		float h01 = map[index + 1];
+		float h10 = map[index + resolution];
+		float h11 = map[index + resolution + 1];
+		float gradI = (h10 - h00) * (1.0f - f.y) + (h11 - h01) * f.y;
+		float gradJ = (h01 - h00) * (1.0f - f.x) + (h11 - h10) * f.x;
+		float height = mix(mix(h00, h01, f.y), mix(h10, h11, f.y), f.x);
+		return vec3(gradI, gradJ, height);
+	}
+
+	// One droplet from pos until it evaporates or would touch a vertex outside its tile's region.
+	void simulateDroplet(float *map, int resolution, const Brush &brush, const ErosionSettings &settings,
+						 const Region &region, vec2 pos) {
+		// Nodes inside these bounds keep the brush, the deposit and the bilinear reads within the region.
+		int margin = std::max(1, settings.radius);
+		int iMin = region.i0 + settings.radius, iMax = region.i1 - 1 - margin;
+		int jMin = region.j0 + settings.radius, jMax = region.j1 - 1 - margin;
+		auto inside = [&](vec2 p) {
+			int i = int(p.x), j = int(p.y);
+			return p.x >= 0.0f && p.y >= 0.0f && i >= iMin && i < iMax && j >= jMin && j < jMax;
+		};
+
+		vec2 direction(0.0f);
+		float speed = 1.0f;
+		float water = 1.0f;
+		float sediment = 0.0f;
+		for (int step = 0; step < settings.lifetime && inside(pos); step++) {
+			int i = int(pos.x);
+			int j = int(pos.y);
+			vec2 f = pos - vec2(i, j);
+			int index = i * resolution + j;
+
+			// Turn downhill, keeping some of the previous direction, and move one cell.
+			vec3 sample = heightAndGradient(map, resolution, pos);
+			direction = direction * settings.inertia - vec2(sample) * (1.0f - settings.inertia);
+			float length = glm::length(direction);
+			if (length < 1e-8f) break;
+			direction /= length;
+			pos += direction;
+			if (!inside(pos)) break;
+			float deltaHeight = heightAndGradient(map, resolution, pos).z - sample.z;
+
+			float capacity = std::max(-deltaHeight, settings.minSlope) * speed * water * settings.capacity;
+			if (sediment > capacity || deltaHeight > 0.0f) {
+				// Uphill fills the pit behind the droplet, otherwise drop part of the excess. Spread over the
+				// cell's corners bilinearly.
+				float amount = deltaHeight > 0.0f ? std::min(deltaHeight, sediment) : (sediment - capacity) * settings.depositRate;
+				sediment -= amount;
+				map[index] += amount * (1.0f - f.x) * (1.0f - f.y);
+				map[index + 1] += amount * (1.0f - f.x) * f.y;
+				map[index + resolution] += amount * f.x * (1.0f - f.y);
+				map[index + resolution + 1] += amount * f.x * f.y;
+			} else {
+				// Erode over the brush, never more than the height difference so no pits are dug.
+				float amount = std::min((capacity - sediment) * settings.erodeRate, -deltaHeight);
+				for (size_t b = 0; b < brush.weight.size(); b++) {
+					float &height = map[(i + brush.di[b]) * resolution + j + brush.dj[b]];
+					float eroded = std::min(amount * brush.weight[b], std::max(0.0f, height));
+					height -= eroded;
+					sediment += eroded;
+				}
+			}
+
+			speed = sqrt(std::max(0.0f, speed * speed - deltaHeight * settings.gravity));
+			water *= 1.0f - settings.evaporation;
+		}
+	}
+
+	// Droplets in rounds of four phases. Tiles of the same phase are a whole tile apart, and a droplet only touches
+	// vertices within halo of its tile, so every tile in a phase can run at once. Each tile runs its droplets in
+	// order from its own seed, so the result is the same for any thread count.
+	void hydraulicErosion(vector<float> &map, int resolution, const ErosionSettings &settings, uint32_t seed,
+						  const function<void(float)> &progress) {
+		Brush brush = makeBrush(std::max(1, settings.radius));
+		int halo = settings.lifetime + settings.radius + 2;
+		int tileSize = 2 * halo;
+		int tilesAcross = (resolution + tileSize - 1) / tileSize + 1; // One spare for the offset.
+		int phasesDone = 0;
+
+		for (int round = 0; round < erosionRounds; round++) {
+			// This round's droplets, split across the tiles by area.
+			int roundDroplets = settings.droplets / erosionRounds + (round < settings.droplets % erosionRounds ? 1 : 0);
+			uint32_t roundSeed = combine(seed, uint32_t(round));
+			int offsetI = int(combine(roundSeed, 1u) % uint32_t(tileSize));
+			int offsetJ = int(combine(roundSeed, 2u) % uint32_t(tileSize));
+
+			for (int phase = 0; phase < 4; phase++) {
+				vector<int> tiles;
+				for (int ti = phase & 1; ti < tilesAcross; ti += 2) {
+					for (int tj = phase >> 1; tj < tilesAcross; tj += 2) {
+						tiles.push_back(ti * tilesAcross + tj);
+					}
+				}
+
+				parallelFor(0, int(tiles.size()), [&](int begin, int end) {
+					for (int t = begin; t < end; t++) {
+						int ti = tiles[t] / tilesAcross;
+						int tj = tiles[t] % tilesAcross;
+						Region core{ std::max(0, ti * tileSize - offsetI), std::min(resolution - 1, (ti + 1) * tileSize - offsetI),
+									 std::max(0, tj * tileSize - offsetJ), std::min(resolution - 1, (tj + 1) * tileSize - offsetJ) };
+						if (core.i0 >= core.i1 || core.j0 >= core.j1) continue;
+						Region region{ std::max(0, core.i0 - halo), std::min(resolution, core.i1 + halo),
+									   std::max(0, core.j0 - halo), std::min(resolution, core.j1 + halo) };
+
+						// Share of the droplets from the cells before this tile to the end of it, so the counts
+						// always add up to roundDroplets.
+						int64_t cells = int64_t(resolution - 1) * (resolution - 1);
+						int64_t before = int64_t(core.i0) * (resolution - 1) + int64_t(core.i1 - core.i0) * core.j0;
+						int64_t after = before + int64_t(core.i1 - core.i0) * (core.j1 - core.j0);
+						int first = int(roundDroplets * before / cells);
+						int last = int(roundDroplets * after / cells);
+
+						mt19937 rng(combine(roundSeed, uint32_t(tiles[t]) + 3u));
+						for (int d = first; d < last; d++) {
+							vec2 start(core.i0 + unitFloat(rng) * (core.i1 - core.i0), core.j0 + unitFloat(rng) * (core.j1 - core.j0));
+							simulateDroplet(map.data(), resolution, brush, settings, region, start);
+						}
+					}
+				});
+
+				if (progress) progress(float(++phasesDone) / (erosionRounds * 4));
+			}
+		}
+	}
+
+	// Moves material off every slope steeper than talus (normalised height per cell) towards the lower
+	// neighbours. Each iteration reads the old heights and writes new ones, so the vertices are independent.
+	void thermalErosion(vector<float> &map, int resolution, float talus, const ErosionSettings &settings,
+						const function<void(float)> &progress) {
+		const int di[8] = { -1, 1, 0, 0, -1, -1, 1, 1 };
+		const int dj[8] = { 0, 0, -1, 1, -1, 1, -1, 1 };
+		const float limit[8] = { talus, talus, talus, talus, talus * root_two<float>(), talus * root_two<float>(),
+								 talus * root_two<float>(), talus * root_two<float>() };
+
+		int count = resolution * resolution;
+		vector<float> outflow(count), share(count), next(count);
+		for (int iteration = 0; iteration < settings.thermalIterations; iteration++) {
+			// How much leaves each vertex, and per unit of excess slope how much goes to each lower neighbour.
+			parallelFor(0, resolution, [&](int rowBegin, int rowEnd) {
+				for (int i = rowBegin; i < rowEnd; i++) {
+					for (int j = 0; j < resolution; j++) {
+						float height = map[i * resolution + j];
+						float total = 0.0f, steepest = 0.0f;
+						for (int k = 0; k < 8; k++) {
+							int ni = i + di[k], nj = j + dj[k];
+							if (ni < 0 || nj < 0 || ni >= resolution || nj >= resolution) continue;
+							float excess = height - map[ni * resolution + nj] - limit[k];
+							if (excess <= 0.0f) continue;
+							total += excess;
+							steepest = std::max(steepest, excess);
+						}
+						float moved = settings.thermalRate * steepest * 0.5f;
+						outflow[i * resolution + j] = moved;
+						share[i * resolution + j] = total > 0.0f ? moved / total : 0.0f;
+					}
+				}
+			});
+
+			// Each vertex loses its outflow and gathers its share from every higher neighbour.
+			parallelFor(0, resolution, [&](int rowBegin, int rowEnd) {
+				for (int i = rowBegin; i < rowEnd; i++) {
+					for (int j = 0; j < resolution; j++) {
+						float height = map[i * resolution + j];
+						float gathered = 0.0f;
+						for (int k = 0; k < 8; k++) {
+							int ni = i + di[k], nj = j + dj[k];
+							if (ni < 0 || nj < 0 || ni >= resolution || nj >= resolution) continue;
+							int neighbour = ni * resolution + nj;
+							float excess = map[neighbour] - height - limit[k];
+							if (excess > 0.0f) gathered += share[neighbour] * excess;
+						}
+						next[i * resolution + j] = height - outflow[i * resolution + j] + gathered;
+					}
+				}
+			});
+			map.swap(next);
+
+			if (progress) progress(float(iteration + 1) / settings.thermalIterations);
+		}
+	}
+}
+
+
+uint32_t ErosionSettings::hash() const {
+	if (!enabled) return 0;
+	int32_t ints[] = { droplets, lifetime, radius, thermalIterations };
+	float floats[] = { inertia, capacity, minSlope, erodeRate, depositRate, evaporation, gravity, talusAngle, thermalRate };
+	uint32_t h = 0x45524f44u;
+	for (int32_t value : ints) {
+		h = combine(h, uint32_t(value));
+	}
+	for (float value : floats) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		h = combine(h, bits);
+	}
+	return h == 0 ? 1 : h;
+}
+
+
+void erodeHeights(vector<float> &heights, int resolution, float cellSize, const ErosionSettings &settings,
+				  uint32_t seed, const function<void(float)> &progress) {
+	if (resolution < 4) return;
+
+	// Normalise to [0, 1], so the settings don't depend on the mesh height.
+	auto range = minmax_element(heights.begin(), heights.end());
+	float low = *range.first;
+	float span = *range.second - low;
+	if (span < 1e-6f) return;
+	for (float &height : heights) {
+		height = (height - low) / span;
+	}
+
+	// Split the progress between the passes by a rough estimate of their work.
+	double hydraulicWork = double(std::max(0, settings.droplets)) * settings.lifetime * 4.0;
+	double thermalWork = double(std::max(0, settings.thermalIterations)) * resolution * resolution * 2.0;
+	float hydraulicShare = float(hydraulicWork / std::max(1.0, hydraulicWork + thermalWork));
+
+	if (settings.droplets > 0 && settings.lifetime > 0) {
+		hydraulicErosion(heights, resolution, settings, seed, [&](float done) {
+			if (progress) progress(done * hydraulicShare);
+		});
+	}
+	if (settings.thermalIterations > 0) {
+		float talus = tan(radians(settings.talusAngle)) * cellSize / span;
+		thermalErosion(heights, resolution, talus, settings, [&](float done) {
+			if (progress) progress(hydraulicShare + done * (1.0f - hydraulicShare));
+		});
+	}
+
+	for (float &height : heights) {
+		height = low + height * span;
+	}
+}
+
+
+void heightNormals(const vector<float> &heights, int resolution, float cellSize, vector<vec3> &normals) {
+	normals.resize(heights.size());
+	GridRect grid;
+	grid.i1 = resolution - 1;
+	grid.j1 = resolution - 1;
+	heightNormals(heights, resolution, cellSize, grid, normals);
+}
+
+
+// Edges use one-sided differences.
+void heightNormals(const vector<float> &heights, int resolution, float cellSize, const GridRect &rect,
+				   vector<vec3> &normals) {
+	if (rect.empty()) return;
+	parallelFor(rect.i0, rect.i1 + 1, [&](int rowBegin, int rowEnd) {
+		for (int i = rowBegin; i < rowEnd; i++) {
+			int i0 = std::max(0, i - 1), i1 = std::min(resolution - 1, i + 1);
+			for (int j = rect.j0; j <= rect.j1; j++) {
+				int j0 = std::max(0, j - 1), j1 = std::min(resolution - 1, j + 1);
+				float dx = (heights[i1 * resolution + j] - heights[i0 * resolution + j]) / ((i1 - i0) * cellSize);
+				float dz = (heights[i * resolution + j1] - heights[i * resolution + j0]) / ((j1 - j0) * cellSize);
+				normals[i * resolution + j] = normalize(vec3(-dx, 1.0f, -dz));
+			}
+		}
+	});
+}
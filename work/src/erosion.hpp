@@ -0,0 +1,52 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "grid_indices.hpp"
+
+
+// Erosion applied to the generated heights before the mesh is built. Both passes work on heights normalised to
+// [0, 1], so the defaults behave the same for any mesh height.
+struct ErosionSettings {
+	bool enabled = false;
+
+	// Hydraulic: droplets that pick up sediment going downhill and drop it where they slow down.
+	int droplets = 200000;
+	int lifetime = 30; // Steps a droplet moves before it evaporates, each about one cell.
+	int radius = 3; // Cells eroded around the droplet.
+	float inertia = 0.05f; // How much a droplet keeps its direction instead of following the slope.
+	float capacity = 4.0f; // Sediment carried per unit of speed, water and slope.
+	float minSlope = 0.01f; // Stops the capacity reaching zero on flat ground.
+	float erodeRate = 0.3f;
+	float depositRate = 0.3f;
+	float evaporation = 0.01f;
+	float gravity = 4.0f;
+
+	// Thermal: material slides off any slope steeper than the talus angle.
+	int thermalIterations = 20;
+	float talusAngle = 35.0f; // Degrees, measured on the terrain at its real size.
+	float thermalRate = 0.5f; // Fraction of the excess moved each iteration.
+
+	// 0 when disabled, otherwise a hash of every setting (part of the height cache key).
+	uint32_t hash() const;
+};
+
+// Runs hydraulic then thermal erosion on a resolution x resolution grid of heights (vertex (i, j) is
+// i * resolution + j) with cellSize world units between vertices. The result only depends on the heights, the
+// settings and the seed, not on the thread count: droplets are seeded per tile and tiles that run at the same time
+// never write to the same vertices. progress is called between passes with the fraction done.
+void erodeHeights(std::vector<float> &heights, int resolution, float cellSize, const ErosionSettings &settings,
+				  uint32_t seed, const std::function<void(float)> &progress = nullptr);
+
+// Vertex normals from central differences of the heights, for after erosion (the noise gradients no longer match).
+void heightNormals(const std::vector<float> &heights, int resolution, float cellSize, std::vector<glm::vec3> &normals);
+// The same for only the vertices in rect, leaving the other normals as they are (normals must already be sized).
+void heightNormals(const std::vector<float> &heights, int resolution, float cellSize, const GridRect &rect,
+				   std::vector<glm::vec3> &normals);
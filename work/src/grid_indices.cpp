@@ -0,0 +1,75 @@
+// std
+#include <algorithm>
+
+// project
+#include "grid_indices.hpp"
+#include "parallel.hpp"
+#include "cgra/cgra_vertex.hpp"
+
+using namespace std;
+using namespace cgra;
+
+
+vector<unsigned int> gridIndices(int rows, int cols, GridTopology topology) {
+	int quadRows = rows - 1;
+	int quadCols = cols - 1;
+	if (quadRows <= 0 || quadCols <= 0) return {};
+
+	if (topology == GridTopology::Strips) {
+		// Each strip zig-zags between row i and i + 1, then a restart index ends it.
+		size_t stripLength = size_t(cols) * 2 + 1;
+		vector<unsigned int> indices(stripLength * quadRows);
+		parallelFor(0, quadRows, [&](int rowBegin, int rowEnd) {
+			for (int i = rowBegin; i < rowEnd; ++i) {
+				unsigned int *out = &indices[stripLength * i];
+				for (int j = 0; j < cols; ++j) {
+					*out++ = unsigned(i * cols + j);
+					*out++ = unsigned((i + 1) * cols + j);
+				}
+				*out = restart_index;
+			}
+		});
+		return indices;
+	}
+
+	vector<unsigned int> indices(size_t(quadRows) * quadCols * 6);
+	parallelFor(0, quadRows, [&](int rowBegin, int rowEnd) {
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			unsigned int *out = &indices[size_t(i) * quadCols * 6];
+			for (int j = 0; j < quadCols; ++j) {
+				unsigned int topLeft = unsigned(i * cols + j);
+				unsigned int bottomLeft = topLeft + 1;
+				unsigned int topRight = topLeft + unsigned(cols);
+				unsigned int bottomRight = topRight + 1;
+				for (unsigned int index : { topLeft, topRight, bottomLeft, bottomLeft, topRight, bottomRight }) {
+					*out++ = index;
+				}
+			}
+		}
+	});
+	return indices;
+}
+
+
+void GridRect::merge(const GridRect &other) {
+	if (other.empty()) return;
+	if (empty()) {
+		*this = other;
+		return;
+	}
+	i0 = std::min(i0, other.i0);
+	j0 = std::min(j0, other.j0);
+	i1 = std::max(i1, other.i1);
+	j1 = std::max(j1, other.j1);
+}
+
+
+GridRect GridRect::expanded(int border, int resolution) const {
+	if (empty()) return *this;
+	GridRect rect;
+	rect.i0 = std::max(0, i0 - border);
+	rect.j0 = std::max(0, j0 - border);
+	rect.i1 = std::min(resolution - 1, i1 + border);
+	rect.j1 = std::min(resolution - 1, j1 + border);
+	return rect;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+// std
+#include <vector>
+
+
+// How the quads of a grid mesh are indexed.
+enum class GridTopology {
+	Triangles, // 6 indices per quad (GL_TRIANGLES).
+	Strips // One triangle strip per row of quads, separated by cgra::restart_index (GL_TRIANGLE_STRIP).
+};
+
+// Index buffer for a rows x cols grid of shared vertices stored row-major (vertex (i, j) is i * cols + j).
+// Winding matches the old per-quad layout: (i,j), (i+1,j), (i,j+1) then (i,j+1), (i+1,j), (i+1,j+1).
+std::vector<unsigned int> gridIndices(int rows, int cols, GridTopology topology);
+
+// Inclusive block of grid vertices [i0, i1] x [j0, j1] (vertex (i, j) is i * resolution + j, with i along x).
+struct GridRect {
+	int i0 = 0, j0 = 0;
+	int i1 = -1, j1 = -1;
+
+	bool empty() const { return i1 < i0 || j1 < j0; }
+	int rows() const { return empty() ? 0 : i1 - i0 + 1; }
+	int cols() const { return empty() ? 0 : j1 - j0 + 1; }
+	// Grows this rect to also cover other.
+	void merge(const GridRect &other);
+	// The rect with border more vertices on every side, clamped to a resolution x resolution grid.
+	GridRect expanded(int border, int resolution) const;
+};
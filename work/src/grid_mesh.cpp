@@ -0,0 +1,13 @@
+// project
+#include "grid_mesh.hpp"
+
+using namespace std;
+using namespace cgra;
+
+
+gl_mesh buildGridMesh(const vector<mesh_vertex> &vertices, int rows, int cols, GridTopology topology) {
+	bool strips = topology == GridTopology::Strips;
+	gl_mesh mesh = build_mesh(vertices, gridIndices(rows, cols, topology), strips ? GL_TRIANGLE_STRIP : GL_TRIANGLES);
+	mesh.primitive_restart = strips;
+	return mesh;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// std
+#include <vector>
+
+// project
+#include "opengl.hpp"
+#include "cgra/cgra_mesh.hpp"
+#include "grid_indices.hpp"
+
+
+// Uploads each grid vertex once and draws it through the shared index buffer.
+cgra::gl_mesh buildGridMesh(const std::vector<cgra::mesh_vertex> &vertices, int rows, int cols, GridTopology topology = GridTopology::Triangles);
@@ -0,0 +1,182 @@
+// std
+#include <algorithm>
+
+// project
+#include "heightfield.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+void Heightfield::build(const vector<float> &heights, const vector<vec3> &normals, int resolution, float meshScale) {
+	m_resolution = resolution;
+	m_meshScale = meshScale;
+	m_cellSize = 2.0f * meshScale / (resolution - 1.0f);
+	m_heights = heights;
+	m_normals = normals;
+
+	// Everything is eligible until a range is set.
+	m_eligible.assign(heights.size(), 1);
+	m_nearestEligible.resize(heights.size());
+	for (size_t i = 0; i < heights.size(); i++) {
+		m_nearestEligible[i] = int(i);
+	}
+}
+
+
+void Heightfield::setEligibleRange(float minHeight, float maxHeight) {
+	int res = m_resolution;
+	for (size_t i = 0; i < m_heights.size(); i++) {
+		m_eligible[i] = m_heights[i] >= minHeight && m_heights[i] <= maxHeight;
+		m_nearestEligible[i] = m_eligible[i] ? int(i) : -1;
+	}
+
+	// Closest eligible vertex for every vertex, spread with a forward and a backward sweep over the 8 neighbours
+	// (the usual two pass distance transform, close to exact for this use).
+	auto distance = [res](int from, int to) {
+		int di = from / res - to / res;
+		int dj = from % res - to % res;
+		return di * di + dj * dj;
+	};
+	auto relax = [&](int i, int j, int ni, int nj) {
+		if (ni < 0 || nj < 0 || ni >= res || nj >= res) return;
+		int index = i * res + j;
+		int candidate = m_nearestEligible[ni * res + nj];
+		if (candidate < 0) return;
+		if (m_nearestEligible[index] < 0 || distance(index, candidate) < distance(index, m_nearestEligible[index])) {
+			m_nearestEligible[index] = candidate;
+		}
+	};
+	for (int i = 0; i < res; i++) {
+		for (int j = 0; j < res; j++) {
+			relax(i, j, i - 1, j - 1);
+			relax(i, j, i - 1, j);
+			relax(i, j, i - 1, j + 1);
+			relax(i, j, i, j - 1);
+		}
+	}
+	for (int i = res - 1; i >= 0; i--) {
+		for (int j = res - 1; j >= 0; j--) {
+			relax(i, j, i + 1, j + 1);
+			relax(i, j, i + 1, j);
+			relax(i, j, i + 1, j - 1);
+			relax(i, j, i, j + 1);
+		}
+	}
+}
+
+
+float Heightfield::height(vec2 xz) const {
+	ivec2 cell;
+	vec2 f;
+	locate(xz, cell, f);
+	int index = cell.x * m_resolution + cell.y;
+	float h00 = m_heights[index];
+	float h10 = m_heights[index + m_resolution];
+	float h01 = m_heights[index + 1];
+	float h11 = m_heights[index + m_resolution + 1];
+
+	// Each quad is split along the (i+1, j) to (i, j+1) diagonal, matching gridIndices.
+	if (f.x + f.y <= 1.0f) {
+		return h00 + f.x * (h10 - h00) + f.y * (h01 - h00);
+	}
+	return h11 + (1.0f - f.x) * (h01 - h11) + (1.0f - f.y) * (h10 - h11);
+}
+
+
+vec3 Heightfield::normal(vec2 xz) const {
+	ivec2 cell;
+	vec2 f;
+	locate(xz, cell, f);
+	int index = cell.x * m_resolution + cell.y;
+	vec3 n0 = mix(m_normals[index], m_normals[index + m_resolution], f.x);
+	vec3 n1 = mix(m_normals[index + 1], m_normals[index + m_resolution + 1], f.x);
+	return normalize(mix(n0, n1, f.y));
+}
+
+
+bool Heightfield::eligible(vec2 xz) const {
+	return m_eligible[closestVertex(xz)] != 0;
+}
+
+
+bool Heightfield::nearestEligible(vec2 xz, vec3 &point) const {
+	int closest = closestVertex(xz);
+	if (m_eligible[closest]) {
+		xz = clamp(xz, vec2(-m_meshScale), vec2(m_meshScale));
+		point = vec3(xz.x, height(xz), xz.y);
+		return true;
+	}
+	int nearest = m_nearestEligible[closest];
+	if (nearest < 0) return false;
+	point = vertexPosition(nearest);
+	return true;
+}
+
+
+bool Heightfield::raycast(vec3 origin, vec3 direction, vec3 &hit) const {
+	if (empty()) return false;
+	// Part of the ray over the grid square.
+	float enter = 0.0f;
+	float exit = 1e30f;
+	for (int axis : { 0, 2 }) {
+		if (abs(direction[axis]) < 1e-8f) {
+			if (abs(origin[axis]) > m_meshScale) return false;
+			continue;
+		}
+		float t0 = (-m_meshScale - origin[axis]) / direction[axis];
+		float t1 = (m_meshScale - origin[axis]) / direction[axis];
+		enter = std::max(enter, std::min(t0, t1));
+		exit = std::min(exit, std::max(t0, t1));
+	}
+	if (enter > exit) return false;
+
+	// March about half a cell across the grid at a time, then bisect the step that crossed the surface. Steep rays
+	// barely move across the grid, so they take longer steps (the surface hardly changes under them).
+	auto below = [&](float t) {
+		vec3 point = origin + direction * t;
+		return point.y < height(vec2(point.x, point.z));
+	};
+	float step = 0.5f * m_cellSize / std::max(0.05f, length(vec2(direction.x, direction.z)));
+	int maxSteps = 8 * m_resolution;
+	float previous = enter;
+	bool wasBelow = below(enter);
+	for (int s = 1; s <= maxSteps && previous < exit; s++) {
+		float t = std::min(exit, enter + s * step);
+		bool isBelow = below(t);
+		if (isBelow && !wasBelow) {
+			float above = previous;
+			for (int k = 0; k < 16; k++) {
+				float middle = 0.5f * (above + t);
+				if (below(middle)) t = middle;
+				else above = middle;
+			}
+			hit = origin + direction * t;
+			return true;
+		}
+		wasBelow = isBelow;
+		previous = t;
+	}
+	return false;
+}
+
+
+void Heightfield::locate(vec2 xz, ivec2 &cell, vec2 &fraction) const {
+	vec2 grid = clamp((xz + m_meshScale) / m_cellSize, vec2(0.0f), vec2(m_resolution - 1.0f));
+	cell = min(ivec2(grid), ivec2(m_resolution - 2));
+	fraction = grid - vec2(cell);
+}
+
+
+int Heightfield::closestVertex(vec2 xz) const {
+	vec2 grid = clamp((xz + m_meshScale) / m_cellSize, vec2(0.0f), vec2(m_resolution - 1.0f));
+	ivec2 vertex = ivec2(grid + 0.5f);
+	return vertex.x * m_resolution + vertex.y;
+}
+
+
+vec3 Heightfield::vertexPosition(int index) const {
+	int i = index / m_resolution;
+	int j = index % m_resolution;
+	return vec3(-m_meshScale + i * m_cellSize, m_heights[index], -m_meshScale + j * m_cellSize);
+}
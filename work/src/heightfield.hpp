@@ -0,0 +1,57 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+// Constant time queries on the terrain grid, for placing objects on the ground.
+// Heights follow the same triangles the mesh is drawn with, normals are interpolated from the vertex normals.
+// An eligibility mask marks vertices inside a height band, and every vertex also stores the closest eligible
+// vertex, so moving a rejected position onto valid ground is a lookup rather than a search.
+class Heightfield {
+public:
+	// Copies the heights and normals of a resolution x resolution grid spanning -meshScale to meshScale
+	// (vertex (i, j) is i * resolution + j, with i along x).
+	void build(const std::vector<float> &heights, const std::vector<glm::vec3> &normals, int resolution, float meshScale);
+	// Marks vertices with heights in [minHeight, maxHeight] as eligible and rebuilds the closest eligible lookup.
+	void setEligibleRange(float minHeight, float maxHeight);
+
+	bool empty() const { return m_resolution < 2; }
+	int resolution() const { return m_resolution; }
+	float meshScale() const { return m_meshScale; }
+	// Per vertex heights and normals, in the same order as build() was given them.
+	const std::vector<float> &heights() const { return m_heights; }
+	const std::vector<glm::vec3> &normals() const { return m_normals; }
+	// Writable heights and normals, for edits in place (see terrain_sculpt.hpp). The eligibility only follows them
+	// after the next setEligibleRange.
+	std::vector<float> &editHeights() { return m_heights; }
+	std::vector<glm::vec3> &editNormals() { return m_normals; }
+	// Height and normal of the drawn surface at a world xz position (clamped to the grid).
+	float height(glm::vec2 xz) const;
+	glm::vec3 normal(glm::vec2 xz) const;
+	// Whether the vertex closest to xz is inside the eligible height band.
+	bool eligible(glm::vec2 xz) const;
+	// The surface point at xz if it is eligible, otherwise the closest eligible vertex. Returns false if no vertex
+	// is eligible.
+	bool nearestEligible(glm::vec2 xz, glm::vec3 &point) const;
+	// First point where the ray from origin along direction (unit length) goes below the surface, inside the grid.
+	// Returns false if it doesn't.
+	bool raycast(glm::vec3 origin, glm::vec3 direction, glm::vec3 &hit) const;
+
+private:
+	std::vector<float> m_heights;
+	std::vector<glm::vec3> m_normals;
+	std::vector<unsigned char> m_eligible;
+	std::vector<int> m_nearestEligible; // Index of the closest eligible vertex, -1 if there are none.
+	int m_resolution = 0;
+	float m_meshScale = 0.0f;
+	float m_cellSize = 0.0f;
+
+	// Grid cell containing xz and the position inside it (0 to 1 on each axis).
+	void locate(glm::vec2 xz, glm::ivec2 &cell, glm::vec2 &fraction) const;
+	int closestVertex(glm::vec2 xz) const;
+	glm::vec3 vertexPosition(int index) const;
+};
@@ -0,0 +1,171 @@
+// std
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+// project
+#include "heightfield_cache.hpp"
+
+using namespace std;
+using namespace glm;
+
+namespace fs = std::filesystem;
+
+
+namespace {
+	// Layout of the start of every cache file. The heights (float per vertex) then the normals (3 floats per vertex)
+	// follow straight after it.
+	struct CacheHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t headerBytes;
+		HeightfieldKey key;
+		uint64_t payloadBytes;
+		uint64_t checksum; // FNV-1a of the heights, continued over the normals.
+	};
+
+	const char cacheMagic[8] = { 'C', 'G', 'R', 'A', 'H', 'F', 'C', '\0' };
+
+	// 64 bit FNV-1a, taking 8 bytes per step (then single bytes for the tail) so checking a large file stays cheap.
+	uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			memcpy(&word, bytes + i, 8);
+			hash ^= word;
+			hash *= 1099511628211ull;
+		}
+		for (; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
+
+
+uint64_t HeightfieldKey::hash() const {
+	return fnv1a(this, sizeof(HeightfieldKey));
+}
+
+
+bool HeightfieldKey::operator==(const HeightfieldKey &other) const {
+	return seed == other.seed && octaves == other.octaves && resolution == other.resolution &&
+		persistence == other.persistence && lacunarity == other.lacunarity && scale == other.scale &&
+		height == other.height && meshScale == other.meshScale && basis == other.basis && fractal == other.fractal &&
+		erosion == other.erosion;
+}
+
+
+HeightfieldCache::HeightfieldCache(string directory) : m_directory(move(directory)) {
+	if (m_directory.empty()) {
+		error_code error;
+		fs::path temp = fs::temp_directory_path(error);
+		m_directory = ((error ? fs::path(".") : temp) / "cgra_terrain_cache").string();
+	}
+}
+
+
+string HeightfieldCache::path(const HeightfieldKey &key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "terrain_%016llx.hfc", (unsigned long long)key.hash());
+	return (fs::path(m_directory) / name).string();
+}
+
+
+// The file is read straight into the vectors the terrain build keeps, so a hit costs one copy of the payload from disk
+// and holds nothing else in memory.
+bool HeightfieldCache::load(const HeightfieldKey &key, vector<float> &heights, vector<vec3> &normals) const {
+	string filePath = path(key);
+	FILE *file = fopen(filePath.c_str(), "rb");
+	if (file == nullptr) return false;
+
+	// Anything that doesn't match exactly is treated as a miss, the caller regenerates and overwrites it.
+	CacheHeader header;
+	size_t vertexCount = size_t(key.resolution) * key.resolution;
+	size_t payloadBytes = vertexCount * (sizeof(float) + sizeof(vec3));
+	bool valid = fread(&header, sizeof(CacheHeader), 1, file) == 1 &&
+		memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) == 0 && header.version == version &&
+		header.headerBytes == sizeof(CacheHeader) && header.key == key && header.payloadBytes == payloadBytes;
+	if (valid) {
+		heights.resize(vertexCount);
+		normals.resize(vertexCount);
+		valid = fread(heights.data(), sizeof(float), vertexCount, file) == vertexCount &&
+			fread(normals.data(), sizeof(vec3), vertexCount, file) == vertexCount && fgetc(file) == EOF &&
+			fnv1a(normals.data(), vertexCount * sizeof(vec3), fnv1a(heights.data(), vertexCount * sizeof(float))) ==
+				header.checksum;
+	}
+	fclose(file);
+	if (!valid) return false;
+
+	// A hit counts as a use, so the files trim() removes are the least recently used rather than the oldest.
+	error_code error;
+	fs::last_write_time(filePath, fs::file_time_type::clock::now(), error);
+	return true;
+}
+
+
+bool HeightfieldCache::store(const HeightfieldKey &key, const vector<float> &heights, const vector<vec3> &normals) const {
+	size_t vertexCount = size_t(key.resolution) * key.resolution;
+	if (heights.size() != vertexCount || normals.size() != vertexCount) return false;
+
+	CacheHeader header{};
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = version;
+	header.headerBytes = sizeof(CacheHeader);
+	header.key = key;
+	header.payloadBytes = vertexCount * (sizeof(float) + sizeof(vec3));
+	// Hashed exactly as load() does, in the same two runs.
+	header.checksum = fnv1a(normals.data(), vertexCount * sizeof(vec3), fnv1a(heights.data(), vertexCount * sizeof(float)));
+
+	error_code error;
+	fs::create_directories(m_directory, error);
+	if (error) return false;
+
+	// Written under a temporary name then renamed, so a reader never maps a half written file.
+	string finalPath = path(key);
+	string tempPath = finalPath + ".tmp";
+	FILE *file = fopen(tempPath.c_str(), "wb");
+	if (file == nullptr) return false;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(heights.data(), sizeof(float), vertexCount, file) == vertexCount &&
+		fwrite(normals.data(), sizeof(vec3), vertexCount, file) == vertexCount;
+	written = fclose(file) == 0 && written;
+	if (written) {
+		fs::rename(tempPath, finalPath, error);
+		written = !error;
+	}
+	if (!written) fs::remove(tempPath, error);
+	trim();
+	return written;
+}
+
+
+// Removes the least recently used files (oldest write time, see load) until the rest fit in maxBytes. The newest file
+// always stays, so a single terrain larger than the limit still caches.
+void HeightfieldCache::trim() const {
+	struct CacheFile {
+		fs::path path;
+		fs::file_time_type time;
+		uintmax_t bytes;
+	};
+	vector<CacheFile> files;
+	uintmax_t totalBytes = 0;
+	error_code error;
+	for (fs::directory_iterator entry(m_directory, error), end; !error && entry != end; entry.increment(error)) {
+		if (entry->path().extension() != ".hfc") continue;
+		error_code fileError;
+		CacheFile file{ entry->path(), fs::last_write_time(entry->path(), fileError), fs::file_size(entry->path(), fileError) };
+		if (fileError) continue;
+		files.push_back(file);
+		totalBytes += file.bytes;
+	}
+
+	sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) { return a.time < b.time; });
+	for (size_t i = 0; i + 1 < files.size() && totalBytes > maxBytes; i++) {
+		if (fs::remove(files[i].path, error)) totalBytes -= files[i].bytes;
+	}
+}
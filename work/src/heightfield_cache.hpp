@@ -0,0 +1,57 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+
+// Everything the terrain heights depend on. Stored whole in the cache file header, so two settings whose hashes
+// collide still can't load each other's heights.
+struct HeightfieldKey {
+	int32_t seed = 0;
+	int32_t octaves = 0;
+	int32_t resolution = 0;
+	float persistence = 0.0f;
+	float lacunarity = 0.0f;
+	float scale = 0.0f;
+	float height = 0.0f;
+	float meshScale = 0.0f;
+	int32_t basis = 0; // NoiseBasis
+	int32_t fractal = 0; // FractalType
+	uint32_t erosion = 0; // ErosionSettings::hash() of the erosion applied after the noise, 0 for none.
+
+	uint64_t hash() const;
+	bool operator==(const HeightfieldKey &other) const;
+};
+
+// On-disk cache of generated terrain heights and normals, one file per key. Files are written once and read straight
+// back into the vectors, so a terrain seen on an earlier run loads without evaluating any noise. Each file has a
+// versioned header and a checksum of its contents. Files from another version, for other settings, truncated or
+// corrupted are rejected (and overwritten by the next store). The directory is kept under maxBytes by removing the
+// least recently used files after each store.
+class HeightfieldCache {
+public:
+	// Bump when the file layout or the noise itself changes, so older files stop matching.
+	static const uint32_t version = 4;
+
+	uint64_t maxBytes = uint64_t(512) << 20; // 16 bytes per vertex, so about 8 terrains at resolution 2000.
+
+	// Uses <system temp>/cgra_terrain_cache when directory is empty.
+	explicit HeightfieldCache(std::string directory = "");
+
+	// Fills heights and normals (resolution^2 each) from the cache. Returns false if there is no valid file.
+	bool load(const HeightfieldKey &key, std::vector<float> &heights, std::vector<glm::vec3> &normals) const;
+	// Writes the file for key, replacing any old one. Returns false if it couldn't be written.
+	bool store(const HeightfieldKey &key, const std::vector<float> &heights, const std::vector<glm::vec3> &normals) const;
+
+	std::string path(const HeightfieldKey &key) const;
+
+private:
+	std::string m_directory;
+
+	void trim() const;
+};
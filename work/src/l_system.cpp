@@ -1,6 +1,7 @@
 #include "l_system.hpp"
-#include "cgra/cgra_mesh.hpp"
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
 using namespace std;
@@ -33,180 +34,327 @@ string LSystem::generateString() {
     return current;
 }
 
-gl_mesh LSystem::generateTreeMesh(const string& lSystemString, vector<vec3>& outEndNodes, vector<vec3>& outEndDirections) {
-    mesh_builder mb;
+LSystemExpansion::LSystemExpansion(const string& axiom, const map<char, string>& rules, int iterations, float angle)
+    : iterations(iterations) {
+    // Rotations of the turn symbols, all about fixed axes: + - around z, & ^ around x (pitch), \ / around y (roll)
+    const char turnSymbols[] = "+-&^\\/";
+    const vec3 turnAxes[] = { vec3(0, 0, 1), vec3(1, 0, 0), vec3(0, 1, 0) };
+    for (int i = 0; i < 6; i++) {
+        rotations[i] = angleAxis(radians(i % 2 == 0 ? angle : -angle), turnAxes[i / 2]);
+    }
+
+    // Rule programs follow the axiom, in the order of the map
+    array<int16_t, 256> ruleFor;
+    ruleFor.fill(-1);
+    int16_t program = 1;
+    for (const auto& rule : rules) {
+        ruleFor[(unsigned char)rule.first] = program++;
+    }
+
+    auto compile = [&](const string& symbols) {
+        vector<TurtleOp> ops;
+        ops.reserve(symbols.size());
+        for (char c : symbols) {
+            TurtleOp op{c, TurtleOp::Ignore, 0, ruleFor[(unsigned char)c]};
+            if (c == 'F') {
+                op.code = TurtleOp::Forward;
+            } else if (c == '[') {
+                op.code = TurtleOp::Push;
+            } else if (c == ']') {
+                op.code = TurtleOp::Pop;
+            } else if (const char* turn = strchr(turnSymbols, c); turn && c != '\0') {
+                op.code = TurtleOp::Turn;
+                op.rotation = uint8_t(turn - turnSymbols);
+            }
+            ops.push_back(op);
+        }
+        return ops;
+    };
+    programs.push_back(compile(axiom));
+    for (const auto& rule : rules) {
+        programs.push_back(compile(rule.second));
+    }
+
+    cursors.reserve(iterations + 1);
+    cursors.push_back(Cursor{programs[0].data(), programs[0].data() + programs[0].size()});
+}
 
-    struct TurtleStateWithRadius {
-        TurtleState turtle;
-        float radius;
+bool LSystemExpansion::next(const TurtleOp*& op) {
+    while (!cursors.empty()) {
+        Cursor& top = cursors.back();
+        if (top.next == top.end) {
+            cursors.pop_back();
+            continue;
+        }
+        const TurtleOp* current = top.next++;
+
+        // Symbols with a rule expand in place until the iterations run out, then come out as they are
+        if (current->rule >= 0 && int(cursors.size()) <= iterations) {
+            const vector<TurtleOp>& rule = programs[current->rule];
+            cursors.push_back(Cursor{rule.data(), rule.data() + rule.size()});
+            continue;
+        }
+        op = current;
+        return true;
+    }
+    return false;
+}
+
+bool LSystemExpansion::next(char& symbol) {
+    const TurtleOp* op;
+    if (!next(op)) return false;
+    symbol = op->symbol;
+    return true;
+}
+
+int LSystemExpansion::maxDepth() const {
+    // For each program with the iterations left so far: the bracket depth it ends at, and the deepest it reaches,
+    // both relative to where it starts. Rules are worked out from no iterations left up, the axiom last.
+    struct Nesting {
+        int net = 0;
+        int peak = 0;
+    };
+    vector<Nesting> nesting(programs.size());
+    auto measure = [&](const vector<TurtleOp>& ops, bool expand) {
+        Nesting result;
+        for (const TurtleOp& op : ops) {
+            if (expand && op.rule >= 0) {
+                result.peak = std::max(result.peak, result.net + nesting[op.rule].peak);
+                result.net += nesting[op.rule].net;
+            } else if (op.code == TurtleOp::Push) {
+                result.peak = std::max(result.peak, ++result.net);
+            } else if (op.code == TurtleOp::Pop) {
+                result.net--;
+            }
+        }
+        return result;
     };
+    for (int left = 0; left < iterations; left++) {
+        vector<Nesting> next(programs.size());
+        for (size_t p = 1; p < programs.size(); p++) {
+            next[p] = measure(programs[p], left > 0);
+        }
+        nesting = next;
+    }
+    return measure(programs[0], iterations > 0).peak;
+}
+
+LSystemExpansion LSystem::expand() const {
+    return LSystemExpansion(axiom, rules, iterations, angle);
+}
+
+uint64_t LSystem::expandedCount(char symbol, int iterations) const {
+    // count[c] is how many of symbol one c becomes after the iterations so far, starting from none
+    array<uint64_t, 256> count{};
+    count[(unsigned char)symbol] = 1;
+    for (int i = 0; i < iterations; i++) {
+        array<uint64_t, 256> next = count;
+        for (const auto& rule : rules) {
+            uint64_t total = 0;
+            for (char c : rule.second) {
+                total += count[(unsigned char)c];
+            }
+            next[(unsigned char)rule.first] = total;
+        }
+        count = next;
+    }
+
+    uint64_t total = 0;
+    for (char c : axiom) {
+        total += count[(unsigned char)c];
+    }
+    return total;
+}
+
+mesh_data LSystem::generateTreeMesh(vector<vec3>& outEndNodes, vector<vec3>& outEndDirections) {
+    LSystemExpansion symbols = expand();
+    return interpret(symbols, expandedCount('F', iterations), expandedCount('[', iterations), outEndNodes, outEndDirections);
+}
+
+mesh_data LSystem::generateTreeMesh(const string& lSystemString, vector<vec3>& outEndNodes, vector<vec3>& outEndDirections) {
+    LSystemExpansion symbols(lSystemString, {}, 0, angle);
+    uint64_t steps = count(lSystemString.begin(), lSystemString.end(), 'F');
+    uint64_t branches = count(lSystemString.begin(), lSystemString.end(), '[');
+    return interpret(symbols, steps, branches, outEndNodes, outEndDirections);
+}
 
-    stack<TurtleStateWithRadius> stateStack;
+// Frame for the first ring of a chain, the same one each cylinder used to get on its own
+static vec3 startFrame(vec3 tangent) {
+    vec3 right = cross(tangent, vec3(1, 0, 0));
+    if (length(right) < 0.001f) {
+        right = cross(tangent, vec3(0, 0, 1));
+    }
+    return normalize(right);
+}
+
+// Parallel transport: turns frame by the smallest rotation taking unit vector from to unit vector to, so rings along
+// a chain don't twist around the branch
+static vec3 transportFrame(vec3 frame, vec3 from, vec3 to) {
+    float c = dot(from, to);
+    if (c < -0.999f) return startFrame(to); // Doubling back, any frame will do
+    vec3 axis = cross(from, to);
+    return normalize(frame * c + cross(axis, frame) + axis * (dot(axis, frame) / (1.0f + c)));
+}
+
+mesh_data LSystem::interpret(LSystemExpansion& symbols, uint64_t steps, uint64_t branches, vector<vec3>& outEndNodes, vector<vec3>& outEndDirections) {
+    mesh_data mesh;
+    // Growing the arrays would briefly need the old and new copies of a large tree. Every step ends in a ring, each
+    // branch starts with two (its collar), and each ring is joined to the one before by a band of quads.
+    mesh.vertices.reserve((steps + 2 * branches + 1) * (cylinderSides + 1));
+    mesh.indices.reserve((steps + branches) * cylinderSides * 6);
+
+    // Branch states, pushed by [ and popped by ]. Unbalanced brackets can nest deeper than the rules say (a ] with
+    // nothing to pop is skipped), in which case the stack grows.
+    vector<TurtleState> stateStack(symbols.maxDepth());
+    size_t depth = 0;
 
     TurtleState turtle;
     turtle.position = vec3(0, 0, 0);
-    turtle.direction = vec3(0, 1, 0);
-    turtle.rotation = mat4(1.0f);
+    turtle.orientation = quat(1, 0, 0, 0);
+    turtle.radius = initialRadius;
 
-    unsigned int vertexIndex = 0;
-    float currentRadius = initialRadius;
     const float MIN_RADIUS = 0.001f;
     bool nextIsNewBranch = false;
 
-    // Track if this is an end node, meaning no forward movement after this position
-    bool isEndNode = false;
-
-    for (size_t i = 0; i < lSystemString.length(); i++) {
-        char c = lSystemString[i];
+    // Ends the step in progress with its ring. Between two steps of a chain the ring is tilted halfway between them
+    // (along next), so the joint closes without a gap or overlap. Otherwise it faces along the step.
+    auto endStep = [&](vec3 next) {
+        if (!turtle.stepping) return;
+        vec3 tangent = turtle.step;
+        if (next != vec3(0.0f) && length(turtle.step + next) > 0.001f) {
+            tangent = normalize(turtle.step + next);
+        }
+        vec3 frame = transportFrame(turtle.frame, turtle.tangent, tangent);
+        int ring = addRing(mesh, turtle.position, tangent, frame, turtle.radius, turtle.texCoord);
+        connectRings(mesh, turtle.ring, ring);
+        turtle.ring = ring;
+        turtle.frame = frame;
+        turtle.tangent = tangent;
+        turtle.stepping = false;
+    };
 
-        // Check if next character is 'F'
-        bool nextIsForward = (i + 1 < lSystemString.length() && lSystemString[i + 1] == 'F');
+    // The last forward step is an end node if the branch closes (or the string ends) before the next one. The
+    // string is only seen one symbol at a time, so it is kept here until the next symbol that decides it.
+    bool pendingEndNode = false;
+    vec3 endNodePosition;
+    vec3 endNodeDirection;
 
-        // Check if we're at a branch end (inside brackets with no more F before ])
-        if (c == 'F') {
-            isEndNode = true;
-            for (size_t j = i + 1; j < lSystemString.length(); j++) {
-                if (lSystemString[j] == 'F') {
-                    isEndNode = false;
-                    break;
-                } else if (lSystemString[j] == ']') {
-                    break;
-                }
+    const TurtleOp* op;
+    while (symbols.next(op)) {
+        if (pendingEndNode && (op->code == TurtleOp::Forward || op->code == TurtleOp::Pop)) {
+            if (op->code == TurtleOp::Pop) {
+                outEndNodes.push_back(endNodePosition);
+                outEndDirections.push_back(endNodeDirection);
             }
+            pendingEndNode = false;
         }
 
-        switch (c) {
-            case 'F': {
+        switch (op->code) {
+            case TurtleOp::Forward: {
+                vec3 direction = turtle.orientation * vec3(0, 1, 0);
                 vec3 startPos = turtle.position;
-                vec3 endPos = turtle.position + turtle.direction * stepLength;
+                vec3 endPos = turtle.position + direction * stepLength;
+                float endRadius = std::max(MIN_RADIUS, turtle.radius * branchTaper);
+                endStep(direction);
 
                 if (nextIsNewBranch) {
-                    // Add a small tapered section as transition
-                    vec3 collarEnd = startPos + turtle.direction * (stepLength * 0.15f);
-                    addCylinder(mb, startPos, collarEnd, currentRadius * 1.4f, currentRadius, vertexIndex);
+                    // Add a small tapered section as transition. Its own first ring, wider than the branch, starts
+                    // a new chain
+                    vec3 collarEnd = startPos + direction * (stepLength * 0.15f);
+                    turtle.frame = startFrame(direction);
+                    turtle.tangent = direction;
+                    int collarRing = addRing(mesh, startPos, direction, turtle.frame, turtle.radius * 1.4f, turtle.texCoord);
+                    turtle.texCoord += 0.15f;
+                    turtle.ring = addRing(mesh, collarEnd, direction, turtle.frame, turtle.radius, turtle.texCoord);
+                    connectRings(mesh, collarRing, turtle.ring);
                     startPos = collarEnd; // Start the branch from end of collar
                     nextIsNewBranch = false;
                 }
 
-                float endRadius = std::max(MIN_RADIUS, currentRadius * branchTaper);
-                if (currentRadius >= MIN_RADIUS) {
-                    addCylinder(mb, startPos, endPos, currentRadius, endRadius, vertexIndex);
+                if (turtle.radius >= MIN_RADIUS) {
+                    // Continue the chain from the ring the turtle is on, or start one here
+                    if (turtle.ring < 0) {
+                        turtle.frame = startFrame(direction);
+                        turtle.tangent = direction;
+                        turtle.ring = addRing(mesh, startPos, direction, turtle.frame, turtle.radius, turtle.texCoord);
+                    }
+                    turtle.stepping = true;
+                    turtle.step = direction;
+                } else {
+                    turtle.ring = -1;
                 }
 
+                // Bark repeats once per step
+                turtle.texCoord += length(endPos - startPos) / stepLength;
                 turtle.position = endPos;
-                currentRadius = endRadius;
-
-                // If this is an end node, record the position and direction for leaf placement
-                if (isEndNode) {
-                    outEndNodes.push_back(endPos);
-                    outEndDirections.push_back(normalize(turtle.direction));
-                }
+                turtle.radius = endRadius;
 
+                // This may be an end node, which records the position and direction for leaf placement
+                pendingEndNode = true;
+                endNodePosition = endPos;
+                endNodeDirection = normalize(direction);
                 break;
             }
-            case '+': {
-                // Rotate around Z axis (positive)
-                mat4 rotation = rotate(mat4(1.0f), radians(angle), vec3(0, 0, 1));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
+            case TurtleOp::Turn: {
+                // Turns are about fixed axes, so they apply on the left
+                turtle.orientation = symbols.rotation(op->rotation) * turtle.orientation;
                 break;
             }
-            case '-': {
-                // Rotate around Z axis (negative)
-                mat4 rotation = rotate(mat4(1.0f), radians(-angle), vec3(0, 0, 1));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
-                break;
-            }
-            case '[': {
-                TurtleStateWithRadius state;
-                state.turtle = turtle;
-                state.radius = currentRadius;
-                stateStack.push(state);
-                
-                currentRadius = std::max(MIN_RADIUS, currentRadius * 0.7f);
+            case TurtleOp::Push: {
+                // The saved state ends on a ring, which the parent carries on from after the branch
+                endStep(vec3(0.0f));
+                if (depth == stateStack.size()) {
+                    stateStack.push_back(turtle);
+                } else {
+                    stateStack[depth] = turtle;
+                }
+                depth++;
+
+                turtle.radius = std::max(MIN_RADIUS, turtle.radius * 0.7f);
                 nextIsNewBranch = true;
                 break;
             }
-            case ']': {
-                if (!stateStack.empty()) {
-                    TurtleStateWithRadius state = stateStack.top();
-                    stateStack.pop();
-                    turtle = state.turtle;
-                    currentRadius = state.radius;
+            case TurtleOp::Pop: {
+                if (depth > 0) {
+                    endStep(vec3(0.0f));
+                    turtle = stateStack[--depth];
                 }
                 nextIsNewBranch = false;
                 break;
             }
-            case '&': { // Pitch down (rotate around X)
-                mat4 rotation = rotate(mat4(1.0f), radians(angle), vec3(1, 0, 0));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
-                break;
-            }
-            case '^': { // Pitch up (rotate around X)
-                mat4 rotation = rotate(mat4(1.0f), radians(-angle), vec3(1, 0, 0));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
-                break;
-            }
-            case '\\': { // Roll left (rotate around Y)
-                mat4 rotation = rotate(mat4(1.0f), radians(angle), vec3(0, 1, 0));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
-                break;
-            }
-            case '/': { // Roll right (rotate around Y)
-                mat4 rotation = rotate(mat4(1.0f), radians(-angle), vec3(0, 1, 0));
-                turtle.rotation = rotation * turtle.rotation;
-                turtle.direction = vec3(rotation * vec4(turtle.direction, 0));
+            default:
                 break;
-            }
         }
     }
-    
-    return mb.build();
-}
+    endStep(vec3(0.0f));
+    if (pendingEndNode) {
+        outEndNodes.push_back(endNodePosition);
+        outEndDirections.push_back(endNodeDirection);
+    }
 
-// Add helper function to create a cylinder between two points
-void LSystem::addCylinder(mesh_builder& mb, vec3 start, vec3 end, float startRadius,
-    float endRadius, unsigned int& vertexIndex) {
-    vec3 direction = normalize(end - start);
+    return mesh;
+}
 
+// A ring of cylinderSides + 1 vertices around centre, facing along tangent, starting at frame. The first vertex is
+// repeated at the end so the bark's u coordinate can run from 0 to 1.
+int LSystem::addRing(mesh_data& mesh, vec3 centre, vec3 tangent, vec3 frame, float radius, float texCoord) {
+    int first = int(mesh.vertices.size());
+    vec3 up = cross(tangent, frame);
     int sides = cylinderSides;
-    for (int i = 0; i < sides; i++) {
-        float angle1 = (2.0f * pi<float>() * i) / sides;
-        float angle2 = (2.0f * pi<float>() * (i + 1)) / sides;
-        
-        vec3 right = normalize(cross(direction, vec3(1, 0, 0)));
-        if (length(right) < 0.001f) {
-            right = normalize(cross(direction, vec3(0, 0, 1)));
-        }
-        vec3 up = normalize(cross(direction, right));
-        
-        // Calculate proper normals (pointing outward from cylinder axis)
-        vec3 normal1 = normalize(cos(angle1) * right + sin(angle1) * up);
-        vec3 normal2 = normalize(cos(angle2) * right + sin(angle2) * up);
-        
-        vec3 v1 = start + startRadius * normal1;
-        vec3 v2 = start + startRadius * normal2;
-        vec3 v3 = end + endRadius * normal1;
-        vec3 v4 = end + endRadius * normal2;
-        
-        // Use the calculated outward-pointing normals
-        mesh_vertex mv1{v1, normal1, vec2(float(i)/sides, 0)};
-        mesh_vertex mv2{v2, normal2, vec2(float(i+1)/sides, 0)};
-        mesh_vertex mv3{v3, normal1, vec2(float(i)/sides, 1)};
-        mesh_vertex mv4{v4, normal2, vec2(float(i+1)/sides, 1)};
-        
-        mb.push_vertex(mv1);
-        mb.push_vertex(mv2);
-        mb.push_vertex(mv3);
-        mb.push_vertex(mv4);
-        
-        mb.push_indices({vertexIndex, vertexIndex + 2, vertexIndex + 1});
-        mb.push_indices({vertexIndex + 1, vertexIndex + 2, vertexIndex + 3});
-        
-        vertexIndex += 4;
+    for (int i = 0; i <= sides; i++) {
+        float angle = (2.0f * pi<float>() * i) / sides;
+        vec3 normal = cos(angle) * frame + sin(angle) * up;
+        mesh.vertices.push_back(mesh_vertex{centre + radius * normal, normal, vec2(float(i) / sides, texCoord)});
+    }
+    return first;
+}
+
+// Band of quads between two rings, wound like the old per-segment cylinders
+void LSystem::connectRings(mesh_data& mesh, int from, int to) {
+    for (int i = 0; i < cylinderSides; i++) {
+        unsigned int start = from + i;
+        unsigned int end = to + i;
+        mesh.indices.insert(mesh.indices.end(), {start, end, start + 1});
+        mesh.indices.insert(mesh.indices.end(), {start + 1, end, end + 1});
     }
 }
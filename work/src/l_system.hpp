@@ -2,16 +2,59 @@
 
 // glm
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // std
+#include <array>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
-#include <stack>
 
 // project
-#include "opengl.hpp"
-#include "cgra/cgra_mesh.hpp"
+#include "cgra/cgra_vertex.hpp"
+
+// One symbol of an L-system compiled for the turtle: what it does, with turns resolved to one of the rotations baked
+// by LSystemExpansion, and the rule it rewrites into resolved to a program index.
+struct TurtleOp {
+    enum Code : uint8_t { Ignore, Forward, Turn, Push, Pop };
+    char symbol;
+    Code code;
+    uint8_t rotation; // For Turn, index into LSystemExpansion::rotation
+    int16_t rule;     // Program the symbol rewrites into, -1 if it has no rule
+};
+
+// Depth-first expansion of an L-system string, one symbol at a time and in the same order as
+// LSystem::generateString. The axiom and rules are compiled to runs of TurtleOps up front, and instead of the string
+// it keeps a cursor into each run being expanded, at most one per iteration, so memory follows the iteration count
+// rather than the string length, which grows geometrically with it.
+class LSystemExpansion {
+public:
+    // Turns rotate by angle degrees.
+    LSystemExpansion(const std::string& axiom, const std::map<char, std::string>& rules, int iterations, float angle = 0.0f);
+    // The cursors point into the compiled programs, which moving keeps but copying wouldn't.
+    LSystemExpansion(const LSystemExpansion&) = delete;
+    LSystemExpansion(LSystemExpansion&&) = default;
+
+    // Sets op to the next symbol of the string. Returns false at the end of the string.
+    bool next(const TurtleOp*& op);
+    bool next(char& symbol);
+
+    // Rotation of a Turn op.
+    const glm::quat& rotation(int index) const { return rotations[index]; }
+    // Deepest the brackets of the whole string nest, worked out from the programs without expanding them.
+    int maxDepth() const;
+
+private:
+    struct Cursor {
+        const TurtleOp* next;
+        const TurtleOp* end;
+    };
+    std::vector<std::vector<TurtleOp>> programs; // The axiom, then each rule.
+    std::vector<Cursor> cursors; // The axiom, then the rule each symbol above it expanded into.
+    std::array<glm::quat, 6> rotations;
+    int iterations;
+};
 
 class LSystem {
 public:
@@ -27,21 +70,44 @@ public:
     
     // Generate the L-System string
     std::string generateString();
+    // The symbols of the same string without building it (see LSystemExpansion)
+    LSystemExpansion expand() const;
+    // How many times symbol appears in the string after the given number of iterations, without expanding it
+    uint64_t expandedCount(char symbol, int iterations) const;
 
-    // Convert L-System string to 3D mesh and collect end node positions and directions
-    cgra::gl_mesh generateTreeMesh(const std::string& lSystemString, std::vector<glm::vec3>& outEndNodes, std::vector<glm::vec3>& outEndDirections);
+    // Convert the L-System to 3D mesh data and collect end node positions and directions (upload with cgra::build_mesh).
+    // The string is expanded as the turtle walks it, so it never exists in full.
+    cgra::mesh_data generateTreeMesh(std::vector<glm::vec3>& outEndNodes, std::vector<glm::vec3>& outEndDirections);
+    // The same for a string that is already expanded
+    cgra::mesh_data generateTreeMesh(const std::string& lSystemString, std::vector<glm::vec3>& outEndNodes, std::vector<glm::vec3>& outEndDirections);
     
     // Constructor
     LSystem();
     
 private:
-    // Helper structure for turtle graphics state
+    // Helper structure for turtle graphics state. The heading is the orientation applied to +y.
     struct TurtleState {
         glm::vec3 position;
-        glm::vec3 direction;
-        glm::mat4 rotation;
+        glm::quat orientation;
+        float radius;
+        // The branch being drawn: its last ring (-1 before the first), that ring's tangent and frame (the direction
+        // of its first vertex), and the bark's v coordinate at the turtle
+        int ring = -1;
+        glm::vec3 tangent;
+        glm::vec3 frame;
+        float texCoord = 0.0f;
+        // Whether a step from that ring to the turtle is waiting for its end ring, whose tilt depends on the next step
+        bool stepping = false;
+        glm::vec3 step;
     };
 
-    // Helper function to add cylinder mesh
-    void addCylinder(cgra::mesh_builder& mb, glm::vec3 start, glm::vec3 end, float startRadius, float endRadius, unsigned int& vertexIndex);
+    // Walks the turtle over the symbols in one pass, with the branch states on a flat stack sized to the deepest
+    // nesting. The forward steps and branches the symbols hold size the mesh up front.
+    // Each branch is a generalized cylinder: consecutive steps share the ring between them, and the rings follow the
+    // branch with parallel-transported frames so they don't twist.
+    cgra::mesh_data interpret(LSystemExpansion& symbols, uint64_t steps, uint64_t branches, std::vector<glm::vec3>& outEndNodes, std::vector<glm::vec3>& outEndDirections);
+
+    // Helper functions to build the branch meshes
+    int addRing(cgra::mesh_data& mesh, glm::vec3 centre, glm::vec3 tangent, glm::vec3 frame, float radius, float texCoord);
+    void connectRings(cgra::mesh_data& mesh, int from, int to);
 };
@@ -0,0 +1,555 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "noise_batch.hpp"
+#include "noise_lattice.hpp"
+#include "noise_pipeline.hpp"
+
+// SIMD intrinsics are only available on x86. Other platforms always use the scalar path.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CGRA_NOISE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC allows AVX2 intrinsics in any function, the CPU check guards their use.
+#define CGRA_TARGET_AVX2
+#else
+// GCC/Clang only emit AVX2 instructions in functions marked for it, so the rest of the build stays SSE2.
+#define CGRA_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+using namespace std;
+using namespace glm;
+
+
+SimdLevel detectSimdLevel() {
+#ifdef CGRA_NOISE_X86
+	static const SimdLevel level = []() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		// The OS must also save the YMM registers on context switches.
+		bool ymmEnabled = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		return (ymmEnabled && avx2) ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#endif
+	}();
+	return level;
+#else
+	return SimdLevel::Scalar;
+#endif
+}
+
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::AVX2: return "AVX2";
+		case SimdLevel::SSE2: return "SSE2";
+		default: return "Scalar";
+	}
+}
+
+
+// Inspiration from: https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
+float perlinNoise(vec2 pos) {
+	vec2 gridPos = floor(pos);
+	CellCorners cell;
+	return cellNoise(cornersOf(cell, int(gridPos.x), int(gridPos.y)), pos - gridPos);
+}
+
+
+float perlinNoise(vec2 pos, vec2 &gradient) {
+	vec2 gridPos = floor(pos);
+	CellCorners cell;
+	return cellNoise(cornersOf(cell, int(gridPos.x), int(gridPos.y)), pos - gridPos, gradient);
+}
+
+
+float fractalNoise(const FractalParams &params, vec2 pos) {
+	if (params.basis != NoiseBasis::Perlin || params.fractal != FractalType::Fbm) {
+		float height;
+		fractalKernel(params)(params, &pos.x, &pos.y, 1, &height, nullptr, nullptr);
+		return height;
+	}
+	float noiseHeight = 0.0f;
+	float maxHeight = 0.0f;
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	// Create perlin noise by combining noise octaves of doubling frequency and halving amplitude.
+	for (int oct = 0; oct < params.octaves; oct++) {
+		// Uses seeded octave offsets, noise scale and diminishing frequency and amplitude per octave.
+		noiseHeight += perlinNoise((pos + params.octaveOffsets[oct]) * params.scale * frequency) * amplitude;
+		maxHeight += amplitude;
+		// Each octave has lower amplitude and higher frequency by the persistence and lacunarity scales.
+		amplitude *= params.persistence;
+		frequency *= params.lacunarity;
+	}
+	// Normalise then scale by amplitude.
+	float normalizedHeight = noiseHeight / maxHeight;
+	return normalizedHeight * params.height;
+}
+
+
+float fractalNoise(const FractalParams &params, vec2 pos, vec2 &gradient) {
+	if (params.basis != NoiseBasis::Perlin || params.fractal != FractalType::Fbm) {
+		float height;
+		fractalKernel(params)(params, &pos.x, &pos.y, 1, &height, &gradient.x, &gradient.y);
+		return height;
+	}
+	float noiseHeight = 0.0f;
+	vec2 noiseGradient(0.0f);
+	float maxHeight = 0.0f;
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	for (int oct = 0; oct < params.octaves; oct++) {
+		// The octave samples at (pos + offset) * scale * frequency, so its gradient scales by scale * frequency.
+		vec2 octaveGradient;
+		noiseHeight += perlinNoise((pos + params.octaveOffsets[oct]) * params.scale * frequency, octaveGradient) * amplitude;
+		noiseGradient += octaveGradient * (amplitude * params.scale * frequency);
+		maxHeight += amplitude;
+		amplitude *= params.persistence;
+		frequency *= params.lacunarity;
+	}
+	gradient = noiseGradient / maxHeight * params.height;
+	return noiseHeight / maxHeight * params.height;
+}
+
+
+// One octave of a batch, added onto the running sums.
+struct OctavePass {
+	vec2 offset;
+	float scale;
+	float frequency;
+	float amplitude;
+};
+
+
+// Scalar pass over samples [begin, count), also used for the samples left over by the vector kernels.
+template <bool Deriv>
+static void octaveScalar(const OctavePass &pass, const float *xs, const float *zs, int begin, int count, float *out, float *outDx, float *outDz) {
+	CellCorners cell;
+	float gradientScale = pass.amplitude * pass.scale * pass.frequency;
+	for (int k = begin; k < count; k++) {
+		vec2 pos = (vec2(xs[k], zs[k]) + pass.offset) * pass.scale * pass.frequency;
+		vec2 gridPos = floor(pos);
+		const CellCorners &corners = cornersOf(cell, int(gridPos.x), int(gridPos.y));
+		if (Deriv) {
+			vec2 gradient;
+			out[k] += cellNoise(corners, pos - gridPos, gradient) * pass.amplitude;
+			outDx[k] += gradient.x * gradientScale;
+			outDz[k] += gradient.y * gradientScale;
+		}
+		else {
+			out[k] += cellNoise(corners, pos - gridPos) * pass.amplitude;
+		}
+	}
+}
+
+
+// Simplex version of octaveScalar.
+template <bool Deriv>
+static void simplexScalar(const OctavePass &pass, const float *xs, const float *zs, int begin, int count, float *out, float *outDx, float *outDz) {
+	float gradientScale = pass.amplitude * pass.scale * pass.frequency;
+	for (int k = begin; k < count; k++) {
+		vec2 gradient;
+		out[k] += simplexNoise((vec2(xs[k], zs[k]) + pass.offset) * pass.scale * pass.frequency, gradient) * pass.amplitude;
+		if (Deriv) {
+			outDx[k] += gradient.x * gradientScale;
+			outDz[k] += gradient.y * gradientScale;
+		}
+	}
+}
+
+
+#ifdef CGRA_NOISE_X86
+
+// ---------------------------------------------------------------- SSE2 (4 lanes)
+
+// 32 bit multiply keeping the low half (_mm_mullo_epi32 is SSE4.1).
+static inline __m128i mullo4(__m128i a, __m128i b) {
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128 floor4(__m128 x) {
+	// Truncate, then step down by one where truncation rounded a negative value up.
+	__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+static inline __m128 lerp4(__m128 a, __m128 b, __m128 t) {
+	return _mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a)));
+}
+
+// Whether every lane holds the same value.
+static inline bool uniform4(__m128i v) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_shuffle_epi32(v, 0))) == 0xFFFF;
+}
+
+// Gradient of lattice corner (ix, iy). Same hash as gradientIndex, then a table lookup per lane (SSE2 has no gather).
+static inline void gradient4(__m128i ix, __m128i iy, __m128 &gx, __m128 &gy) {
+	__m128i n = _mm_add_epi32(mullo4(ix, _mm_set1_epi32(17)), mullo4(iy, _mm_set1_epi32(57)));
+	n = _mm_xor_si128(_mm_slli_epi32(n, 13), n);
+	__m128i inner = _mm_add_epi32(mullo4(mullo4(n, n), _mm_set1_epi32(255179)), _mm_set1_epi32(98712751));
+	__m128i m = _mm_add_epi32(mullo4(n, inner), _mm_set1_epi32(1576546427));
+	m = _mm_srli_epi32(_mm_and_si128(m, _mm_set1_epi32(2147483647)), 31 - gradientTableBits);
+
+	alignas(16) int index[4];
+	_mm_store_si128((__m128i *)index, m);
+	gx = _mm_setr_ps(gradientTable.x[index[0]], gradientTable.x[index[1]], gradientTable.x[index[2]], gradientTable.x[index[3]]);
+	gy = _mm_setr_ps(gradientTable.y[index[0]], gradientTable.y[index[1]], gradientTable.y[index[2]], gradientTable.y[index[3]]);
+}
+
+template <bool Deriv>
+static void octaveSSE2(const OctavePass &pass, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz) {
+	CellCorners cell;
+	__m128 offsetX = _mm_set1_ps(pass.offset.x), offsetZ = _mm_set1_ps(pass.offset.y);
+	__m128 scale = _mm_set1_ps(pass.scale), freq = _mm_set1_ps(pass.frequency);
+	__m128 amplitude = _mm_set1_ps(pass.amplitude);
+	__m128 gradientScale = _mm_set1_ps(pass.amplitude * pass.scale * pass.frequency);
+	__m128 three = _mm_set1_ps(3.0f), two = _mm_set1_ps(2.0f), one = _mm_set1_ps(1.0f), six = _mm_set1_ps(6.0f);
+
+	for (int k = 0; k + 4 <= count; k += 4) {
+		__m128 px = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(xs + k), offsetX), scale), freq);
+		__m128 pz = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(zs + k), offsetZ), scale), freq);
+		__m128 gridX = floor4(px);
+		__m128 gridZ = floor4(pz);
+		__m128 fx = _mm_sub_ps(px, gridX);
+		__m128 fz = _mm_sub_ps(pz, gridZ);
+		__m128 fx1 = _mm_sub_ps(fx, one);
+		__m128 fz1 = _mm_sub_ps(fz, one);
+		__m128 sx = _mm_mul_ps(_mm_mul_ps(fx, fx), _mm_sub_ps(three, _mm_mul_ps(two, fx)));
+		__m128 sz = _mm_mul_ps(_mm_mul_ps(fz, fz), _mm_sub_ps(three, _mm_mul_ps(two, fz)));
+
+		// All four lanes in one cell (the common case along a row) share its cached corners.
+		__m128i ix = _mm_cvttps_epi32(gridX);
+		__m128i iz = _mm_cvttps_epi32(gridZ);
+		__m128 blx, blz, brx, brz, tlx, tlz, trx, trz;
+		if (uniform4(ix) && uniform4(iz)) {
+			const CellCorners &corners = cornersOf(cell, _mm_cvtsi128_si32(ix), _mm_cvtsi128_si32(iz));
+			blx = _mm_set1_ps(corners.bl.x); blz = _mm_set1_ps(corners.bl.y);
+			brx = _mm_set1_ps(corners.br.x); brz = _mm_set1_ps(corners.br.y);
+			tlx = _mm_set1_ps(corners.tl.x); tlz = _mm_set1_ps(corners.tl.y);
+			trx = _mm_set1_ps(corners.tr.x); trz = _mm_set1_ps(corners.tr.y);
+		}
+		else {
+			__m128i ix1 = _mm_add_epi32(ix, _mm_set1_epi32(1));
+			__m128i iz1 = _mm_add_epi32(iz, _mm_set1_epi32(1));
+			gradient4(ix, iz, blx, blz);
+			gradient4(ix1, iz, brx, brz);
+			gradient4(ix, iz1, tlx, tlz);
+			gradient4(ix1, iz1, trx, trz);
+		}
+		__m128 bl = _mm_add_ps(_mm_mul_ps(blx, fx), _mm_mul_ps(blz, fz));
+		__m128 br = _mm_add_ps(_mm_mul_ps(brx, fx1), _mm_mul_ps(brz, fz));
+		__m128 tl = _mm_add_ps(_mm_mul_ps(tlx, fx), _mm_mul_ps(tlz, fz1));
+		__m128 tr = _mm_add_ps(_mm_mul_ps(trx, fx1), _mm_mul_ps(trz, fz1));
+		__m128 noise = lerp4(lerp4(bl, br, sx), lerp4(tl, tr, sx), sz);
+		_mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(noise, amplitude)));
+
+		// See the scalar cellNoise(cell, posFrac, gradient).
+		if (Deriv) {
+			__m128 dsx = _mm_mul_ps(_mm_mul_ps(six, fx), _mm_sub_ps(one, fx));
+			__m128 dsz = _mm_mul_ps(_mm_mul_ps(six, fz), _mm_sub_ps(one, fz));
+			__m128 sxz = _mm_mul_ps(sx, sz);
+			__m128 corners = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(bl, br), tl), tr);
+			__m128 dx = _mm_add_ps(_mm_add_ps(lerp4(blx, brx, sx), _mm_mul_ps(sz, _mm_sub_ps(tlx, blx))),
+				_mm_mul_ps(sxz, _mm_add_ps(_mm_sub_ps(_mm_sub_ps(blx, brx), tlx), trx)));
+			dx = _mm_add_ps(dx, _mm_mul_ps(dsx, _mm_add_ps(_mm_sub_ps(br, bl), _mm_mul_ps(sz, corners))));
+			__m128 dz = _mm_add_ps(_mm_add_ps(lerp4(blz, brz, sx), _mm_mul_ps(sz, _mm_sub_ps(tlz, blz))),
+				_mm_mul_ps(sxz, _mm_add_ps(_mm_sub_ps(_mm_sub_ps(blz, brz), tlz), trz)));
+			dz = _mm_add_ps(dz, _mm_mul_ps(dsz, _mm_add_ps(_mm_sub_ps(tl, bl), _mm_mul_ps(sx, corners))));
+			_mm_storeu_ps(outDx + k, _mm_add_ps(_mm_loadu_ps(outDx + k), _mm_mul_ps(dx, gradientScale)));
+			_mm_storeu_ps(outDz + k, _mm_add_ps(_mm_loadu_ps(outDz + k), _mm_mul_ps(dz, gradientScale)));
+		}
+	}
+}
+
+
+// Adds one simplex corner at offset (dx, dz) with gradient (gx, gz), see the scalar simplexNoise. Lanes outside the
+// corner's falloff radius clamp to zero and add nothing.
+template <bool Deriv>
+static inline void simplexCorner4(__m128 dx, __m128 dz, __m128 gx, __m128 gz, __m128 &noise, __m128 &noiseDx, __m128 &noiseDz) {
+	__m128 falloff = _mm_max_ps(_mm_sub_ps(_mm_set1_ps(0.5f), _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz))), _mm_setzero_ps());
+	__m128 ramp = _mm_add_ps(_mm_mul_ps(gx, dx), _mm_mul_ps(gz, dz));
+	__m128 falloff2 = _mm_mul_ps(falloff, falloff);
+	__m128 falloff4 = _mm_mul_ps(falloff2, falloff2);
+	noise = _mm_add_ps(noise, _mm_mul_ps(falloff4, ramp));
+	if (Deriv) {
+		__m128 slope = _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(8.0f), _mm_mul_ps(falloff2, falloff)), ramp);
+		noiseDx = _mm_add_ps(noiseDx, _mm_sub_ps(_mm_mul_ps(falloff4, gx), _mm_mul_ps(slope, dx)));
+		noiseDz = _mm_add_ps(noiseDz, _mm_sub_ps(_mm_mul_ps(falloff4, gz), _mm_mul_ps(slope, dz)));
+	}
+}
+
+template <bool Deriv>
+static void simplexSSE2(const OctavePass &pass, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz) {
+	__m128 offsetX = _mm_set1_ps(pass.offset.x), offsetZ = _mm_set1_ps(pass.offset.y);
+	__m128 scale = _mm_set1_ps(pass.scale), freq = _mm_set1_ps(pass.frequency);
+	__m128 amplitude = _mm_set1_ps(pass.amplitude * simplexNormalization);
+	__m128 gradientScale = _mm_set1_ps(pass.amplitude * pass.scale * pass.frequency * simplexNormalization);
+	__m128 skew = _mm_set1_ps(simplexSkew), unskew = _mm_set1_ps(simplexUnskew);
+	__m128 one = _mm_set1_ps(1.0f), farUnskew = _mm_set1_ps(1.0f - 2.0f * simplexUnskew);
+	__m128i oneInt = _mm_set1_epi32(1);
+
+	for (int k = 0; k + 4 <= count; k += 4) {
+		__m128 px = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(xs + k), offsetX), scale), freq);
+		__m128 pz = _mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(zs + k), offsetZ), scale), freq);
+		__m128 skewed = _mm_mul_ps(_mm_add_ps(px, pz), skew);
+		__m128 cellX = floor4(_mm_add_ps(px, skewed));
+		__m128 cellZ = floor4(_mm_add_ps(pz, skewed));
+		__m128 unskewed = _mm_mul_ps(_mm_add_ps(cellX, cellZ), unskew);
+		__m128 x0 = _mm_sub_ps(px, _mm_sub_ps(cellX, unskewed));
+		__m128 z0 = _mm_sub_ps(pz, _mm_sub_ps(cellZ, unskewed));
+
+		// The middle corner is (1, 0) below the diagonal of the half square and (0, 1) above it.
+		__m128 below = _mm_cmpgt_ps(x0, z0);
+		__m128 middleX = _mm_and_ps(below, one);
+		__m128 x1 = _mm_add_ps(_mm_sub_ps(x0, middleX), unskew);
+		__m128 z1 = _mm_add_ps(_mm_sub_ps(z0, _mm_sub_ps(one, middleX)), unskew);
+		__m128 x2 = _mm_sub_ps(x0, farUnskew);
+		__m128 z2 = _mm_sub_ps(z0, farUnskew);
+
+		__m128i ix = _mm_cvttps_epi32(cellX);
+		__m128i iz = _mm_cvttps_epi32(cellZ);
+		__m128i middleIx = _mm_and_si128(_mm_castps_si128(below), oneInt);
+		__m128 g0x, g0z, g1x, g1z, g2x, g2z;
+		gradient4(ix, iz, g0x, g0z);
+		gradient4(_mm_add_epi32(ix, middleIx), _mm_add_epi32(iz, _mm_sub_epi32(oneInt, middleIx)), g1x, g1z);
+		gradient4(_mm_add_epi32(ix, oneInt), _mm_add_epi32(iz, oneInt), g2x, g2z);
+
+		__m128 noise = _mm_setzero_ps(), dx = _mm_setzero_ps(), dz = _mm_setzero_ps();
+		simplexCorner4<Deriv>(x0, z0, g0x, g0z, noise, dx, dz);
+		simplexCorner4<Deriv>(x1, z1, g1x, g1z, noise, dx, dz);
+		simplexCorner4<Deriv>(x2, z2, g2x, g2z, noise, dx, dz);
+		_mm_storeu_ps(out + k, _mm_add_ps(_mm_loadu_ps(out + k), _mm_mul_ps(noise, amplitude)));
+		if (Deriv) {
+			_mm_storeu_ps(outDx + k, _mm_add_ps(_mm_loadu_ps(outDx + k), _mm_mul_ps(dx, gradientScale)));
+			_mm_storeu_ps(outDz + k, _mm_add_ps(_mm_loadu_ps(outDz + k), _mm_mul_ps(dz, gradientScale)));
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------- AVX2 (8 lanes)
+
+CGRA_TARGET_AVX2 static inline __m256 lerp8(__m256 a, __m256 b, __m256 t) {
+	return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+CGRA_TARGET_AVX2 static inline void gradient8(__m256i ix, __m256i iy, __m256 &gx, __m256 &gy) {
+	__m256i n = _mm256_add_epi32(_mm256_mullo_epi32(ix, _mm256_set1_epi32(17)), _mm256_mullo_epi32(iy, _mm256_set1_epi32(57)));
+	n = _mm256_xor_si256(_mm256_slli_epi32(n, 13), n);
+	__m256i inner = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_mullo_epi32(n, n), _mm256_set1_epi32(255179)), _mm256_set1_epi32(98712751));
+	__m256i m = _mm256_add_epi32(_mm256_mullo_epi32(n, inner), _mm256_set1_epi32(1576546427));
+	m = _mm256_srli_epi32(_mm256_and_si256(m, _mm256_set1_epi32(2147483647)), 31 - gradientTableBits);
+	gx = _mm256_i32gather_ps(gradientTable.x, m, 4);
+	gy = _mm256_i32gather_ps(gradientTable.y, m, 4);
+}
+
+template <bool Deriv>
+CGRA_TARGET_AVX2 static void octaveAVX2(const OctavePass &pass, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz) {
+	__m256 offsetX = _mm256_set1_ps(pass.offset.x), offsetZ = _mm256_set1_ps(pass.offset.y);
+	__m256 scale = _mm256_set1_ps(pass.scale), freq = _mm256_set1_ps(pass.frequency);
+	__m256 amplitude = _mm256_set1_ps(pass.amplitude);
+	__m256 gradientScale = _mm256_set1_ps(pass.amplitude * pass.scale * pass.frequency);
+	__m256 three = _mm256_set1_ps(3.0f), two = _mm256_set1_ps(2.0f), one = _mm256_set1_ps(1.0f), six = _mm256_set1_ps(6.0f);
+
+	for (int k = 0; k + 8 <= count; k += 8) {
+		__m256 px = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(xs + k), offsetX), scale), freq);
+		__m256 pz = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(zs + k), offsetZ), scale), freq);
+		__m256 gridX = _mm256_floor_ps(px);
+		__m256 gridZ = _mm256_floor_ps(pz);
+		__m256 fx = _mm256_sub_ps(px, gridX);
+		__m256 fz = _mm256_sub_ps(pz, gridZ);
+		__m256 fx1 = _mm256_sub_ps(fx, one);
+		__m256 fz1 = _mm256_sub_ps(fz, one);
+		__m256 sx = _mm256_mul_ps(_mm256_mul_ps(fx, fx), _mm256_sub_ps(three, _mm256_mul_ps(two, fx)));
+		__m256 sz = _mm256_mul_ps(_mm256_mul_ps(fz, fz), _mm256_sub_ps(three, _mm256_mul_ps(two, fz)));
+
+		// Every corner is gathered from the table. Unlike SSE2, checking for a shared cell and broadcasting the
+		// cached corners measured slower than the gathers here.
+		__m256i ix = _mm256_cvttps_epi32(gridX);
+		__m256i iz = _mm256_cvttps_epi32(gridZ);
+		__m256i ix1 = _mm256_add_epi32(ix, _mm256_set1_epi32(1));
+		__m256i iz1 = _mm256_add_epi32(iz, _mm256_set1_epi32(1));
+		__m256 blx, blz, brx, brz, tlx, tlz, trx, trz;
+		gradient8(ix, iz, blx, blz);
+		gradient8(ix1, iz, brx, brz);
+		gradient8(ix, iz1, tlx, tlz);
+		gradient8(ix1, iz1, trx, trz);
+		__m256 bl = _mm256_add_ps(_mm256_mul_ps(blx, fx), _mm256_mul_ps(blz, fz));
+		__m256 br = _mm256_add_ps(_mm256_mul_ps(brx, fx1), _mm256_mul_ps(brz, fz));
+		__m256 tl = _mm256_add_ps(_mm256_mul_ps(tlx, fx), _mm256_mul_ps(tlz, fz1));
+		__m256 tr = _mm256_add_ps(_mm256_mul_ps(trx, fx1), _mm256_mul_ps(trz, fz1));
+		__m256 noise = lerp8(lerp8(bl, br, sx), lerp8(tl, tr, sx), sz);
+		_mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(noise, amplitude)));
+
+		if (Deriv) {
+			__m256 dsx = _mm256_mul_ps(_mm256_mul_ps(six, fx), _mm256_sub_ps(one, fx));
+			__m256 dsz = _mm256_mul_ps(_mm256_mul_ps(six, fz), _mm256_sub_ps(one, fz));
+			__m256 sxz = _mm256_mul_ps(sx, sz);
+			__m256 corners = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(bl, br), tl), tr);
+			__m256 dx = _mm256_add_ps(_mm256_add_ps(lerp8(blx, brx, sx), _mm256_mul_ps(sz, _mm256_sub_ps(tlx, blx))),
+				_mm256_mul_ps(sxz, _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(blx, brx), tlx), trx)));
+			dx = _mm256_add_ps(dx, _mm256_mul_ps(dsx, _mm256_add_ps(_mm256_sub_ps(br, bl), _mm256_mul_ps(sz, corners))));
+			__m256 dz = _mm256_add_ps(_mm256_add_ps(lerp8(blz, brz, sx), _mm256_mul_ps(sz, _mm256_sub_ps(tlz, blz))),
+				_mm256_mul_ps(sxz, _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(blz, brz), tlz), trz)));
+			dz = _mm256_add_ps(dz, _mm256_mul_ps(dsz, _mm256_add_ps(_mm256_sub_ps(tl, bl), _mm256_mul_ps(sx, corners))));
+			_mm256_storeu_ps(outDx + k, _mm256_add_ps(_mm256_loadu_ps(outDx + k), _mm256_mul_ps(dx, gradientScale)));
+			_mm256_storeu_ps(outDz + k, _mm256_add_ps(_mm256_loadu_ps(outDz + k), _mm256_mul_ps(dz, gradientScale)));
+		}
+	}
+}
+
+template <bool Deriv>
+CGRA_TARGET_AVX2 static inline void simplexCorner8(__m256 dx, __m256 dz, __m256 gx, __m256 gz, __m256 &noise, __m256 &noiseDx, __m256 &noiseDz) {
+	__m256 falloff = _mm256_max_ps(_mm256_sub_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dz, dz))), _mm256_setzero_ps());
+	__m256 ramp = _mm256_add_ps(_mm256_mul_ps(gx, dx), _mm256_mul_ps(gz, dz));
+	__m256 falloff2 = _mm256_mul_ps(falloff, falloff);
+	__m256 falloff4 = _mm256_mul_ps(falloff2, falloff2);
+	noise = _mm256_add_ps(noise, _mm256_mul_ps(falloff4, ramp));
+	if (Deriv) {
+		__m256 slope = _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(8.0f), _mm256_mul_ps(falloff2, falloff)), ramp);
+		noiseDx = _mm256_add_ps(noiseDx, _mm256_sub_ps(_mm256_mul_ps(falloff4, gx), _mm256_mul_ps(slope, dx)));
+		noiseDz = _mm256_add_ps(noiseDz, _mm256_sub_ps(_mm256_mul_ps(falloff4, gz), _mm256_mul_ps(slope, dz)));
+	}
+}
+
+template <bool Deriv>
+CGRA_TARGET_AVX2 static void simplexAVX2(const OctavePass &pass, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz) {
+	__m256 offsetX = _mm256_set1_ps(pass.offset.x), offsetZ = _mm256_set1_ps(pass.offset.y);
+	__m256 scale = _mm256_set1_ps(pass.scale), freq = _mm256_set1_ps(pass.frequency);
+	__m256 amplitude = _mm256_set1_ps(pass.amplitude * simplexNormalization);
+	__m256 gradientScale = _mm256_set1_ps(pass.amplitude * pass.scale * pass.frequency * simplexNormalization);
+	__m256 skew = _mm256_set1_ps(simplexSkew), unskew = _mm256_set1_ps(simplexUnskew);
+	__m256 one = _mm256_set1_ps(1.0f), farUnskew = _mm256_set1_ps(1.0f - 2.0f * simplexUnskew);
+	__m256i oneInt = _mm256_set1_epi32(1);
+
+	for (int k = 0; k + 8 <= count; k += 8) {
+		__m256 px = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(xs + k), offsetX), scale), freq);
+		__m256 pz = _mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(zs + k), offsetZ), scale), freq);
+		__m256 skewed = _mm256_mul_ps(_mm256_add_ps(px, pz), skew);
+		__m256 cellX = _mm256_floor_ps(_mm256_add_ps(px, skewed));
+		__m256 cellZ = _mm256_floor_ps(_mm256_add_ps(pz, skewed));
+		__m256 unskewed = _mm256_mul_ps(_mm256_add_ps(cellX, cellZ), unskew);
+		__m256 x0 = _mm256_sub_ps(px, _mm256_sub_ps(cellX, unskewed));
+		__m256 z0 = _mm256_sub_ps(pz, _mm256_sub_ps(cellZ, unskewed));
+
+		__m256 below = _mm256_cmp_ps(x0, z0, _CMP_GT_OQ);
+		__m256 middleX = _mm256_and_ps(below, one);
+		__m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, middleX), unskew);
+		__m256 z1 = _mm256_add_ps(_mm256_sub_ps(z0, _mm256_sub_ps(one, middleX)), unskew);
+		__m256 x2 = _mm256_sub_ps(x0, farUnskew);
+		__m256 z2 = _mm256_sub_ps(z0, farUnskew);
+
+		__m256i ix = _mm256_cvttps_epi32(cellX);
+		__m256i iz = _mm256_cvttps_epi32(cellZ);
+		__m256i middleIx = _mm256_and_si256(_mm256_castps_si256(below), oneInt);
+		__m256 g0x, g0z, g1x, g1z, g2x, g2z;
+		gradient8(ix, iz, g0x, g0z);
+		gradient8(_mm256_add_epi32(ix, middleIx), _mm256_add_epi32(iz, _mm256_sub_epi32(oneInt, middleIx)), g1x, g1z);
+		gradient8(_mm256_add_epi32(ix, oneInt), _mm256_add_epi32(iz, oneInt), g2x, g2z);
+
+		__m256 noise = _mm256_setzero_ps(), dx = _mm256_setzero_ps(), dz = _mm256_setzero_ps();
+		simplexCorner8<Deriv>(x0, z0, g0x, g0z, noise, dx, dz);
+		simplexCorner8<Deriv>(x1, z1, g1x, g1z, noise, dx, dz);
+		simplexCorner8<Deriv>(x2, z2, g2x, g2z, noise, dx, dz);
+		_mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_loadu_ps(out + k), _mm256_mul_ps(noise, amplitude)));
+		if (Deriv) {
+			_mm256_storeu_ps(outDx + k, _mm256_add_ps(_mm256_loadu_ps(outDx + k), _mm256_mul_ps(dx, gradientScale)));
+			_mm256_storeu_ps(outDz + k, _mm256_add_ps(_mm256_loadu_ps(outDz + k), _mm256_mul_ps(dz, gradientScale)));
+		}
+	}
+}
+
+#endif // CGRA_NOISE_X86
+
+
+// Sums the octaves one pass at a time over the whole batch, so the scalar and SSE2 passes keep reusing the lattice
+// cell they are in.
+// Vector kernels fill whole blocks of lanes, the scalar loop finishes the tail. Perlin and simplex fBm have kernels
+// here, everything else goes through the scalar pipeline.
+template <bool Deriv>
+static void fractalNoisePasses(const FractalParams &params, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz, SimdLevel level) {
+	bool simplex = params.basis == NoiseBasis::Simplex;
+	if (params.fractal != FractalType::Fbm || !(simplex || params.basis == NoiseBasis::Perlin)) {
+		fractalKernel(params)(params, xs, zs, count, out, Deriv ? outDx : nullptr, Deriv ? outDz : nullptr);
+		return;
+	}
+	fill(out, out + count, 0.0f);
+	if (Deriv) {
+		fill(outDx, outDx + count, 0.0f);
+		fill(outDz, outDz + count, 0.0f);
+	}
+
+	float maxHeight = 0.0f;
+	OctavePass pass{ vec2(0.0f), params.scale, 1.0f, 1.0f };
+	for (int oct = 0; oct < params.octaves; oct++) {
+		pass.offset = params.octaveOffsets[oct];
+		int done = 0;
+#ifdef CGRA_NOISE_X86
+		if (level == SimdLevel::AVX2) {
+			if (simplex) simplexAVX2<Deriv>(pass, xs, zs, count, out, outDx, outDz);
+			else octaveAVX2<Deriv>(pass, xs, zs, count, out, outDx, outDz);
+			done = count - count % 8;
+		}
+		if (level >= SimdLevel::SSE2 && count - done >= 4) {
+			float *dxTail = Deriv ? outDx + done : nullptr;
+			float *dzTail = Deriv ? outDz + done : nullptr;
+			if (simplex) simplexSSE2<Deriv>(pass, xs + done, zs + done, count - done, out + done, dxTail, dzTail);
+			else octaveSSE2<Deriv>(pass, xs + done, zs + done, count - done, out + done, dxTail, dzTail);
+			done = count - (count - done) % 4;
+		}
+#else
+		(void)level;
+#endif
+		if (simplex) simplexScalar<Deriv>(pass, xs, zs, done, count, out, outDx, outDz);
+		else octaveScalar<Deriv>(pass, xs, zs, done, count, out, outDx, outDz);
+		maxHeight += pass.amplitude;
+		pass.amplitude *= params.persistence;
+		pass.frequency *= params.lacunarity;
+	}
+
+	// Normalise then scale by amplitude.
+	float normalize = params.height / maxHeight;
+	for (int k = 0; k < count; k++) {
+		out[k] *= normalize;
+	}
+	if (Deriv) {
+		for (int k = 0; k < count; k++) {
+			outDx[k] *= normalize;
+			outDz[k] *= normalize;
+		}
+	}
+}
+
+
+void fractalNoiseBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, SimdLevel level) {
+	fractalNoisePasses<false>(params, xs, zs, count, out, nullptr, nullptr, level);
+}
+
+
+void fractalNoiseBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out) {
+	fractalNoiseBatch(params, xs, zs, count, out, detectSimdLevel());
+}
+
+
+void fractalNoiseDerivBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz, SimdLevel level) {
+	fractalNoisePasses<true>(params, xs, zs, count, out, outDx, outDz, level);
+}
+
+
+void fractalNoiseDerivBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz) {
+	fractalNoiseDerivBatch(params, xs, zs, count, out, outDx, outDz, detectSimdLevel());
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// glm
+#include <glm/glm.hpp>
+
+
+// Instruction set used by the batch noise kernel. Picked once at runtime from what the CPU supports.
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+
+// Single octave noise the fractal is built from (see noise_pipeline.hpp).
+enum class NoiseBasis { Perlin, Value, Simplex };
+
+// How each octave is shaped before the octaves are summed. Ridged folds the noise into sharp crests where it crosses
+// zero, billow into rounded hills.
+enum class FractalType { Fbm, Ridged, Billow };
+
+// Settings shared by every sample of one fBm evaluation (mirrors the PerlinNoise parameters).
+struct FractalParams {
+	NoiseBasis basis = NoiseBasis::Perlin;
+	FractalType fractal = FractalType::Fbm;
+	const glm::vec2 *octaveOffsets = nullptr; // One seeded offset per octave.
+	int octaves = 4;
+	float scale = 0.2f;
+	float persistence = 0.4f;
+	float lacunarity = 2.0f;
+	float height = 8.0f;
+};
+
+// Best instruction set available on this CPU (cached after the first call).
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Single octave of Perlin gradient noise at pos, roughly in [-1, 1]. Corner gradients come from a
+// table of 4096 unit vectors indexed by a hash of the lattice corner, so results are fixed for a given position.
+float perlinNoise(glm::vec2 pos);
+// Same, also writing the analytic gradient (d/dx, d/dz) of the noise.
+float perlinNoise(glm::vec2 pos, glm::vec2 &gradient);
+
+// Scalar reference sample of the terrain height: octaves of noise at the seeded offsets, each scaled up in frequency
+// by the lacunarity and down in amplitude by the persistence, summed, normalised by the total amplitude and scaled
+// by the height. Perlin fBm is evaluated here, other bases and fractals go through fractalKernel.
+float fractalNoise(const FractalParams &params, glm::vec2 pos);
+// Same, also writing the analytic gradient of the height, so normals need no neighbouring samples.
+float fractalNoise(const FractalParams &params, glm::vec2 pos, glm::vec2 &gradient);
+
+// The batch functions below have their own kernels for Perlin and simplex fBm. Other bases and fractals go through
+// fractalKernel.
+// Evaluates fBm perlin noise for count samples at (xs[k], zs[k]), writing the heights to out.
+// Processes 8 lanes at a time with AVX2 or 4 with SSE2, with the scalar path for the remainder. Octaves are summed
+// one pass at a time, and samples that stay in the same lattice cell (neighbours along a row) reuse its corners.
+// Simplex fBm has vector kernels too (three corner lookups per sample instead of four).
+// Results match fractalNoise to float rounding.
+void fractalNoiseBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out);
+void fractalNoiseBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, SimdLevel level);
+
+// fractalNoiseBatch that also writes the height gradient (outDx, outDz) of every sample.
+// The surface normal is then normalize(vec3(-dx, 1, -dz)).
+void fractalNoiseDerivBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz);
+void fractalNoiseDerivBatch(const FractalParams &params, const float *xs, const float *zs, int count, float *out, float *outDx, float *outDz, SimdLevel level);
@@ -0,0 +1,121 @@
+#pragma once
+
+// std
+#include <climits>
+#include <cmath>
+
+// glm
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+
+// Lattice hash, gradient table and single cell gradient noise shared by the noise kernels (noise_batch.cpp and
+// noise_pipeline.cpp). Everything is inline so the kernels that include it can inline it into their loops.
+
+// Unit gradients at evenly spaced angles, indexed by the top bits of the lattice hash. Looking them up replaces the
+// cos/sin that used to be evaluated for every corner of every sample. Stored as separate x and y arrays so the AVX2
+// kernel can gather them directly.
+const int gradientTableBits = 12;
+const int gradientTableSize = 1 << gradientTableBits;
+
+struct GradientTable {
+	alignas(32) float x[gradientTableSize];
+	alignas(32) float y[gradientTableSize];
+
+	GradientTable() {
+		for (int i = 0; i < gradientTableSize; i++) {
+			float angle = (i + 0.5f) / gradientTableSize * glm::two_pi<float>();
+			x[i] = std::cos(angle);
+			y[i] = std::sin(angle);
+		}
+	}
+};
+
+// One table shared by every translation unit (an inline variable).
+inline const GradientTable gradientTable;
+
+
+// Positive 31 bit hash of a lattice corner.
+inline unsigned latticeHash(int x, int y) {
+	// Create a hash then bitshift it with XOR to further randomise (unsigned, so overflow wraps).
+	unsigned n = unsigned(x) * 17u + unsigned(y) * 57u;
+	n = (n << 13) ^ n;
+	// Dropping the sign bit gives a positive 31 bit number.
+	return (n * (n * n * 255179u + 98712751u) + 1576546427u) & 2147483647u;
+}
+
+
+// The top bits of the hash pick the gradient.
+inline int gradientIndex(int x, int y) {
+	return int(latticeHash(x, y) >> (31 - gradientTableBits));
+}
+
+
+inline glm::vec2 randGradient(int x, int y) {
+	int index = gradientIndex(x, y);
+	return glm::vec2(gradientTable.x[index], gradientTable.y[index]);
+}
+
+
+// Simplex noise (Stefan Gustavson, "Simplex noise demystified") skews the plane so its triangles become half squares
+// of the lattice, looks up the gradients of the three corners of the triangle a sample is in and sums their ramps
+// under a radial falloff. The normalization brings the largest possible sum with unit gradients to about 1.
+const float simplexSkew = 0.366025404f; // (sqrt(3) - 1) / 2
+const float simplexUnskew = 0.211324865f; // (3 - sqrt(3)) / 6
+const float simplexNormalization = 99.2f;
+
+
+// Gradients of the four corners of one lattice cell. Neighbouring samples in a row mostly stay in the same cell, so
+// the batch kernels keep the last cell they used and only look up corners again when a sample crosses into another.
+struct CellCorners {
+	int x = INT_MIN;
+	int z = INT_MIN;
+	glm::vec2 bl, br, tl, tr;
+};
+
+inline const CellCorners &cornersOf(CellCorners &cell, int x, int z) {
+	if (cell.x != x || cell.z != z) {
+		cell.x = x;
+		cell.z = z;
+		cell.bl = randGradient(x, z);
+		cell.br = randGradient(x + 1, z);
+		cell.tl = randGradient(x, z + 1);
+		cell.tr = randGradient(x + 1, z + 1);
+	}
+	return cell;
+}
+
+
+// Noise inside a cell at posFrac (0 to 1 on each axis).
+inline float cellNoise(const CellCorners &cell, glm::vec2 posFrac) {
+	// Use fractional component of position to make it smoother closer to vertices.
+	glm::vec2 smooth = posFrac * posFrac * (3.0f - 2.0f * posFrac);
+
+	// Gradients of the four grid corners relative to this position.
+	float bl = glm::dot(cell.bl, posFrac);
+	float br = glm::dot(cell.br, posFrac - glm::vec2(1, 0));
+	float tl = glm::dot(cell.tl, posFrac - glm::vec2(0, 1));
+	float tr = glm::dot(cell.tr, posFrac - glm::vec2(1, 1));
+
+	// Bilinear interpolation using smooth/fade.
+	return glm::mix(glm::mix(bl, br, smooth.x), glm::mix(tl, tr, smooth.x), smooth.y);
+}
+
+
+// Same noise, also returning its gradient: the derivative of the fade curve times the corner differences, plus
+// the fade-weighted corner gradients.
+inline float cellNoise(const CellCorners &cell, glm::vec2 posFrac, glm::vec2 &gradient) {
+	glm::vec2 smooth = posFrac * posFrac * (3.0f - 2.0f * posFrac);
+	glm::vec2 smoothDeriv = 6.0f * posFrac * (1.0f - posFrac);
+
+	float bl = glm::dot(cell.bl, posFrac);
+	float br = glm::dot(cell.br, posFrac - glm::vec2(1, 0));
+	float tl = glm::dot(cell.tl, posFrac - glm::vec2(0, 1));
+	float tr = glm::dot(cell.tr, posFrac - glm::vec2(1, 1));
+
+	float corners = bl - br - tl + tr;
+	gradient = cell.bl + smooth.x * (cell.br - cell.bl) + smooth.y * (cell.tl - cell.bl)
+		+ smooth.x * smooth.y * (cell.bl - cell.br - cell.tl + cell.tr)
+		+ smoothDeriv * glm::vec2(br - bl + smooth.y * corners, tl - bl + smooth.x * corners);
+	return glm::mix(glm::mix(bl, br, smooth.x), glm::mix(tl, tr, smooth.x), smooth.y);
+}
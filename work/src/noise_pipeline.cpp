@@ -0,0 +1,222 @@
+// std
+#include <array>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+// project
+#include "noise_pipeline.hpp"
+#include "noise_lattice.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+const char* noiseBasisName(NoiseBasis basis) {
+	switch (basis) {
+		case NoiseBasis::Value: return "Value";
+		case NoiseBasis::Simplex: return "Simplex";
+		default: return "Perlin";
+	}
+}
+
+
+const char* fractalTypeName(FractalType fractal) {
+	switch (fractal) {
+		case FractalType::Ridged: return "Ridged";
+		case FractalType::Billow: return "Billow";
+		default: return "fBm";
+	}
+}
+
+
+float valueNoise(vec2 pos, vec2 &gradient) {
+	vec2 gridPos = floor(pos);
+	int x = int(gridPos.x);
+	int z = int(gridPos.y);
+	vec2 posFrac = pos - gridPos;
+	vec2 smooth = posFrac * posFrac * (3.0f - 2.0f * posFrac);
+	vec2 smoothDeriv = 6.0f * posFrac * (1.0f - posFrac);
+
+	// Corner heights in [-1, 1] from the lattice hash.
+	auto corner = [](int cx, int cz) { return latticeHash(cx, cz) * (2.0f / 2147483647.0f) - 1.0f; };
+	float bl = corner(x, z);
+	float br = corner(x + 1, z);
+	float tl = corner(x, z + 1);
+	float tr = corner(x + 1, z + 1);
+
+	float corners = bl - br - tl + tr;
+	gradient = smoothDeriv * vec2(br - bl + smooth.y * corners, tl - bl + smooth.x * corners);
+	return mix(mix(bl, br, smooth.x), mix(tl, tr, smooth.x), smooth.y);
+}
+
+
+// Corner gradients come from the Perlin gradient table (see noise_lattice.hpp).
+float simplexNoise(vec2 pos, vec2 &gradient) {
+	// Skew the plane so the triangles become half squares, then find which half pos is in.
+	vec2 cell = floor(pos + (pos.x + pos.y) * simplexSkew);
+	vec2 d0 = pos - (cell - (cell.x + cell.y) * simplexUnskew);
+	ivec2 middle = d0.x > d0.y ? ivec2(1, 0) : ivec2(0, 1);
+	vec2 d1 = d0 - vec2(middle) + simplexUnskew;
+	vec2 d2 = d0 - 1.0f + 2.0f * simplexUnskew;
+	ivec2 origin(cell);
+
+	// Each corner adds its gradient ramp times a radial falloff (0.5 - r^2)^4.
+	float noise = 0.0f;
+	gradient = vec2(0.0f);
+	auto addCorner = [&](vec2 d, ivec2 corner) {
+		float falloff = 0.5f - dot(d, d);
+		if (falloff <= 0.0f) return;
+		vec2 cornerGradient = randGradient(corner.x, corner.y);
+		float ramp = dot(cornerGradient, d);
+		float falloff2 = falloff * falloff;
+		noise += falloff2 * falloff2 * ramp;
+		gradient += falloff2 * falloff2 * cornerGradient - 8.0f * falloff2 * falloff * ramp * d;
+	};
+	addCorner(d0, origin);
+	addCorner(d1, origin + middle);
+	addCorner(d2, origin + ivec2(1));
+	gradient *= simplexNormalization;
+	return noise * simplexNormalization;
+}
+
+
+namespace {
+	// Bases: one octave of noise with its gradient.
+	struct PerlinBasis {
+		static float sample(vec2 pos, vec2 &gradient) {
+			vec2 gridPos = floor(pos);
+			CellCorners cell;
+			return cellNoise(cornersOf(cell, int(gridPos.x), int(gridPos.y)), pos - gridPos, gradient);
+		}
+	};
+
+	struct ValueBasis {
+		static float sample(vec2 pos, vec2 &gradient) { return valueNoise(pos, gradient); }
+	};
+
+	struct SimplexBasis {
+		static float sample(vec2 pos, vec2 &gradient) { return simplexNoise(pos, gradient); }
+	};
+
+
+	// Fractals: the shape of each octave (noise n with gradient) before it is summed, kept in [-1, 1].
+	struct FbmFractal {
+		static float shape(float n, vec2 &) { return n; }
+	};
+
+	struct RidgedFractal {
+		static float shape(float n, vec2 &gradient) {
+			float ridge = 1.0f - abs(n);
+			gradient *= (n < 0.0f ? 4.0f : -4.0f) * ridge;
+			return 2.0f * ridge * ridge - 1.0f;
+		}
+	};
+
+	struct BillowFractal {
+		static float shape(float n, vec2 &gradient) {
+			gradient *= n < 0.0f ? -2.0f : 2.0f;
+			return 2.0f * abs(n) - 1.0f;
+		}
+	};
+
+
+	// Constants of one octave, worked out once per batch.
+	struct OctaveStep {
+		vec2 offset;
+		float frequency; // Includes the noise scale.
+		float amplitude;
+	};
+
+
+	// Fractal noise for one combination of basis, fractal and octave count. With a fixed count the octaves are
+	// expanded at compile time, so each sample is one straight run of code with no loop or branches on the settings.
+	// Octaves of 0 reads the count from the params instead.
+	template <class Basis, class Fractal, int Octaves>
+	struct FractalPipeline {
+		template <bool Deriv>
+		static void addOctave(const OctaveStep &step, vec2 pos, float &height, vec2 &gradient) {
+			vec2 octaveGradient;
+			float noise = Fractal::shape(Basis::sample((pos + step.offset) * step.frequency, octaveGradient), octaveGradient);
+			height += noise * step.amplitude;
+			if (Deriv) gradient += octaveGradient * (step.amplitude * step.frequency);
+		}
+
+		template <bool Deriv, size_t... Octave>
+		static float sumOctaves(const OctaveStep *steps, vec2 pos, vec2 &gradient, index_sequence<Octave...>) {
+			float height = 0.0f;
+			(addOctave<Deriv>(steps[Octave], pos, height, gradient), ...);
+			return height;
+		}
+
+		template <bool Deriv>
+		static void samples(const vector<OctaveStep> &steps, float normalize, const float *xs, const float *zs,
+							int count, float *out, float *outDx, float *outDz) {
+			for (int k = 0; k < count; k++) {
+				vec2 pos(xs[k], zs[k]);
+				vec2 gradient(0.0f);
+				float height = 0.0f;
+				if constexpr (Octaves > 0) {
+					height = sumOctaves<Deriv>(steps.data(), pos, gradient, make_index_sequence<Octaves>());
+				} else {
+					for (const OctaveStep &step : steps) {
+						addOctave<Deriv>(step, pos, height, gradient);
+					}
+				}
+				out[k] = height * normalize;
+				if (Deriv) {
+					outDx[k] = gradient.x * normalize;
+					outDz[k] = gradient.y * normalize;
+				}
+			}
+		}
+
+		static void run(const FractalParams &params, const float *xs, const float *zs, int count, float *out,
+						float *outDx, float *outDz) {
+			int octaves = Octaves > 0 ? Octaves : params.octaves;
+			vector<OctaveStep> steps(octaves);
+			float maxHeight = 0.0f;
+			float amplitude = 1.0f;
+			float frequency = 1.0f;
+			for (int oct = 0; oct < octaves; oct++) {
+				steps[oct] = OctaveStep{ params.octaveOffsets[oct], params.scale * frequency, amplitude };
+				maxHeight += amplitude;
+				amplitude *= params.persistence;
+				frequency *= params.lacunarity;
+			}
+			float normalize = params.height / maxHeight;
+			if (outDx) {
+				samples<true>(steps, normalize, xs, zs, count, out, outDx, outDz);
+			} else {
+				samples<false>(steps, normalize, xs, zs, count, out, nullptr, nullptr);
+			}
+		}
+	};
+
+
+	// One row of the table: a kernel for every octave count, the runtime loop first.
+	using KernelRow = array<FractalKernel, unrolledOctaves + 1>;
+
+	template <class Basis, class Fractal, size_t... Octaves>
+	KernelRow kernelRow(index_sequence<Octaves...>) {
+		return KernelRow{ &FractalPipeline<Basis, Fractal, int(Octaves)>::run... };
+	}
+
+	template <class Basis>
+	array<KernelRow, 3> basisKernels() {
+		auto octaves = make_index_sequence<unrolledOctaves + 1>();
+		return { kernelRow<Basis, FbmFractal>(octaves), kernelRow<Basis, RidgedFractal>(octaves),
+				 kernelRow<Basis, BillowFractal>(octaves) };
+	}
+
+	// Indexed by basis, then fractal type, then octave count (in the order of the enums).
+	const array<array<KernelRow, 3>, 3> kernels = {
+		basisKernels<PerlinBasis>(), basisKernels<ValueBasis>(), basisKernels<SimplexBasis>()
+	};
+}
+
+
+FractalKernel fractalKernel(const FractalParams &params) {
+	int octaves = params.octaves >= 1 && params.octaves <= unrolledOctaves ? params.octaves : 0;
+	return kernels[int(params.basis)][int(params.fractal)][octaves];
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "noise_batch.hpp"
+
+
+const char* noiseBasisName(NoiseBasis basis);
+const char* fractalTypeName(FractalType fractal);
+
+// Single octave of value noise (random heights at the lattice corners, blended with the Perlin fade curve) and of
+// simplex noise (gradient noise over a triangular lattice, three corners per sample and no axis-aligned artifacts),
+// each with its analytic gradient. Both lie roughly in [-1, 1].
+float valueNoise(glm::vec2 pos, glm::vec2 &gradient);
+float simplexNoise(glm::vec2 pos, glm::vec2 &gradient);
+
+// Fractal noise of count samples at (xs[k], zs[k]), writing the heights to out and, unless outDx is null, the height
+// gradients to outDx and outDz. Same normalisation and octave offsets as fractalNoiseBatch.
+using FractalKernel = void (*)(const FractalParams &params, const float *xs, const float *zs, int count, float *out,
+							   float *outDx, float *outDz);
+
+// Octave counts up to this have a kernel with the octave loop unrolled at compile time. Larger counts share one with
+// a runtime loop.
+const int unrolledOctaves = 10;
+
+// Kernel for the basis, fractal type and octave count of params, from a table of pre-instantiated variants of
+// FractalPipeline<Basis, Fractal, Octaves> (see noise_pipeline.cpp).
+FractalKernel fractalKernel(const FractalParams &params);
@@ -0,0 +1,169 @@
+// std
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// project
+#include "parallel.hpp"
+
+using namespace std;
+
+
+namespace {
+	// More blocks than threads, so a thread that gets descheduled doesn't hold up the whole loop.
+	const int blocksPerThread = 4;
+
+	atomic<int> threadCountOverride{ 0 };
+
+	// Set on threads that are already running parallelFor work, so nested calls stay serial.
+	thread_local bool insideParallelFor = false;
+
+
+#ifndef CGRA_HAVE_OPENMP
+	// Fallback pool used when OpenMP is not available. Workers sleep until a job is posted, then pull
+	// block indices from a shared counter until none are left. The posting thread works on blocks too.
+	class ThreadPool {
+	public:
+		explicit ThreadPool(int workerCount) {
+			for (int i = 0; i < workerCount; i++) {
+				m_workers.emplace_back([this, i]() { workerLoop(i); });
+			}
+		}
+
+		~ThreadPool() {
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_stop = true;
+			}
+			m_wake.notify_all();
+			for (thread &worker : m_workers) {
+				worker.join();
+			}
+		}
+
+		// Runs the blocks on the calling thread plus up to helpers workers. Returns false without running
+		// anything if another thread is already using the pool.
+		bool tryRun(int blockCount, int helpers, const function<void(int)> &block) {
+			unique_lock<mutex> runLock(m_runMutex, try_to_lock);
+			if (!runLock.owns_lock()) return false;
+
+			{
+				lock_guard<mutex> lock(m_mutex);
+				m_block = &block;
+				m_blockCount = blockCount;
+				m_nextBlock = 0;
+				m_helpers = min(helpers, int(m_workers.size()));
+				m_busyWorkers = int(m_workers.size());
+				m_generation++;
+			}
+			m_wake.notify_all();
+
+			runBlocks();
+
+			// Wait for the workers to finish their last blocks before the job goes out of scope.
+			unique_lock<mutex> lock(m_mutex);
+			m_done.wait(lock, [this]() { return m_busyWorkers == 0; });
+			m_block = nullptr;
+			return true;
+		}
+
+	private:
+		vector<thread> m_workers;
+		mutex m_runMutex; // Held for the duration of one parallelFor.
+		mutex m_mutex;
+		condition_variable m_wake;
+		condition_variable m_done;
+		const function<void(int)> *m_block = nullptr;
+		int m_blockCount = 0;
+		atomic<int> m_nextBlock{ 0 };
+		int m_helpers = 0;
+		int m_busyWorkers = 0;
+		unsigned long long m_generation = 0;
+		bool m_stop = false;
+
+		void runBlocks() {
+			bool wasInside = insideParallelFor;
+			insideParallelFor = true;
+			for (int b = m_nextBlock++; b < m_blockCount; b = m_nextBlock++) {
+				(*m_block)(b);
+			}
+			insideParallelFor = wasInside;
+		}
+
+		void workerLoop(int index) {
+			unsigned long long seenGeneration = 0;
+			while (true) {
+				bool helping;
+				{
+					unique_lock<mutex> lock(m_mutex);
+					m_wake.wait(lock, [&]() { return m_stop || m_generation != seenGeneration; });
+					if (m_stop) return;
+					seenGeneration = m_generation;
+					helping = index < m_helpers;
+				}
+				if (helping) runBlocks();
+				{
+					lock_guard<mutex> lock(m_mutex);
+					m_busyWorkers--;
+				}
+				m_done.notify_one();
+			}
+		}
+	};
+
+	// One worker per extra hardware thread. Lower thread counts just use fewer of them.
+	ThreadPool& threadPool() {
+		static ThreadPool pool(max(1, int(thread::hardware_concurrency())) - 1);
+		return pool;
+	}
+#endif
+}
+
+
+int parallelThreadCount() {
+	int count = threadCountOverride;
+	if (count > 0) return count;
+	return max(1, int(thread::hardware_concurrency()));
+}
+
+
+void setParallelThreadCount(int count) {
+	threadCountOverride = max(0, count);
+}
+
+
+void parallelFor(int begin, int end, const function<void(int, int)> &body) {
+	int count = end - begin;
+	if (count <= 0) return;
+	int threads = min(parallelThreadCount(), count);
+	if (threads <= 1 || insideParallelFor) {
+		body(begin, end);
+		return;
+	}
+
+	// Contiguous blocks, so each thread writes its own slice of the output arrays.
+	int blockCount = min(count, threads * blocksPerThread);
+	auto block = [&](int b) {
+		int blockBegin = begin + int((long long)count * b / blockCount);
+		int blockEnd = begin + int((long long)count * (b + 1) / blockCount);
+		body(blockBegin, blockEnd);
+	};
+
+#ifdef CGRA_HAVE_OPENMP
+	#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+	for (int b = 0; b < blockCount; b++) {
+		insideParallelFor = true;
+		block(b);
+		insideParallelFor = false;
+	}
+#else
+	function<void(int)> blockFunction = block;
+	if (!threadPool().tryRun(blockCount, threads - 1, blockFunction)) {
+		// Pool is busy with another caller, so do the work here instead of waiting.
+		body(begin, end);
+	}
+#endif
+}
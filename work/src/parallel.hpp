@@ -0,0 +1,15 @@
+#pragma once
+
+// std
+#include <functional>
+
+
+// Number of threads parallelFor splits work across. Defaults to the hardware concurrency.
+int parallelThreadCount();
+// Overrides the thread count (values below 1 reset it to the hardware concurrency).
+void setParallelThreadCount(int count);
+
+// Splits [begin, end) into contiguous blocks and runs body(blockBegin, blockEnd) for each block across threads,
+// returning once every block is done. Uses OpenMP when CGRA_HAVE_OPENMP is defined, otherwise a small built-in
+// thread pool. Nested calls (and calls made while the pool is busy) run on the calling thread.
+void parallelFor(int begin, int end, const std::function<void(int, int)> &body);
@@ -1,13 +1,14 @@
 // glm
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <random>
 #include <chrono>
 
 // project
 #include "cgra/cgra_geometry.hpp"
 #include "cgra/cgra_mesh.hpp"
 #include "perlin_noise.hpp"
+#include "parallel.hpp"
+#include "grid_mesh.hpp"
 #include "cgra/cgra_image.hpp"
 
 using namespace std;
@@ -59,24 +60,6 @@ void PerlinNoise::setShaderParams() {
 }
 
 
-// Get the min and max height (as x, y) of the terrain for texturing.
-void PerlinNoise::calculateHeightRange() {
-	// Min and max height initially are the height of the first vertex.
-	vec2 range(vertices[0].pos.y);
-	for (int i = 1; i < vertices.size(); i++) {
-		float vertHeight = vertices[i].pos.y;
-		// Adjust the min/max if any vertex is lower/higher.
-		if (range.x > vertHeight) {
-			range.x = vertHeight;
-		}
-		if (range.y < vertHeight) {
-			range.y = vertHeight;
-		}
-	}
-	heightRange = range;
-}
-
-
 void PerlinNoise::draw(const mat4& view, const mat4& proj, const mat4& lightSpaceMatrix, GLuint shadowMapTexture,
 					   bool enableShadows, bool usePCF) {
 	// set up the shader for every draw call
@@ -101,26 +84,131 @@ void PerlinNoise::draw(const mat4& view, const mat4& proj, const mat4& lightSpac
 	glUniform1i(glGetUniformLocation(shader, "uEnableShadows"), enableShadows);
 	glUniform1i(glGetUniformLocation(shader, "uUsePCF"), usePCF);
 
-	// Draw the terrain mesh.
-	terrain.draw();
+	// Baked normals replace the vertex normals, the world tiles don't have them.
+	bool bakedNormals = bakedNormalMap != 0 && !worldMode;
+	glActiveTexture(GL_TEXTURE27);
+	glBindTexture(GL_TEXTURE_2D, bakedNormals ? bakedNormalMap : 0);
+	glUniform1i(glGetUniformLocation(shader, "uBakedNormalMap"), 27);
+	glUniform1i(glGetUniformLocation(shader, "uBakedNormals"), bakedNormals);
+
+	// Draw the terrain mesh. The LOD distances are measured from the camera position in the view matrix.
+	vec3 eye = vec3(inverse(view) * vec4(0, 0, 0, 1));
+	drawGeometry(shader, proj * view * modelTransform, eye, lodBias);
+}
+
+
+// Draws the terrain triangles with the given shader (also used by the shadow pass). viewProj and eye pick the LOD.
+void PerlinNoise::drawGeometry(GLuint program, const mat4 &viewProj, vec3 eye, float bias) {
+	if (worldMode) {
+		worldChunks().draw();
+	} else if (useLod && heightMap != 0) {
+		lod.select(viewProj, eye, bias);
+		lod.draw(program, heightMap);
+	} else if (compactMesh) {
+		if (heightMap != 0) compact.draw(program, heightMap);
+	} else {
+		terrain.draw();
+	}
+}
+
+
+// Tile cache for world mode. Tiles use the same noise as the single mesh, so the mesh around the origin and
+// the streamed world match.
+TerrainChunks& PerlinNoise::worldChunks() {
+	if (!chunks) {
+		chunks = make_unique<TerrainChunks>(std::max(1, std::min(4, parallelThreadCount() - 1)));
+		chunks->setNoise(TerrainGenerator::fractalParams(builtKey, octaveOffsets), octaveOffsets);
+	}
+	return *chunks;
+}
+
+
+void PerlinNoise::updateWorld(vec3 cameraPosition) {
+	worldChunks().update(cameraPosition);
 }
 
 
-// For water interactions when colliding with terrain.
-void PerlinNoise::createHeightMap(float height) {
+// The heightmap doesn't depend on the water, the water shader compares against the level itself.
+void PerlinNoise::setWaterLevel(float height) {
 	waterHeight = height; // Store water height for controlling tree spawning locations.
-	// Store information in a vector.
-	std::vector<float> heightData(vertices.size());
-	for (size_t i = 0; i < vertices.size(); i++) {
-		heightData[i] = vertices[i].pos.y;
+	TerrainGenerator::setEligibleRange(heightfield, heightRange, waterHeight);
+}
+
+
+void PerlinNoise::simplifyMesh() {
+	if (!meshSimplified) return;
+	float water = mix(heightRange.x, heightRange.y, waterHeight);
+	terrain.destroy();
+	terrain = build_mesh(simplifyTerrain(heightfield.heights(), heightfield.normals(), heightfield.resolution(),
+										 builtKey.meshScale, water, simplify));
+}
+
+
+// The baked normals came from the noise, which the edited heights no longer follow, so a stroke drops them.
+void PerlinNoise::beginSculpt(vec2 position) {
+	flattenHeight = heightfield.height(position);
+	uploadNormalMap(BakedNormalMap());
+}
+
+
+// Edits the heightfield in place, then updates the normals around the edit and the GPU copies of just that area:
+// the heightmap, and the vertex buffer or the compact normals. The cost follows the brush size, not the terrain size.
+void PerlinNoise::sculpt(vec2 position, float deltaTime) {
+	if (worldMode || heightfield.empty()) return;
+	int resolution = heightfield.resolution();
+	float scale = heightfield.meshScale();
+	vector<float> &heights = heightfield.editHeights();
+	GridRect changed = applyBrush(heights, resolution, scale, position, brush, deltaTime, flattenHeight);
+	if (changed.empty()) return;
+	GridRect reshaded = updateNormals(heights, resolution, scale, changed, heightfield.editNormals());
+	const vector<vec3> &normals = heightfield.normals();
+	lod.update(heights, changed);
+
+	// Heightmap rows are grid rows, so the changed heights are one sub-image of the full rows.
+	glBindTexture(GL_TEXTURE_2D, heightMap);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, resolution);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, changed.j0, changed.i0, changed.cols(), changed.rows(), GL_RED, GL_FLOAT,
+					&heights[changed.i0 * resolution + changed.j0]);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	if (compactMesh) {
+		compact.update(normals, reshaded);
+	}
+	// Grid vertices are in the same order as the heights, so each row of the rect is one range of the vertex buffer.
+	// The simplified mesh can't be patched, it is simplified again when the stroke ends.
+	bool gridMesh = !compactMesh && !meshSimplified && terrain.vbo != 0;
+	bool keptVertices = vertices.size() == heights.size();
+	if (!gridMesh && !keptVertices) return;
+	vector<mesh_vertex> row(reshaded.cols());
+	if (gridMesh) glBindBuffer(GL_ARRAY_BUFFER, terrain.vbo);
+	for (int i = reshaded.i0; i <= reshaded.i1; i++) {
+		float u = i / (resolution - 1.0f);
+		for (int j = reshaded.j0; j <= reshaded.j1; j++) {
+			float v = j / (resolution - 1.0f);
+			int vertIndex = i * resolution + j;
+			vec3 position((-1.0f + 2.0f * u) * scale, heights[vertIndex], (-1.0f + 2.0f * v) * scale);
+			row[j - reshaded.j0] = mesh_vertex{ position, normals[vertIndex], vec2(u, v) };
+		}
+		int first = i * resolution + reshaded.j0;
+		if (gridMesh) glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(mesh_vertex), row.size() * sizeof(mesh_vertex), row.data());
+		if (keptVertices) copy(row.begin(), row.end(), vertices.begin() + first);
 	}
+	if (gridMesh) glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	GLuint tex;
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
 
-	// Create texture. 32 bit float on the red channel.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, meshResolution, meshResolution, 0, GL_RED, GL_FLOAT, heightData.data());
+void PerlinNoise::uploadHeightMap() {
+	// Reuse the texture from the last mesh, the sliders can regenerate the terrain every frame.
+	if (heightMap == 0) {
+		glGenTextures(1, &heightMap);
+	}
+	glBindTexture(GL_TEXTURE_2D, heightMap);
+
+	// Create texture. 32 bit float on the red channel, or 16 bit when the compact mesh is drawn from it.
+	int resolution = heightfield.resolution();
+	GLenum format = compactMesh ? compact.heightFormat() : GL_R32F;
+	glTexImage2D(GL_TEXTURE_2D, 0, format, resolution, resolution, 0, GL_RED, GL_FLOAT, heightfield.heights().data());
 
 	// Texture parameters
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -129,179 +217,138 @@ void PerlinNoise::createHeightMap(float height) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	glBindTexture(GL_TEXTURE_2D, 0);
-	// Store for later.
-	heightMap = tex;
 }
 
 
-// Create terrain mesh using perlin noise heightmap.
-void PerlinNoise::createMesh() {
-	// Randomiser based on the user-controlled seed.
-	mt19937 randomiser(noiseSeed);
-	uniform_int_distribution<int> distribution(0, 10000); // Min to max.
-	// Generates 2 random floats to make a vec2 to offset each octave, eliminating repeated patterns.
-	vector<vec2> octaveOffsets(noiseOctaves);
-	for (int oct = 0; oct < noiseOctaves; oct++) {
-		octaveOffsets[oct] = vec2(distribution(randomiser), distribution(randomiser));
-	}
-
-	// Calculate the vertex positions using perlin noise.
-	// 1 vertex on either side of padding for normals to be smooth around the edge of the terrain.
-	int padResolution = meshResolution + 2;
-	vector<vec3> vertexPositions(padResolution * padResolution);
-	for (int i = 0; i < padResolution; ++i) {
-		for (int j = 0; j < padResolution; ++j) {
-			// Get u and v offset on mesh and map to range -noiseSize to noiseSize for x and z.
-			float u = i / (padResolution - 1.0f);
-			float v = j / (padResolution - 1.0f);
-			// Rescale the mesh to the original size after padding.
-			float rescaling = (padResolution - 1.0f) / (meshResolution - 1.0f);
-			float x = (-1.0f + 2.0f * u) * meshScale * rescaling;
-			float z = (-1.0f + 2.0f * v) * meshScale * rescaling;
-
-			// Position, normal and uv of the vertex. Height is based on noise.
-			float height = generatePerlinNoise(vec2(x, z), octaveOffsets);
-			int vertIndex = i * padResolution + j;
-			vertexPositions[vertIndex] = vec3(x, height, z);
-		}
+void PerlinNoise::uploadNormalMap(const BakedNormalMap &map) {
+	if (map.size == 0) {
+		if (bakedNormalMap != 0) glDeleteTextures(1, &bakedNormalMap);
+		bakedNormalMap = 0;
+		return;
 	}
-
-	// Create the vertices which have positions, normals and UVs, utilising the gradient between sorrounding vertices for the normals.
-	vertices = vector<mesh_vertex>(meshResolution * meshResolution);
-	for (int i = 0; i < meshResolution; ++i) {
-		for (int j = 0; j < meshResolution; ++j) {
-			// Get u and v offset on mesh and map to range -noiseSize to noiseSize for x and z.
-			float u = i / (meshResolution - 1.0f);
-			float v = j / (meshResolution - 1.0f);
-
-			// Each increase in i is a whole loop of j over meshResolution.
-			int vertIndex = i * meshResolution + j;
-			int padIndex = (i + 1) * padResolution + (j + 1); // Padding so normals don't go off edge of terrain.
-			vec3 pos = vertexPositions[padIndex];
-			vec2 uv(u, v);
-
-			// Interpolate normal from slope angle between vertex neighbours in x and z directions.
-			vec3 tangentX = normalize(vertexPositions[padIndex + 1] - vertexPositions[padIndex - 1]);
-			vec3 tangentZ = normalize(vertexPositions[padIndex + padResolution] - vertexPositions[padIndex - padResolution]);
-			vec3 norm = normalize(cross(tangentX, tangentZ));
-
-			vertices[vertIndex] = mesh_vertex{ pos, norm, uv };
-		}
+	if (bakedNormalMap == 0) {
+		glGenTextures(1, &bakedNormalMap);
 	}
-	
-	// Create the triangles. Ignore the final vertex (meshResolution - 1) as the quads/triangles are formed up to it.
-	mesh_builder mb;
-	unsigned int index = 0;
-	for (int i = 0; i < meshResolution - 1; ++i) {
-		for (int j = 0; j < meshResolution - 1; ++j) {
-			// Offset i by the rows of j that have been passed already. This is to index the vector properly.
-			int iOffset = i * meshResolution;
-
-			// Get vertices. 2D array alternative: vertices[i][j] to vertices[i+1][j+1].
-			mesh_vertex topLeft = vertices[iOffset + j];
-			mesh_vertex bottomLeft = vertices[iOffset + (j + 1)];
-			mesh_vertex topRight = vertices[(iOffset + meshResolution) + j];
-			mesh_vertex bottomRight = vertices[(iOffset + meshResolution) + (j + 1)];
-			// Add the two sets of three vertices for the left triangle and right triangle.
-			for (mesh_vertex v : { topLeft, topRight, bottomLeft, bottomLeft, topRight, bottomRight }) {
-				mb.push_vertex(v);
-			}
+	glBindTexture(GL_TEXTURE_2D, bakedNormalMap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, map.size, map.size, 0, GL_RG, GL_UNSIGNED_BYTE, map.packed.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	// Mipmapped, several texels can land in one pixel when the map is much finer than the mesh.
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-			// Add all the indices of the quad in a one liner, instead of doing push_index() 6 times.
-			mb.push_indices({ index, index + 1, index + 2, index + 3, index + 4, index + 5 });
-			index += 6;
-		}
-	}
-	// Build and set gl_mesh.
-	terrain = mb.build();
 
-	// Create a heightMap and range for the water to collide with the terrain.
-	//createHeightMap();
-	calculateHeightRange();
+// Create terrain mesh using perlin noise heightmap.
+void PerlinNoise::createMesh(bool storeInCache) {
+	TerrainBuild build = beginBuild(waterHeight, storeInCache);
+	buildTerrain(build);
+	applyTerrain(build);
 }
 
 
-inline vec2 randGradient(vec2 v) {
-	// Create a hash then bitshift it with XOR to further randomise.
-	int n = int(v.x) * 17 + int(v.y) * 57;
-	n = (n << 13) ^ n;
-	// 2147483647 is max int, so bitwise AND is used with it to force a positive integer by dropping the (positive/negative) sign bit.
-	float num = ((n * (n * n * 255179 + 98712751) + 1576546427) & 2147483647) / 2147483647.0f; // Divided by max int (as float) to give [0.0, 1.0] range.
+// Copy of the settings a rebuild needs, so the sliders can keep changing while it runs.
+TerrainBuild PerlinNoise::beginBuild(float waterLevel, bool storeInCache) const {
+	TerrainBuild build;
+	build.key = heightfieldKey();
+	build.simplify = simplify;
+	build.simplify.enabled = simplify.enabled && !compactMesh;
+	build.withVertices = (!compactMesh && !build.simplify.enabled) || keepVertices;
+	build.useCache = useHeightCache;
+	build.storeInCache = storeInCache;
+	build.waterLevel = waterLevel;
+	build.erosion = erosion;
+	build.normalMap = normalMap;
+	build.normalMap.enabled = normalMap.enabled && !erosion.enabled;
+	build.progress = buildProgress;
+	return build;
+}
+
 
-	// Next convert the random number from [0.0, 1.0] into an angle from [0.0, 2PI] for a circular gradient.
-	float angle = num * glm::two_pi<float>();
-	return vec2(cos(angle), sin(angle));
+// The CPU side of createMesh, safe to run on another thread while the current terrain draws.
+void PerlinNoise::buildTerrain(TerrainBuild &build) {
+	generator.build(build);
 }
 
 
-// Inspiration from: https://gist.github.com/patriciogonzalezvivo/670c22f3966e662d2f83
-float PerlinNoise::generateNoise(vec2 pos) {
-	// Use fractional component of position to make it smoother closer to vertices.
-	vec2 gridPos = floor(pos);
-	vec2 posFrac = pos - gridPos;
-	vec2 smooth = posFrac * posFrac * (3.0f - 2.0f * posFrac);
+// The GL side of createMesh, on the render thread. Replaces the drawn terrain with the build (which is left empty).
+void PerlinNoise::applyTerrain(TerrainBuild &build) {
+	const HeightfieldKey &key = build.key;
+	int resolution = key.resolution;
+	builtKey = key;
+	octaveOffsets = move(build.octaveOffsets);
+	loadedFromCache = build.loadedFromCache;
+	heightRange = build.heightRange;
 
-	// Gradients of the four grid corners relative to this position.
-	float bl = dot(randGradient(gridPos), posFrac);
-	float br = dot(randGradient(gridPos + vec2(1, 0)), posFrac - vec2(1, 0));
-	float tl = dot(randGradient(gridPos + vec2(0, 1)), posFrac - vec2(0, 1));
-	float tr = dot(randGradient(gridPos + vec2(1, 1)), posFrac - vec2(1, 1));
+	// The water level may have moved while the build ran.
+	if (build.waterLevel != waterHeight) {
+		TerrainGenerator::setEligibleRange(build.heightfield, heightRange, waterHeight);
+	}
+	swap(heightfield, build.heightfield);
+	lod.build(heightfield.heights(), resolution, key.meshScale);
+
+	// Create the triangles over the shared vertices. Each grid vertex is uploaded once and indexed by its neighbouring
+	// quads. The compact mesh has no vertex buffer, just the packed normals next to the heightmap.
+	// A build started before the compact checkbox changed may not have vertices, the rebuild that follows fixes that.
+	// The simplified mesh has its own vertices, only the ones its triangles use.
+	terrain.destroy();
+	terrain = gl_mesh();
+	meshSimplified = false;
+	if (compactMesh) {
+		compact.build(heightfield.normals(), resolution, key.meshScale);
+	} else {
+		compact.destroy();
+		if (build.simplify.enabled) {
+			terrain = build_mesh(build.simplified);
+			meshSimplified = true;
+			// Simplified for a water level or error that has changed since.
+			if (build.waterLevel != waterHeight || build.simplify.maxError != simplify.maxError ||
+				build.simplify.underwaterError != simplify.underwaterError) {
+				simplifyMesh();
+			}
+		} else if (build.withVertices) {
+			terrain = buildGridMesh(build.vertices, resolution, resolution, meshTopology);
+		}
+	}
+	vertices.clear();
+	if (keepVertices) {
+		vertices = move(build.vertices);
+	}
+	uploadHeightMap();
+	uploadNormalMap(build.bakedNormals);
 
-	// Bilinear interpolation using smooth/fade.
-    return mix(mix(bl, br, smooth.x), mix(tl, tr, smooth.x), smooth.y);
+	// Streamed tiles are rebuilt from the new noise as they come back into view.
+	if (chunks) {
+		chunks->setNoise(TerrainGenerator::fractalParams(key, octaveOffsets), octaveOffsets);
+	}
 }
 
 
-float PerlinNoise::generatePerlinNoise(vec2 pos, const vector<vec2> &octaveOffsets) {
-	float noiseHeight = 0.0f;
-	float maxHeight = 0.0f;
-	float amplitude = 1.0f;
-	float frequency = 1.0f;
-	// Create perlin noise by combining noise octaves of doubling frequency and halving amplitude.
-	for (int oct = 0; oct < noiseOctaves; oct++) {
-		// Uses seeded octave offsets, noise scale and diminishing frequency and amplitude per octave.
-		noiseHeight += generateNoise((pos + octaveOffsets[oct]) * noiseScale * frequency) * amplitude;
-		maxHeight += amplitude;
-		// Each octave has lower amplitude and higher frequency by the persistence and lacunarity scales.
-		amplitude *= noisePersistence;
-		frequency *= noiseLacunarity;
-	}
-	// Normalise then scale by amplitude.
-	float normalizedHeight = noiseHeight / maxHeight;
-	return normalizedHeight * meshHeight;
+HeightfieldKey PerlinNoise::heightfieldKey() const {
+	HeightfieldKey key;
+	key.seed = noiseSeed;
+	key.octaves = noiseOctaves;
+	key.resolution = meshResolution;
+	key.persistence = noisePersistence;
+	key.lacunarity = noiseLacunarity;
+	key.scale = noiseScale;
+	key.height = meshHeight;
+	key.meshScale = meshScale;
+	key.basis = int32_t(noiseBasis);
+	key.fractal = int32_t(noiseFractal);
+	key.erosion = erosion.hash();
+	return key;
 }
 
 
-// For drawing trees on the terrain.
+// For drawing trees on the terrain. Positions that are underwater or on a peak move to the closest vertex where
+// trees can grow.
 vec3 PerlinNoise::sampleVertex(vec2 position) {
-	int vertCount = meshResolution - 1;
-
-	float x = position.x;
-	float z = position.y;
-
-	// We want the closest valid vertex.
-	float bestDistance = 10000;
-	vec3 bestVert = vec3(0);
-	// Get places where trees can grow.
-	float min = heightRange.x;
-	float max = heightRange.y;
-	for (int index = 0; index < meshResolution * meshResolution; index++) {
-		vec3 vert = vertices[index].pos;
-		float heightProp = (vert.y - min) / (max - min);
-		// Trees can only spawn above water and not on the tips of mountains.
-		if (heightProp >= waterHeight && heightProp <= 0.95) {
-			// Find the closest vertex (horizontally) to the position.
-			float distance = sqrt(pow(vert.x - x, 2) + pow(vert.z - z, 2));
-			if (distance < bestDistance) {
-				bestDistance = distance;
-				bestVert = vert;
-			}
-			// Good enough, so stop early to speed up.
-			if (bestDistance < 1.5f) {
-				break;
-			}
-		}
-	}
-
-	return bestVert - vec3(0, 0.2f, 0); // Move slightly into ground.
-}
\ No newline at end of file
+	vec3 point(0.0f);
+	heightfield.nearestEligible(position, point);
+	return point - vec3(0, 0.2f, 0); // Move slightly into ground.
+}
@@ -1,21 +1,37 @@
 #pragma once
 
+// std
+#include <memory>
+
 // glm
 #include <glm/glm.hpp>
 
 // project
 #include "opengl.hpp"
+#include "noise_batch.hpp"
+#include "grid_mesh.hpp"
+#include "terrain_chunks.hpp"
+#include "terrain_lod.hpp"
+#include "terrain_compact.hpp"
+#include "heightfield.hpp"
+#include "terrain_generator.hpp"
+#include "terrain_sculpt.hpp"
 
 class PerlinNoise {
 private:
-	float generateNoise(glm::vec2 pos);
-	float generatePerlinNoise(glm::vec2 pos, const std::vector<glm::vec2> &octaveOffsets);
+	HeightfieldKey heightfieldKey() const;
 	void loadTexture(int index);
-	void calculateHeightRange();
+	void uploadHeightMap();
+	void uploadNormalMap(const BakedNormalMap &map);
 	GLuint textures[8]{};
 	GLuint normalMaps[8]{};
-	std::vector<glm::vec3> validVertices;
-	float waterHeight;
+	GLuint bakedNormalMap = 0; // Noise normals finer than the mesh, 0 when not baked.
+	float waterHeight = 0.0f;
+	HeightfieldKey builtKey{}; // Settings of the terrain currently drawn, which the sliders may already be ahead of.
+	std::vector<glm::vec2> octaveOffsets; // Seeded offsets of the drawn terrain, shared with the world tiles.
+	std::unique_ptr<TerrainChunks> chunks; // Created the first time world mode is used.
+	bool meshSimplified = false; // Whether terrain holds the simplified mesh.
+	float flattenHeight = 0.0f; // Height under the brush when the sculpting stroke started.
 
 public:
 	cgra::gl_mesh terrain;
@@ -29,11 +45,33 @@ public:
 	float noiseLacunarity = 2.0f; // Frequency increase between octaves.
 	float noiseScale = 0.2f; // Spread of noise.
 	int noiseOctaves = 4; // Higher octaves add finer details.
+	NoiseBasis noiseBasis = NoiseBasis::Perlin; // Noise summed in each octave.
+	FractalType noiseFractal = FractalType::Fbm; // Shape of each octave: plain, ridged or billowy.
 	float meshHeight = 8.0f; // Overall height.
 	float meshScale = 10.0f; // Overall size of mesh.
 	int meshResolution = 100; // Square this to get total vertices.
+	GridTopology meshTopology = GridTopology::Triangles; // Indexed triangles or primitive-restart strips.
 	float textureScale = 18.0f; // Size of texture.
-	std::vector<cgra::mesh_vertex> vertices;
+	std::vector<cgra::mesh_vertex> vertices; // Only filled when keepVertices is set, the drawing paths don't need it.
+	bool keepVertices = false; // Keep a CPU copy of the full mesh vertices after createMesh.
+	bool worldMode = false; // Stream tiles of the same noise around the camera instead of drawing the single mesh.
+	bool useLod = false; // Draw the mesh as distance-based LOD patches displaced by the heightmap.
+	float lodBias = 0.0f; // Coarser LOD for secondary passes (reflection/refraction), set before draw.
+	TerrainLod lod;
+	bool compactMesh = false; // Draw from the heightmap and a packed normal texture instead of a vertex buffer.
+	TerrainCompact compact;
+	SimplifySettings simplify; // Draw an error-bounded simplification of the grid (not in compact mode).
+	// Shade with normals baked from the noise at a finer grid than the mesh, so a coarse mesh keeps the lighting
+	// detail of a fine one (not in world mode, or on eroded heights that no longer follow the noise).
+	NormalMapSettings normalMap;
+	Heightfield heightfield; // Height, normal and tree eligibility queries on the mesh.
+	ErosionSettings erosion; // Hydraulic and thermal erosion of the generated heights.
+	BrushSettings brush; // Sculpting brush.
+	// Fraction of the erosion done by the build in progress, for the GUI.
+	std::shared_ptr<std::atomic<float>> buildProgress = std::make_shared<std::atomic<float>>(0.0f);
+	bool useHeightCache = true; // Load previously generated heights from disk instead of evaluating the noise.
+	bool loadedFromCache = false; // Whether the last createMesh came from the cache.
+	TerrainGenerator generator; // CPU side of createMesh, with the octave layer and height caches.
 
 	// User chosen textures that smoothly transition based on height.
 	int chosenTextures[8] = { 1, 0, 0, 0, 0, 0, 0, 0 };
@@ -52,7 +90,27 @@ public:
 	void draw(const glm::mat4& view, const glm::mat4& proj, const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f),
 			  GLuint shadowMapTexture = 0, bool enableShadows = false, bool usePCF = true);
 	void setShaderParams();
-	void createMesh();
-	void createHeightMap(float waterHeight);
+	// Rebuilds the terrain for the current settings. With storeInCache, freshly generated heights are written to the
+	// height cache (off while dragging sliders, so every intermediate value isn't saved).
+	void createMesh(bool storeInCache = true);
+	// The same rebuild in three steps. beginBuild copies the settings, buildTerrain is the CPU work and can run in the
+	// background (see RegenerationQueue), applyTerrain uploads the result and makes it the drawn terrain.
+	TerrainBuild beginBuild(float waterLevel, bool storeInCache = true) const;
+	void buildTerrain(TerrainBuild &build);
+	void applyTerrain(TerrainBuild &build);
+	// Sets the water level (as a proportion of the height range) that trees grow above.
+	void setWaterLevel(float waterHeight);
+	// Simplifies the drawn heights again after the water level or the allowed error changed.
+	void simplifyMesh();
+	// Brush edits of the drawn heights (not in world mode). A stroke is beginSculpt, then a sculpt call every frame
+	// the brush is held down. Each sculpt call only updates and uploads the area under the brush. The height range
+	// (texture bands and water level) stays as generated, the tree eligibility and the simplified mesh are out of
+	// date until setWaterLevel and simplifyMesh run again once the stroke ends.
+	// Generating the terrain again replaces the edits.
+	void beginSculpt(glm::vec2 position);
+	void sculpt(glm::vec2 position, float deltaTime);
+	void drawGeometry(GLuint program, const glm::mat4 &viewProj, glm::vec3 eye, float lodBias = 0.0f);
+	TerrainChunks& worldChunks();
+	void updateWorld(glm::vec3 cameraPosition);
 	glm::vec3 sampleVertex(glm::vec2 position);
 };
\ No newline at end of file
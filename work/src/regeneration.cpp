@@ -0,0 +1,70 @@
+// project
+#include "regeneration.hpp"
+
+using namespace std;
+
+
+RegenerationQueue::RegenerationQueue() {
+	m_worker = thread([this]() { workerLoop(); });
+}
+
+
+// Waits for the running job, but drops anything queued or unapplied.
+RegenerationQueue::~RegenerationQueue() {
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+		m_pending = nullptr;
+	}
+	m_wake.notify_all();
+	m_worker.join();
+}
+
+
+void RegenerationQueue::submit(Job job) {
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_pending = move(job);
+	}
+	m_wake.notify_all();
+}
+
+
+bool RegenerationQueue::applyFinished() {
+	Apply apply;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		apply = move(m_finished);
+		m_finished = nullptr;
+	}
+	if (!apply) return false;
+	apply();
+	return true;
+}
+
+
+bool RegenerationQueue::busy() const {
+	lock_guard<mutex> lock(m_mutex);
+	return m_running || m_pending || m_finished;
+}
+
+
+void RegenerationQueue::workerLoop() {
+	while (true) {
+		Job job;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wake.wait(lock, [this]() { return m_stop || m_pending; });
+			if (m_stop) return;
+			job = move(m_pending);
+			m_pending = nullptr;
+			m_running = true;
+		}
+
+		Apply apply = job();
+
+		lock_guard<mutex> lock(m_mutex);
+		m_running = false;
+		if (apply) m_finished = move(apply);
+	}
+}
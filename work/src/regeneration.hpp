@@ -0,0 +1,42 @@
+#pragma once
+
+// std
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+
+// Runs scene rebuilds on a background thread, one at a time, so the frame loop never waits on generation.
+// A job does the CPU work and returns a function that swaps its result into the scene (GL uploads included).
+// Those run on the render thread in applyFinished(), called at the start of a frame, so the previous scene keeps
+// drawing until the new one is complete. A job submitted while another is running replaces any job still waiting,
+// so dragging a slider only ever builds the latest value rather than queueing one rebuild per tick.
+class RegenerationQueue {
+public:
+	using Apply = std::function<void()>;
+	using Job = std::function<Apply()>;
+
+	RegenerationQueue();
+	~RegenerationQueue();
+	RegenerationQueue(const RegenerationQueue&) = delete;
+	RegenerationQueue& operator=(const RegenerationQueue&) = delete;
+
+	// Queues job, dropping a queued job that hasn't started yet.
+	void submit(Job job);
+	// Swaps in the newest finished job (older finished ones are skipped). Returns true if one was applied.
+	bool applyFinished();
+	// Whether a job is queued, running or waiting to be applied.
+	bool busy() const;
+
+private:
+	std::thread m_worker;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wake;
+	Job m_pending;
+	Apply m_finished;
+	bool m_running = false;
+	bool m_stop = false;
+
+	void workerLoop();
+};
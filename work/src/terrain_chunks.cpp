@@ -0,0 +1,258 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "terrain_chunks.hpp"
+#include "grid_mesh.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+TerrainChunks::TerrainChunks(int workerCount) {
+	for (int i = 0; i < std::max(1, workerCount); i++) {
+		m_workers.emplace_back([this]() { workerLoop(); });
+	}
+}
+
+
+// Only joins the workers. GL buffers are freed with clear(), which needs a live context.
+TerrainChunks::~TerrainChunks() {
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (thread &worker : m_workers) {
+		worker.join();
+	}
+}
+
+
+void TerrainChunks::setNoise(const FractalParams &params, const vector<vec2> &octaveOffsets) {
+	clear();
+	lock_guard<mutex> lock(m_mutex);
+	m_noise.octaveOffsets = octaveOffsets;
+	m_noise.params = params;
+	m_noise.params.octaveOffsets = nullptr; // Workers point this at their own copy of the offsets.
+	m_noise.tileSize = tileSize;
+	m_noise.tileResolution = tileResolution;
+	m_noise.generation++;
+}
+
+
+void TerrainChunks::clear() {
+	for (auto &entry : m_tiles) {
+		entry.second.mesh.destroy();
+	}
+	m_tiles.clear();
+	m_lru.clear();
+	m_requested.clear();
+
+	lock_guard<mutex> lock(m_mutex);
+	m_queue.clear();
+	m_finished.clear();
+}
+
+
+void TerrainChunks::update(vec3 cameraPosition) {
+	m_frame++;
+
+	// Tile layout changed in the GUI, so every cached tile is the wrong shape.
+	if (tileSize != m_noise.tileSize || tileResolution != m_noise.tileResolution) {
+		NoiseSnapshot noise = m_noise;
+		setNoise(noise.params, noise.octaveOffsets);
+	}
+	ensureIndexBuffer();
+
+	m_centre = ivec2(floor(vec2(cameraPosition.x, cameraPosition.z) / tileSize));
+	int radius = effectiveRadius();
+	auto inRange = [&](TileKey key) {
+		ivec2 offset = abs(keyCoords(key) - m_centre);
+		return offset.x <= radius && offset.y <= radius;
+	};
+
+	// Take a few finished tiles, drop queued tiles the camera has moved away from, and queue missing ones.
+	vector<TileData> finished;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_focus = m_centre;
+		int count = std::min(int(m_finished.size()), std::max(1, uploadsPerFrame));
+		move(m_finished.begin(), m_finished.begin() + count, back_inserter(finished));
+		m_finished.erase(m_finished.begin(), m_finished.begin() + count);
+
+		m_queue.erase(remove_if(m_queue.begin(), m_queue.end(), [&](TileKey key) {
+			if (inRange(key)) return false;
+			m_requested.erase(key);
+			return true;
+		}), m_queue.end());
+
+		for (int x = m_centre.x - radius; x <= m_centre.x + radius; x++) {
+			for (int z = m_centre.y - radius; z <= m_centre.y + radius; z++) {
+				TileKey key = makeKey(x, z);
+				if (m_tiles.count(key) || m_requested.count(key)) continue;
+				m_requested.insert(key);
+				m_queue.push_back(key);
+			}
+		}
+	}
+	m_wake.notify_all();
+
+	for (TileData &data : finished) {
+		m_requested.erase(data.key);
+		if (data.generation == m_noise.generation && !m_tiles.count(data.key)) {
+			uploadTile(data);
+		}
+	}
+
+	// Everything in view counts as used this frame.
+	for (auto &entry : m_tiles) {
+		if (!inRange(entry.first)) continue;
+		Tile &tile = entry.second;
+		tile.lastUsedFrame = m_frame;
+		m_lru.splice(m_lru.begin(), m_lru, tile.lruPosition);
+	}
+	evictOverBudget();
+}
+
+
+void TerrainChunks::draw() {
+	int radius = effectiveRadius();
+	for (auto &entry : m_tiles) {
+		ivec2 offset = abs(keyCoords(entry.first) - m_centre);
+		if (offset.x <= radius && offset.y <= radius) {
+			entry.second.mesh.draw();
+		}
+	}
+}
+
+
+// The view radius shrinks if the square of tiles around the camera would not fit in the memory budget.
+int TerrainChunks::effectiveRadius() const {
+	size_t budget = size_t(std::max(1, memoryBudgetMB)) * 1024 * 1024;
+	int maxTiles = int(budget / tileBytes());
+	int budgetRadius = int((sqrt(float(std::max(1, maxTiles))) - 1.0f) / 2.0f);
+	return std::max(0, std::min(viewRadius, budgetRadius));
+}
+
+
+TerrainChunks::TileKey TerrainChunks::makeKey(int x, int z) {
+	return (TileKey(x) << 32) | TileKey(unsigned(z));
+}
+
+
+ivec2 TerrainChunks::keyCoords(TileKey key) {
+	return ivec2(int(key >> 32), int(unsigned(key & 0xFFFFFFFF)));
+}
+
+
+// Builds one tile on a worker thread. Normals come from the analytic noise gradient at each vertex, so a vertex on
+// a tile edge gets exactly the same normal from both tiles that share it and the lighting has no seams.
+TerrainChunks::TileData TerrainChunks::generateTile(const NoiseSnapshot &noise, TileKey key) {
+	int resolution = noise.tileResolution;
+	float spacing = noise.tileSize / (resolution - 1.0f);
+	vec2 origin = vec2(keyCoords(key)) * noise.tileSize;
+
+	FractalParams params = noise.params;
+	params.octaveOffsets = noise.octaveOffsets.data();
+
+	TileData data;
+	data.key = key;
+	data.generation = noise.generation;
+	data.resolution = resolution;
+	data.vertices.resize(resolution * resolution);
+
+	// Same row batching as PerlinNoise::createMesh.
+	vector<float> rowX(resolution), rowZ(resolution), rowHeights(resolution), rowDx(resolution), rowDz(resolution);
+	for (int j = 0; j < resolution; j++) {
+		rowZ[j] = origin.y + j * spacing;
+	}
+	for (int i = 0; i < resolution; i++) {
+		float x = origin.x + i * spacing;
+		fill(rowX.begin(), rowX.end(), x);
+		fractalNoiseDerivBatch(params, rowX.data(), rowZ.data(), resolution, rowHeights.data(), rowDx.data(), rowDz.data());
+		for (int j = 0; j < resolution; j++) {
+			vec3 norm = normalize(vec3(-rowDx[j], 1.0f, -rowDz[j]));
+			vec2 uv(i / (resolution - 1.0f), j / (resolution - 1.0f));
+			data.vertices[i * resolution + j] = mesh_vertex{ vec3(x, rowHeights[j], rowZ[j]), norm, uv };
+		}
+	}
+	return data;
+}
+
+
+size_t TerrainChunks::tileBytes() const {
+	return size_t(tileResolution) * tileResolution * sizeof(mesh_vertex);
+}
+
+
+void TerrainChunks::uploadTile(TileData &data) {
+	Tile &tile = m_tiles[data.key];
+	tile.mesh = build_mesh(data.vertices, m_indexBuffer, m_indexCount);
+	m_lru.push_front(data.key);
+	tile.lruPosition = m_lru.begin();
+	tile.lastUsedFrame = m_frame;
+}
+
+
+// Drops least recently used tiles until the cache fits the budget. Tiles used this frame are never evicted,
+// effectiveRadius() already keeps those within the budget.
+void TerrainChunks::evictOverBudget() {
+	size_t budget = size_t(std::max(1, memoryBudgetMB)) * 1024 * 1024;
+	while (residentBytes() > budget && !m_lru.empty()) {
+		auto tile = m_tiles.find(m_lru.back());
+		if (tile->second.lastUsedFrame == m_frame) break;
+		tile->second.mesh.destroy();
+		m_tiles.erase(tile);
+		m_lru.pop_back();
+	}
+}
+
+
+// Every tile has the same grid, so they all draw through one index buffer.
+void TerrainChunks::ensureIndexBuffer() {
+	if (m_indexBuffer != 0 && m_indexResolution == tileResolution) return;
+	if (m_indexBuffer == 0) glGenBuffers(1, &m_indexBuffer);
+
+	vector<GLuint> indices = gridIndices(tileResolution, tileResolution, GridTopology::Triangles);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	m_indexCount = int(indices.size());
+	m_indexResolution = tileResolution;
+}
+
+
+void TerrainChunks::workerLoop() {
+	while (true) {
+		NoiseSnapshot noise;
+		TileKey key;
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wake.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+			if (m_stop) return;
+
+			// Closest tile to the camera first, so the ground under the camera fills in before the horizon.
+			auto distance = [this](TileKey k) {
+				ivec2 offset = abs(keyCoords(k) - m_focus);
+				return std::max(offset.x, offset.y);
+			};
+			auto next = min_element(m_queue.begin(), m_queue.end(), [&](TileKey a, TileKey b) {
+				return distance(a) < distance(b);
+			});
+			key = *next;
+			m_queue.erase(next);
+			noise = m_noise;
+		}
+
+		TileData data = generateTile(noise, key);
+
+		lock_guard<mutex> lock(m_mutex);
+		// Results for a noise field that was replaced while this tile was being built are thrown away.
+		if (data.generation == m_noise.generation) {
+			m_finished.push_back(move(data));
+		}
+	}
+}
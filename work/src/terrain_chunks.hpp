@@ -0,0 +1,108 @@
+#pragma once
+
+// std
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "opengl.hpp"
+#include "cgra/cgra_mesh.hpp"
+#include "noise_batch.hpp"
+
+
+// Streams a very large terrain as square tiles around the camera. Tiles are generated on worker threads,
+// uploaded a few per frame, and evicted least-recently-used once the cache goes over its memory budget.
+// Every tile samples the same world-space noise field, so neighbouring tiles line up without seams.
+class TerrainChunks {
+public:
+	float tileSize = 20.0f; // World size of one tile edge.
+	int tileResolution = 65; // Vertices along one tile edge.
+	int viewRadius = 6; // Tiles kept loaded in each direction around the camera.
+	int memoryBudgetMB = 128; // Upper bound on the vertex memory held by resident tiles.
+	int uploadsPerFrame = 4; // Finished tiles uploaded per frame, so streaming never stalls a frame.
+
+	explicit TerrainChunks(int workerCount = 2);
+	~TerrainChunks();
+	TerrainChunks(const TerrainChunks&) = delete;
+	TerrainChunks& operator=(const TerrainChunks&) = delete;
+
+	// Switches to a new noise field. Drops every cached tile and any work still queued for the old one.
+	void setNoise(const FractalParams &params, const std::vector<glm::vec2> &octaveOffsets);
+	// Requests missing tiles around the camera, uploads finished ones and evicts over-budget tiles.
+	void update(glm::vec3 cameraPosition);
+	// Draws every resident tile inside the view radius with whatever shader is bound.
+	void draw();
+	// Frees all tiles (GL buffers included).
+	void clear();
+
+	// Stats for the GUI.
+	int residentTiles() const { return int(m_tiles.size()); }
+	size_t residentBytes() const { return m_tiles.size() * tileBytes(); }
+	int pendingTiles() const { return int(m_requested.size()); }
+	int effectiveRadius() const;
+
+private:
+	// Tile coordinates packed into one key.
+	using TileKey = long long;
+
+	struct Tile {
+		cgra::gl_mesh mesh;
+		std::list<TileKey>::iterator lruPosition;
+		unsigned long long lastUsedFrame = 0;
+	};
+
+	// CPU side result handed back from a worker.
+	struct TileData {
+		TileKey key;
+		unsigned generation;
+		int resolution;
+		std::vector<cgra::mesh_vertex> vertices;
+	};
+
+	// Snapshot of everything a worker needs, so the GUI can change settings while tiles are in flight.
+	struct NoiseSnapshot {
+		std::vector<glm::vec2> octaveOffsets;
+		FractalParams params;
+		float tileSize = 0.0f;
+		int tileResolution = 0;
+		unsigned generation = 0;
+	};
+
+	static TileKey makeKey(int x, int z);
+	static glm::ivec2 keyCoords(TileKey key);
+	static TileData generateTile(const NoiseSnapshot &noise, TileKey key);
+	size_t tileBytes() const;
+	void uploadTile(TileData &data);
+	void evictOverBudget();
+	void ensureIndexBuffer();
+	void workerLoop();
+
+	// Main thread state.
+	std::unordered_map<TileKey, Tile> m_tiles;
+	std::list<TileKey> m_lru; // Most recently used at the front.
+	std::unordered_set<TileKey> m_requested; // Queued or being generated.
+	unsigned long long m_frame = 0;
+	glm::ivec2 m_centre{ 0 };
+	GLuint m_indexBuffer = 0; // All tiles share one grid index buffer.
+	int m_indexCount = 0;
+	int m_indexResolution = 0;
+
+	// Shared with the workers (guarded by m_mutex).
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::deque<TileKey> m_queue;
+	std::vector<TileData> m_finished;
+	NoiseSnapshot m_noise;
+	glm::ivec2 m_focus{ 0 }; // Workers build the queued tile closest to this first.
+	bool m_stop = false;
+	std::vector<std::thread> m_workers;
+};
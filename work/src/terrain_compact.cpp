@@ -0,0 +1,117 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "terrain_compact.hpp"
+#include "grid_mesh.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+// The normals always point up (y = sqrt(1 - x^2 - z^2) > 0), so only x and z are stored, as signed bytes.
+static GLbyte packComponent(float value) {
+	return GLbyte(round(glm::clamp(value, -1.0f, 1.0f) * 127.0f));
+}
+
+
+void TerrainCompact::build(const vector<vec3> &normals, int resolution, float meshScale) {
+	m_resolution = resolution;
+	m_meshScale = meshScale;
+	if (!packedNormals) {
+		if (m_normalMap != 0) glDeleteTextures(1, &m_normalMap);
+		m_normalMap = 0;
+		return;
+	}
+
+	vector<GLbyte> packed(normals.size() * 2);
+	for (size_t i = 0; i < normals.size(); i++) {
+		packed[i * 2] = packComponent(normals[i].x);
+		packed[i * 2 + 1] = packComponent(normals[i].z);
+	}
+
+	if (m_normalMap == 0) glGenTextures(1, &m_normalMap);
+	glBindTexture(GL_TEXTURE_2D, m_normalMap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8_SNORM, resolution, resolution, 0, GL_RG, GL_BYTE, packed.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+void TerrainCompact::update(const vector<vec3> &normals, const GridRect &rect) {
+	if (m_normalMap == 0 || rect.empty()) return;
+	vector<GLbyte> packed(size_t(rect.rows()) * rect.cols() * 2);
+	GLbyte *texel = packed.data();
+	for (int i = rect.i0; i <= rect.i1; i++) {
+		for (int j = rect.j0; j <= rect.j1; j++) {
+			const vec3 &normal = normals[i * m_resolution + j];
+			*texel++ = packComponent(normal.x);
+			*texel++ = packComponent(normal.z);
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, m_normalMap);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, rect.j0, rect.i0, rect.cols(), rect.rows(), GL_RG, GL_BYTE, packed.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+
+void TerrainCompact::draw(GLuint shader, GLuint heightMap) {
+	if (m_resolution < 2) return;
+	ensurePatch();
+	glUseProgram(shader);
+
+	glActiveTexture(GL_TEXTURE28);
+	glBindTexture(GL_TEXTURE_2D, heightMap);
+	glUniform1i(glGetUniformLocation(shader, "uCompactHeightMap"), 28);
+	glActiveTexture(GL_TEXTURE29);
+	glBindTexture(GL_TEXTURE_2D, m_normalMap);
+	glUniform1i(glGetUniformLocation(shader, "uCompactNormalMap"), 29);
+	glUniform1i(glGetUniformLocation(shader, "uCompactNormals"), m_normalMap != 0);
+	glUniform1i(glGetUniformLocation(shader, "uCompactEnabled"), 1);
+
+	// Enough patches to cover every quad. Patches on the far edges hang over the grid, the shader clamps those
+	// vertices onto the last row so the extra triangles have no area.
+	int patches = (m_resolution - 1 + m_patchQuads - 1) / m_patchQuads;
+	glUniform4f(glGetUniformLocation(shader, "uCompactGrid"), m_meshScale, float(m_resolution), float(m_patchQuads), float(patches));
+
+	glBindVertexArray(m_vao);
+	glDrawElementsInstanced(GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, nullptr, patches * patches);
+	glBindVertexArray(0);
+
+	// The shader may be shared with other geometry (the shadow pass), so switch the compact path back off.
+	glUniform1i(glGetUniformLocation(shader, "uCompactEnabled"), 0);
+}
+
+
+void TerrainCompact::destroy() {
+	if (m_normalMap != 0) glDeleteTextures(1, &m_normalMap);
+	if (m_indexBuffer != 0) glDeleteBuffers(1, &m_indexBuffer);
+	if (m_vao != 0) glDeleteVertexArrays(1, &m_vao);
+	m_normalMap = m_indexBuffer = m_vao = 0;
+	m_patchQuads = 0;
+}
+
+
+// The patch is only an index buffer over (patchQuads + 1)^2 vertex ids, with the same winding as the full grid.
+// There are no vertex attributes, so the vertex array just holds the index buffer.
+void TerrainCompact::ensurePatch() {
+	if (m_vao != 0 && m_patchQuads == patchQuads) return;
+	m_patchQuads = std::max(1, patchQuads);
+	if (m_vao == 0) glGenVertexArrays(1, &m_vao);
+	if (m_indexBuffer == 0) glGenBuffers(1, &m_indexBuffer);
+
+	vector<GLuint> indices = gridIndices(m_patchQuads + 1, m_patchQuads + 1, GridTopology::Triangles);
+	glBindVertexArray(m_vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	m_indexCount = int(indices.size());
+}
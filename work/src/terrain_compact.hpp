@@ -0,0 +1,49 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "opengl.hpp"
+#include "terrain_sculpt.hpp"
+
+
+// Draws the terrain grid without a vertex buffer. One small patch of indices is drawn instanced over the grid, and
+// the vertex shader rebuilds each vertex from gl_VertexID (position in the patch) and gl_InstanceID (which patch),
+// fetching the height from the heightmap and the normal from a packed normal texture. The GPU holds 2 or 4 bytes of
+// height plus 0 or 2 bytes of normal per vertex instead of a 32 byte cgra::mesh_vertex.
+class TerrainCompact {
+public:
+	int patchQuads = 64; // Quads along one edge of the instanced patch.
+	bool halfHeights = true; // 16 bit float heightmap instead of 32 bit.
+	bool packedNormals = true; // Two byte normal texture, otherwise the shader differences neighbouring heights.
+
+	// Uploads the normal texture for a resolution x resolution grid spanning -meshScale to meshScale
+	// (vertex (i, j) is i * resolution + j, with i along x). The heights come from the heightmap passed to draw.
+	void build(const std::vector<glm::vec3> &normals, int resolution, float meshScale);
+	// Uploads the normals in rect again after they were edited in place (same grid as build).
+	void update(const std::vector<glm::vec3> &normals, const GridRect &rect);
+	// Draws the whole grid with the given shader, which needs the uCompact uniforms (see terrain_vert.glsl).
+	void draw(GLuint shader, GLuint heightMap);
+	// Frees the GL objects (needs a live context, so it isn't done on destruction).
+	void destroy();
+
+	// Heightmap texture format for the current settings.
+	GLenum heightFormat() const { return halfHeights ? GL_R16F : GL_R32F; }
+	// GPU bytes per grid vertex (height and normal textures).
+	int bytesPerVertex() const { return (halfHeights ? 2 : 4) + (packedNormals ? 2 : 0); }
+
+private:
+	GLuint m_normalMap = 0;
+	GLuint m_vao = 0;
+	GLuint m_indexBuffer = 0;
+	int m_indexCount = 0;
+	int m_patchQuads = 0;
+	int m_resolution = 0;
+	float m_meshScale = 0.0f;
+
+	void ensurePatch();
+};
@@ -0,0 +1,264 @@
+// std
+#include <chrono>
+#include <random>
+
+// project
+#include "terrain_generator.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+// Get the min and max height (as x, y) of the terrain for texturing.
+static vec2 calculateHeightRange(const vector<float> &heights) {
+	// Min and max height initially are the height of the first vertex.
+	vec2 range(heights[0]);
+	for (size_t i = 1; i < heights.size(); i++) {
+		float vertHeight = heights[i];
+		// Adjust the min/max if any vertex is lower/higher.
+		if (range.x > vertHeight) {
+			range.x = vertHeight;
+		}
+		if (range.y < vertHeight) {
+			range.y = vertHeight;
+		}
+	}
+	return range;
+}
+
+
+// Milliseconds since start.
+static double elapsed(chrono::steady_clock::time_point start) {
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+
+// Only reads the settings in the build, never anything shared with the caller.
+void TerrainGenerator::build(TerrainBuild &build) {
+	const HeightfieldKey &key = build.key;
+	int resolution = key.resolution;
+	TerrainTimings &timings = build.timings;
+	timings = TerrainTimings();
+
+	// The offsets are cheap and the world tiles need them even when the heights come from the cache.
+	build.octaveOffsets = createOctaveOffsets(key);
+
+	// Heights and normals of every vertex, from the cache if these settings were generated before.
+	auto start = chrono::steady_clock::now();
+	build.loadedFromCache = build.useCache && heightCache.load(key, build.heights, build.normals);
+	timings.cache = elapsed(start);
+	if (!build.loadedFromCache) {
+		start = chrono::steady_clock::now();
+		updateOctaveLayers(key, build.octaveOffsets);
+		timings.noise = elapsed(start);
+
+		start = chrono::steady_clock::now();
+		weightOctaveLayers(key, build.heights, build.normals);
+		timings.normals = elapsed(start);
+
+		// Erosion moves the heights away from the noise, so its normals come from the heights instead.
+		if (build.erosion.enabled) {
+			start = chrono::steady_clock::now();
+			float cellSize = 2.0f * key.meshScale / (resolution - 1.0f);
+			auto progress = build.progress;
+			if (progress) progress->store(0.0f);
+			erodeHeights(build.heights, resolution, cellSize, build.erosion, uint32_t(key.seed), [progress](float done) {
+				if (progress) progress->store(done);
+			});
+			heightNormals(build.heights, resolution, cellSize, build.normals);
+			timings.erosion = elapsed(start);
+		}
+
+		if (build.useCache && build.storeInCache) {
+			start = chrono::steady_clock::now();
+			heightCache.store(key, build.heights, build.normals);
+			timings.cache += elapsed(start);
+		}
+	}
+
+	// Height range and tree eligibility, so applying the build is just the swap and the uploads.
+	start = chrono::steady_clock::now();
+	build.heightRange = calculateHeightRange(build.heights);
+	timings.heightRange = elapsed(start);
+
+	start = chrono::steady_clock::now();
+	build.heightfield.build(build.heights, build.normals, resolution, key.meshScale);
+	setEligibleRange(build.heightfield, build.heightRange, build.waterLevel);
+	timings.heightfield = elapsed(start);
+
+	// The full vertices (positions, normals and UVs) are only needed for the vertex buffer, or if a copy is kept.
+	start = chrono::steady_clock::now();
+	if (build.withVertices) {
+		build.vertices = vector<mesh_vertex>(resolution * resolution);
+		for (int i = 0; i < resolution; ++i) {
+			// Get u and v offset on mesh and map to range -noiseSize to noiseSize for x and z.
+			float u = i / (resolution - 1.0f);
+			float x = (-1.0f + 2.0f * u) * key.meshScale;
+			for (int j = 0; j < resolution; ++j) {
+				float v = j / (resolution - 1.0f);
+				// Each increase in i is a whole loop of j over resolution.
+				int vertIndex = i * resolution + j;
+				float z = (-1.0f + 2.0f * v) * key.meshScale;
+				build.vertices[vertIndex] = mesh_vertex{ vec3(x, build.heights[vertIndex], z), build.normals[vertIndex], vec2(u, v) };
+			}
+		}
+	}
+	timings.vertices = elapsed(start);
+
+	// Fewer, larger triangles where the terrain is flat, or under the water.
+	if (build.simplify.enabled) {
+		start = chrono::steady_clock::now();
+		float waterHeight = mix(build.heightRange.x, build.heightRange.y, build.waterLevel);
+		build.simplified = simplifyTerrain(build.heights, build.normals, resolution, key.meshScale, waterHeight, build.simplify);
+		timings.simplify = elapsed(start);
+	}
+
+	// Shading detail from the noise at a finer grid than the mesh.
+	if (build.normalMap.enabled) {
+		start = chrono::steady_clock::now();
+		bakeNormalMap(fractalParams(key, build.octaveOffsets), resolution, key.meshScale, build.normalMap.texelsPerCell,
+					  build.bakedNormals);
+		timings.normalMap = elapsed(start);
+	}
+}
+
+
+// Trees can only spawn above water and not on the tips of mountains.
+void TerrainGenerator::setEligibleRange(Heightfield &field, vec2 range, float waterLevel) {
+	field.setEligibleRange(mix(range.x, range.y, waterLevel), mix(range.x, range.y, 0.95f));
+}
+
+
+// Evaluates the noise for every vertex through the per-octave layers.
+void TerrainGenerator::generateHeights(const HeightfieldKey &key, const vector<vec2> &offsets, vector<float> &heights,
+									   vector<vec3> &normals) {
+	updateOctaveLayers(key, offsets);
+	weightOctaveLayers(key, heights, normals);
+}
+
+
+// Returns true if the layers had to be sampled again.
+bool TerrainGenerator::updateOctaveLayers(const HeightfieldKey &key, const vector<vec2> &offsets) {
+	// The octave layers only depend on these settings. Height and persistence just reweight them.
+	LayerSettings settings{ key.seed, key.octaves, key.resolution, key.basis, key.fractal, key.scale, key.lacunarity,
+							key.meshScale };
+	if (!octaveLayers.empty() && settings == layerSettings) return false;
+
+	// Every row shares the same z coordinates, so they are mapped once and each row is evaluated as a batch.
+	vector<float> rowZ(key.resolution);
+	for (int j = 0; j < key.resolution; ++j) {
+		float v = j / (key.resolution - 1.0f);
+		rowZ[j] = (-1.0f + 2.0f * v) * key.meshScale;
+	}
+	createOctaveLayers(key, offsets, rowZ);
+	layerSettings = settings;
+	return true;
+}
+
+
+// Heights and analytic normals as the weighted sum of the current octave layers.
+void TerrainGenerator::weightOctaveLayers(const HeightfieldKey &key, vector<float> &heights, vector<vec3> &normals) {
+	int resolution = key.resolution;
+	int octaves = key.octaves;
+
+	// Weighted sum of the octaves. Each octave has lower amplitude by the persistence, normalised then scaled by height.
+	vector<float> weights(octaves);
+	float amplitude = 1.0f;
+	float maxHeight = 0.0f;
+	for (int oct = 0; oct < octaves; oct++) {
+		weights[oct] = amplitude;
+		maxHeight += amplitude;
+		amplitude *= key.persistence;
+	}
+	for (float &weight : weights) {
+		weight *= key.height / maxHeight;
+	}
+
+	// Heights and normals of every vertex. The layers carry the analytic noise gradient, so the normals come from the
+	// same weighted sum as the heights with no neighbouring samples needed.
+	int vertexCount = resolution * resolution;
+	heights.resize(vertexCount);
+	normals.resize(vertexCount);
+	parallelFor(0, vertexCount, [&](int begin, int end) {
+		for (int vertIndex = begin; vertIndex < end; ++vertIndex) {
+			float height = 0.0f;
+			vec2 gradient(0.0f);
+			for (int oct = 0; oct < octaves; oct++) {
+				const OctaveLayer &layer = octaveLayers[oct];
+				height += layer.height[vertIndex] * weights[oct];
+				gradient += vec2(layer.dx[vertIndex], layer.dz[vertIndex]) * weights[oct];
+			}
+			heights[vertIndex] = height;
+			normals[vertIndex] = normalize(vec3(-gradient.x, 1.0f, -gradient.y));
+		}
+	});
+}
+
+
+vector<vec2> TerrainGenerator::createOctaveOffsets(const HeightfieldKey &key) {
+	// Randomiser based on the user-controlled seed.
+	mt19937 randomiser(key.seed);
+	uniform_int_distribution<int> distribution(0, 10000); // Min to max.
+	// Generates 2 random floats to make a vec2 to offset each octave, eliminating repeated patterns.
+	vector<vec2> offsets(key.octaves);
+	for (int oct = 0; oct < key.octaves; oct++) {
+		offsets[oct] = vec2(distribution(randomiser), distribution(randomiser));
+	}
+	return offsets;
+}
+
+
+// Samples every noise octave separately (with its gradient) over the mesh grid, so later changes to the height or
+// persistence only need the weighted sum in weightOctaveLayers.
+void TerrainGenerator::createOctaveLayers(const HeightfieldKey &key, const vector<vec2> &offsets, const vector<float> &rowZ) {
+	int resolution = int(rowZ.size());
+	octaveLayers.resize(key.octaves);
+	for (OctaveLayer &layer : octaveLayers) {
+		layer.height.resize(resolution * resolution);
+		layer.dx.resize(resolution * resolution);
+		layer.dz.resize(resolution * resolution);
+	}
+	parallelFor(0, resolution, [&](int rowBegin, int rowEnd) {
+		vector<float> rowX(resolution);
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			float u = i / (resolution - 1.0f);
+			float x = (-1.0f + 2.0f * u) * key.meshScale;
+			fill(rowX.begin(), rowX.end(), x);
+
+			// One octave is a single octave fractal at that octave's frequency, evaluated for the whole row (with SIMD
+			// for Perlin and simplex fBm). Ridged and billow shape each octave on its own, so their layers sum the
+			// same way.
+			float frequency = 1.0f;
+			for (int oct = 0; oct < key.octaves; oct++) {
+				FractalParams params;
+				params.basis = NoiseBasis(key.basis);
+				params.fractal = FractalType(key.fractal);
+				params.octaveOffsets = &offsets[oct];
+				params.octaves = 1;
+				params.scale = key.scale * frequency;
+				params.height = 1.0f;
+				OctaveLayer &layer = octaveLayers[oct];
+				int row = i * resolution;
+				fractalNoiseDerivBatch(params, rowX.data(), rowZ.data(), resolution, &layer.height[row], &layer.dx[row], &layer.dz[row]);
+				frequency *= key.lacunarity;
+			}
+		}
+	});
+}
+
+
+// Parameters for the shared noise kernels, taken from a set of terrain settings.
+FractalParams TerrainGenerator::fractalParams(const HeightfieldKey &key, const vector<vec2> &octaveOffsets) {
+	FractalParams params;
+	params.basis = NoiseBasis(key.basis);
+	params.fractal = FractalType(key.fractal);
+	params.octaveOffsets = octaveOffsets.data();
+	params.octaves = key.octaves;
+	params.scale = key.scale;
+	params.persistence = key.persistence;
+	params.lacunarity = key.lacunarity;
+	params.height = key.height;
+	return params;
+}
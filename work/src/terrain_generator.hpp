@@ -0,0 +1,101 @@
+#pragma once
+
+// std
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_vertex.hpp"
+#include "noise_batch.hpp"
+#include "erosion.hpp"
+#include "heightfield.hpp"
+#include "heightfield_cache.hpp"
+#include "terrain_normal_map.hpp"
+#include "terrain_simplify.hpp"
+
+
+// Milliseconds spent in each stage of a build, for profiling (see bench/terrain_bench.cpp).
+struct TerrainTimings {
+	double noise = 0.0; // Sampling the octave layers, 0 when the layer cache could be reused.
+	double normals = 0.0; // Weighting the layers into heights and analytic normals.
+	double erosion = 0.0; // Erosion and the normals recomputed after it.
+	double cache = 0.0; // Loading from and storing to the height cache.
+	double heightRange = 0.0;
+	double heightfield = 0.0; // Heightfield copy and tree eligibility.
+	double vertices = 0.0;
+	double simplify = 0.0; // Simplified mesh, 0 when it's off.
+	double normalMap = 0.0; // Baked normal map, 0 when it's off.
+};
+
+
+// Settings and results of one terrain rebuild. The settings are copied in up front, so the build can run while the
+// originals keep changing (see PerlinNoise::beginBuild).
+struct TerrainBuild {
+	HeightfieldKey key;
+	bool withVertices = true; // Fill vertices (positions, normals and UVs), not just the heights and normals.
+	bool useCache = true;
+	bool storeInCache = true;
+	float waterLevel = 0.0f; // Trees grow above this proportion of the height range.
+	ErosionSettings erosion; // key.erosion must be erosion.hash().
+	std::shared_ptr<std::atomic<float>> progress; // Set to the fraction of the erosion done, if not null.
+	std::vector<glm::vec2> octaveOffsets;
+	std::vector<float> heights;
+	std::vector<glm::vec3> normals;
+	std::vector<cgra::mesh_vertex> vertices;
+	SimplifySettings simplify; // Fills simplified when enabled.
+	cgra::mesh_data simplified;
+	NormalMapSettings normalMap; // Fills bakedNormals when enabled. Baked from the noise, so not for eroded heights.
+	BakedNormalMap bakedNormals;
+	Heightfield heightfield;
+	glm::vec2 heightRange{ 0.0f };
+	bool loadedFromCache = false;
+	TerrainTimings timings;
+};
+
+
+// The CPU side of the terrain: noise heights and normals over the mesh grid, the tree eligibility and the vertices,
+// with the per-octave layer cache and the height cache on disk. Nothing here touches GL, so it also runs on a worker
+// thread or headless (benchmarks, batch tools). Only one build may run at a time on a generator.
+class TerrainGenerator {
+public:
+	HeightfieldCache heightCache;
+
+	// Fills in everything after the settings.
+	void build(TerrainBuild &build);
+	// Heights and normals of every vertex, through the per-octave layers.
+	void generateHeights(const HeightfieldKey &key, const std::vector<glm::vec2> &offsets, std::vector<float> &heights,
+						 std::vector<glm::vec3> &normals);
+
+	// Seeded offsets of each octave, eliminating repeated patterns.
+	static std::vector<glm::vec2> createOctaveOffsets(const HeightfieldKey &key);
+	// Parameters for the shared noise kernels.
+	static FractalParams fractalParams(const HeightfieldKey &key, const std::vector<glm::vec2> &octaveOffsets);
+	// Trees can only spawn above water and not on the tips of mountains.
+	static void setEligibleRange(Heightfield &field, glm::vec2 range, float waterLevel);
+
+private:
+	// Settings the cached octave layers were sampled with.
+	struct LayerSettings {
+		int seed, octaves, resolution, basis, fractal;
+		float scale, lacunarity, meshScale;
+		bool operator==(const LayerSettings &other) const {
+			return seed == other.seed && octaves == other.octaves && resolution == other.resolution &&
+				basis == other.basis && fractal == other.fractal && scale == other.scale &&
+				lacunarity == other.lacunarity && meshScale == other.meshScale;
+		}
+	};
+	LayerSettings layerSettings{};
+	// Unweighted noise of one octave over the mesh grid, with its analytic gradient for the normals.
+	struct OctaveLayer {
+		std::vector<float> height, dx, dz;
+	};
+	std::vector<OctaveLayer> octaveLayers;
+
+	bool updateOctaveLayers(const HeightfieldKey &key, const std::vector<glm::vec2> &offsets);
+	void weightOctaveLayers(const HeightfieldKey &key, std::vector<float> &heights, std::vector<glm::vec3> &normals);
+	void createOctaveLayers(const HeightfieldKey &key, const std::vector<glm::vec2> &offsets, const std::vector<float> &rowZ);
+};
@@ -0,0 +1,241 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/gtc/type_ptr.hpp>
+
+// project
+#include "terrain_lod.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+void TerrainLod::build(const vector<float> &heights, int resolution, float meshScale) {
+	m_resolution = resolution;
+	m_meshScale = meshScale;
+
+	// Enough levels for the leaves to be about as detailed as the heightmap.
+	int halfPatch = std::max(1, patchQuads / 2);
+	patchQuads = halfPatch * 2;
+	float leafCount = (resolution - 1.0f) / patchQuads;
+	m_levels = std::min(12, std::max(0, int(round(log2(std::max(1.0f, leafCount))))) + 1);
+
+	int leaves = 1 << (m_levels - 1);
+	m_heightBounds.assign(m_levels, vector<vec2>());
+	for (int level = 0; level < m_levels; level++) {
+		int count = leaves >> level;
+		m_heightBounds[level].assign(count * count, vec2(0.0f));
+	}
+	updateBounds(heights, 0, 0, leaves - 1, leaves - 1);
+	m_selection.clear();
+}
+
+
+void TerrainLod::update(const vector<float> &heights, const GridRect &changed) {
+	if (m_levels == 0 || changed.empty()) return;
+	// Leaves overlap their neighbours by a vertex, so one more leaf on each side is enough to cover the change.
+	int leaves = 1 << (m_levels - 1);
+	float verticesPerLeaf = (m_resolution - 1.0f) / leaves;
+	auto leafOf = [&](int vertex, int side) {
+		return glm::clamp(int(floor(vertex / verticesPerLeaf)) + side, 0, leaves - 1);
+	};
+	updateBounds(heights, leafOf(changed.i0, -1), leafOf(changed.j0, -1), leafOf(changed.i1, 1), leafOf(changed.j1, 1));
+}
+
+
+// Bounds of the leaves [x0, x1] x [z0, z1], then of every node above them.
+void TerrainLod::updateBounds(const vector<float> &heights, int x0, int z0, int x1, int z1) {
+	int resolution = m_resolution;
+	int leaves = 1 << (m_levels - 1);
+
+	// Leaf bounds come from the heights they cover (one extra vertex on each side, for the bilinear sampling).
+	float verticesPerLeaf = (resolution - 1.0f) / leaves;
+	for (int x = x0; x <= x1; x++) {
+		int i0 = std::max(0, int(floor(x * verticesPerLeaf)) - 1);
+		int i1 = std::min(resolution - 1, int(ceil((x + 1) * verticesPerLeaf)) + 1);
+		for (int z = z0; z <= z1; z++) {
+			int j0 = std::max(0, int(floor(z * verticesPerLeaf)) - 1);
+			int j1 = std::min(resolution - 1, int(ceil((z + 1) * verticesPerLeaf)) + 1);
+			vec2 bounds(heights[i0 * resolution + j0]);
+			for (int i = i0; i <= i1; i++) {
+				for (int j = j0; j <= j1; j++) {
+					float height = heights[i * resolution + j];
+					bounds = vec2(std::min(bounds.x, height), std::max(bounds.y, height));
+				}
+			}
+			m_heightBounds[0][x * leaves + z] = bounds;
+		}
+	}
+
+	// Each parent covers its four children.
+	for (int level = 1; level < m_levels; level++) {
+		x0 /= 2, z0 /= 2, x1 /= 2, z1 /= 2;
+		int count = leaves >> level;
+		const vector<vec2> &children = m_heightBounds[level - 1];
+		for (int x = x0; x <= x1; x++) {
+			for (int z = z0; z <= z1; z++) {
+				vec2 bounds = children[(2 * x) * (2 * count) + 2 * z];
+				for (int q = 1; q < 4; q++) {
+					vec2 child = children[(2 * x + (q & 1)) * (2 * count) + 2 * z + (q >> 1)];
+					bounds = vec2(std::min(bounds.x, child.x), std::max(bounds.y, child.y));
+				}
+				m_heightBounds[level][x * count + z] = bounds;
+			}
+		}
+	}
+}
+
+
+void TerrainLod::select(const mat4 &viewProj, vec3 eye, float lodBias) {
+	m_selection.clear();
+	if (m_levels == 0) return;
+
+	// Frustum planes straight from the matrix rows (Gribb-Hartmann), as (normal, distance).
+	mat4 m = transpose(viewProj);
+	m_frustum[0] = m[3] + m[0];
+	m_frustum[1] = m[3] - m[0];
+	m_frustum[2] = m[3] + m[1];
+	m_frustum[3] = m[3] - m[1];
+	m_frustum[4] = m[3] + m[2];
+	m_frustum[5] = m[3] - m[2];
+	m_eye = eye;
+
+	// Finest range is a few leaves wide, then doubles with each level. The bias shrinks every range.
+	m_ranges.resize(m_levels);
+	float range = detailDistance * nodeSize(0) * pow(0.5f, std::max(0.0f, lodBias));
+	for (int level = 0; level < m_levels; level++) {
+		m_ranges[level] = range;
+		range *= 2.0f;
+	}
+
+	// The root is always drawn, even if the camera is further away than its range.
+	if (!selectNode(m_levels - 1, 0, 0)) {
+		m_selection.push_back(SelectedNode{ vec2(-m_meshScale), nodeSize(m_levels - 1), m_levels - 1, -1 });
+	}
+}
+
+
+void TerrainLod::draw(GLuint shader, GLuint heightMap) {
+	ensurePatch();
+	glUseProgram(shader);
+
+	glActiveTexture(GL_TEXTURE30);
+	glBindTexture(GL_TEXTURE_2D, heightMap);
+	glUniform1i(glGetUniformLocation(shader, "uLodHeightMap"), 30);
+	glUniform1i(glGetUniformLocation(shader, "uLodEnabled"), 1);
+	glUniform3fv(glGetUniformLocation(shader, "uLodEye"), 1, value_ptr(m_eye));
+	glUniform2f(glGetUniformLocation(shader, "uLodTerrain"), m_meshScale, float(m_resolution));
+	GLint nodeLocation = glGetUniformLocation(shader, "uLodNode");
+	GLint morphLocation = glGetUniformLocation(shader, "uLodMorph");
+
+	int quarterIndices = m_patch.index_count / 4;
+	glBindVertexArray(m_patch.vao);
+	for (const SelectedNode &node : m_selection) {
+		// Morph over the last part of this level's range, so vertices reach the coarser grid right at its end.
+		float end = m_ranges[node.level];
+		float previous = node.level > 0 ? m_ranges[node.level - 1] : 0.0f;
+		float start = mix(previous, end, morphStart);
+		glUniform4f(nodeLocation, node.origin.x, node.origin.y, node.size, float(m_patchQuads));
+		glUniform2f(morphLocation, start, end);
+
+		int first = node.quarter < 0 ? 0 : node.quarter * quarterIndices;
+		int count = node.quarter < 0 ? m_patch.index_count : quarterIndices;
+		glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, (void *)(first * sizeof(GLuint)));
+	}
+	glBindVertexArray(0);
+
+	// The shader may be shared with other geometry (the shadow pass), so switch the LOD path back off.
+	glUniform1i(glGetUniformLocation(shader, "uLodEnabled"), 0);
+}
+
+
+int TerrainLod::triangleCount() const {
+	int total = 0;
+	for (const SelectedNode &node : m_selection) {
+		total += patchQuads * patchQuads * 2 / (node.quarter < 0 ? 1 : 4);
+	}
+	return total;
+}
+
+
+float TerrainLod::nodeSize(int level) const {
+	return 2.0f * m_meshScale / float(1 << (m_levels - 1 - level));
+}
+
+
+// Returns false when the node is further than its level's range, so the parent draws that area instead.
+bool TerrainLod::selectNode(int level, int x, int z) {
+	float size = nodeSize(level);
+	vec2 origin = vec2(-m_meshScale) + vec2(x, z) * size;
+	vec2 bounds = m_heightBounds[level][x * (1 << (m_levels - 1 - level)) + z];
+	vec3 boundsMin(origin.x, bounds.x, origin.y);
+	vec3 boundsMax(origin.x + size, bounds.y, origin.y + size);
+
+	// Culled nodes count as handled, so their parent doesn't draw them either.
+	if (!inFrustum(boundsMin, boundsMax)) return true;
+
+	float distance = length(m_eye - clamp(m_eye, boundsMin, boundsMax));
+	if (distance > m_ranges[level]) return false;
+
+	// Leaves, and nodes that no child range reaches, are drawn whole.
+	if (level == 0 || distance > m_ranges[level - 1]) {
+		m_selection.push_back(SelectedNode{ origin, size, level, -1 });
+		return true;
+	}
+
+	for (int q = 0; q < 4; q++) {
+		if (!selectNode(level - 1, 2 * x + (q & 1), 2 * z + (q >> 1))) {
+			m_selection.push_back(SelectedNode{ origin, size, level, q });
+		}
+	}
+	return true;
+}
+
+
+bool TerrainLod::inFrustum(vec3 boundsMin, vec3 boundsMax) const {
+	for (const vec4 &plane : m_frustum) {
+		// Corner furthest along the plane normal. If even that is behind the plane, the box is outside.
+		vec3 corner = mix(boundsMin, boundsMax, step(vec3(0.0f), vec3(plane)));
+		if (dot(vec3(plane), corner) + plane.w < 0.0f) return false;
+	}
+	return true;
+}
+
+
+// Flat (patchQuads + 1)^2 grid over [0, 1] in x and z. The shader places and displaces it per node.
+void TerrainLod::ensurePatch() {
+	if (m_patch.vao != 0 && m_patchQuads == patchQuads) return;
+	m_patch.destroy();
+	m_patchQuads = patchQuads;
+
+	int size = m_patchQuads + 1;
+	vector<mesh_vertex> vertices(size * size);
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			vec2 uv(i / float(m_patchQuads), j / float(m_patchQuads));
+			vertices[i * size + j] = mesh_vertex{ vec3(uv.x, 0.0f, uv.y), vec3(0, 1, 0), uv };
+		}
+	}
+
+	// Same winding as gridIndices, but grouped into the four quarters (x half + 2 * z half).
+	int half = m_patchQuads / 2;
+	vector<GLuint> indices;
+	indices.reserve(m_patchQuads * m_patchQuads * 6);
+	for (int q = 0; q < 4; q++) {
+		int iStart = (q & 1) * half;
+		int jStart = (q >> 1) * half;
+		for (int i = iStart; i < iStart + half; i++) {
+			for (int j = jStart; j < jStart + half; j++) {
+				GLuint topLeft = i * size + j;
+				GLuint topRight = (i + 1) * size + j;
+				GLuint bottomLeft = i * size + j + 1;
+				GLuint bottomRight = (i + 1) * size + j + 1;
+				indices.insert(indices.end(), { topLeft, topRight, bottomLeft, bottomLeft, topRight, bottomRight });
+			}
+		}
+	}
+	m_patch = build_mesh(vertices, indices);
+}
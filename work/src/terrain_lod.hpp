@@ -0,0 +1,69 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "opengl.hpp"
+#include "cgra/cgra_mesh.hpp"
+#include "terrain_sculpt.hpp"
+
+
+// Continuous distance-dependent level of detail for the heightmap terrain (CDLOD).
+// The terrain square is split into a quadtree. Each frame nodes are picked against the view frustum and a set of
+// distance ranges around the camera (each level's range is double the one below it), and every picked node is
+// drawn with the same small grid patch. The vertex shader reads heights from the heightmap texture and morphs
+// vertices onto the next coarser grid towards the end of each range, so neighbouring levels meet without cracks
+// or popping. The triangle count depends on the ranges rather than the terrain size.
+class TerrainLod {
+public:
+	int patchQuads = 32; // Quads along one edge of the patch drawn for each node. Must be even.
+	float detailDistance = 2.0f; // Range of the finest level in leaf node sizes.
+	float morphStart = 0.7f; // Fraction of a level's range at which vertices start morphing to the coarser level.
+
+	// Builds the quadtree height bounds from the terrain heights (vertex (i, j) is i * resolution + j).
+	void build(const std::vector<float> &heights, int resolution, float meshScale);
+	// Updates the bounds of the nodes covering the changed vertices, after the heights were edited in place.
+	void update(const std::vector<float> &heights, const GridRect &changed);
+	// Picks the nodes to draw for a camera. lodBias > 0 switches to coarser levels sooner (each step halves the ranges).
+	void select(const glm::mat4 &viewProj, glm::vec3 eye, float lodBias = 0.0f);
+	// Draws the selected nodes with the given shader, which needs the uLod uniforms (see terrain_vert.glsl).
+	void draw(GLuint shader, GLuint heightMap);
+
+	// Stats for the GUI.
+	int levelCount() const { return m_levels; }
+	int selectedNodes() const { return int(m_selection.size()); }
+	int triangleCount() const;
+
+private:
+	// Node picked for drawing. A quarter of -1 draws the whole node, otherwise only that child area is drawn at
+	// this level's resolution (its other children were refined further).
+	struct SelectedNode {
+		glm::vec2 origin;
+		float size;
+		int level;
+		int quarter;
+	};
+
+	// Height bounds of every node. Level 0 holds the leaves.
+	std::vector<std::vector<glm::vec2>> m_heightBounds;
+	std::vector<float> m_ranges; // Selection range of each level for the current bias.
+	std::vector<SelectedNode> m_selection;
+	glm::vec4 m_frustum[6];
+	glm::vec3 m_eye{ 0.0f };
+	int m_levels = 0;
+	int m_resolution = 0;
+	float m_meshScale = 0.0f;
+
+	cgra::gl_mesh m_patch; // Indices are grouped by quarter so a single quarter can be drawn on its own.
+	int m_patchQuads = 0;
+
+	void updateBounds(const std::vector<float> &heights, int x0, int z0, int x1, int z1);
+	float nodeSize(int level) const;
+	bool selectNode(int level, int x, int z);
+	bool inFrustum(glm::vec3 boundsMin, glm::vec3 boundsMax) const;
+	void ensurePatch();
+};
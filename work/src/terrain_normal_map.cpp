@@ -0,0 +1,49 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "terrain_normal_map.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+int normalMapSize(int resolution, int texelsPerCell) {
+	return (resolution - 1) * std::max(1, texelsPerCell) + 1;
+}
+
+
+static uint8_t packComponent(float value) {
+	return uint8_t(round((glm::clamp(value, -1.0f, 1.0f) * 0.5f + 0.5f) * 255.0f));
+}
+
+
+void bakeNormalMap(const FractalParams &params, int resolution, float meshScale, int texelsPerCell, BakedNormalMap &map) {
+	int size = normalMapSize(resolution, texelsPerCell);
+	map.size = size;
+	map.packed.resize(size_t(size) * size * 2);
+
+	// Every row shares the same z coordinates, the same as the mesh rows.
+	vector<float> rowZ(size);
+	for (int j = 0; j < size; ++j) {
+		rowZ[j] = (-1.0f + 2.0f * j / (size - 1.0f)) * meshScale;
+	}
+	parallelFor(0, size, [&](int rowBegin, int rowEnd) {
+		vector<float> rowX(size), heights(size), dx(size), dz(size);
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			fill(rowX.begin(), rowX.end(), (-1.0f + 2.0f * i / (size - 1.0f)) * meshScale);
+			fractalNoiseDerivBatch(params, rowX.data(), rowZ.data(), size, heights.data(), dx.data(), dz.data());
+			uint8_t *row = &map.packed[size_t(i) * size * 2];
+			for (int j = 0; j < size; ++j) {
+				vec3 normal = normalize(vec3(-dx[j], 1.0f, -dz[j]));
+				row[j * 2] = packComponent(normal.x);
+				row[j * 2 + 1] = packComponent(normal.z);
+			}
+		}
+	});
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <vector>
+
+// project
+#include "noise_batch.hpp"
+
+
+// Settings of the baked terrain normal map.
+struct NormalMapSettings {
+	bool enabled = false;
+	int texelsPerCell = 4; // Texels along each edge of a mesh quad.
+};
+
+// Normals of the noise on a grid finer than the mesh, for shading detail the mesh vertices can't carry.
+// Texel (i, j) is i * size + j (i along x, like the heights), and every texelsPerCell-th texel sits on a mesh vertex.
+struct BakedNormalMap {
+	int size = 0;
+	// Normal x and z of each texel mapped from [-1, 1] to [0, 255]. The normals always point up, so the shader
+	// rebuilds y from them.
+	std::vector<uint8_t> packed;
+};
+
+// Texels along each edge of the normal map for a mesh of resolution x resolution vertices.
+int normalMapSize(int resolution, int texelsPerCell);
+
+// Samples the fractal noise (with its analytic gradient) over the grid of the normal map for a mesh spanning
+// -meshScale to meshScale, one row per batch, with the rows split across threads.
+void bakeNormalMap(const FractalParams &params, int resolution, float meshScale, int texelsPerCell, BakedNormalMap &map);
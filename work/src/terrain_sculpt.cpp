@@ -0,0 +1,81 @@
+// std
+#include <algorithm>
+#include <cmath>
+
+// project
+#include "terrain_sculpt.hpp"
+#include "erosion.hpp"
+
+using namespace std;
+using namespace glm;
+
+
+GridRect applyBrush(vector<float> &heights, int resolution, float meshScale, vec2 centre, const BrushSettings &brush,
+					float deltaTime, float flattenHeight) {
+	// Vertices inside the square around the brush circle.
+	float verticesPerUnit = (resolution - 1.0f) / (2.0f * meshScale);
+	vec2 gridCentre = (centre + meshScale) * verticesPerUnit;
+	float gridRadius = brush.radius * verticesPerUnit;
+	GridRect rect;
+	rect.i0 = std::max(0, int(ceil(gridCentre.x - gridRadius)));
+	rect.j0 = std::max(0, int(ceil(gridCentre.y - gridRadius)));
+	rect.i1 = std::min(resolution - 1, int(floor(gridCentre.x + gridRadius)));
+	rect.j1 = std::min(resolution - 1, int(floor(gridCentre.y + gridRadius)));
+	if (rect.empty() || gridRadius <= 0.0f) return GridRect();
+
+	// Smoothing averages the neighbours as they were before this dab, so it doesn't depend on the visiting order.
+	GridRect source = rect.expanded(1, resolution);
+	vector<float> before;
+	if (brush.mode == BrushMode::Smooth) {
+		before.resize(size_t(source.rows()) * source.cols());
+		for (int i = source.i0; i <= source.i1; i++) {
+			copy_n(&heights[i * resolution + source.j0], source.cols(), &before[(i - source.i0) * source.cols()]);
+		}
+	}
+	auto beforeAt = [&](int i, int j) {
+		i = glm::clamp(i, source.i0, source.i1);
+		j = glm::clamp(j, source.j0, source.j1);
+		return before[(i - source.i0) * source.cols() + (j - source.j0)];
+	};
+
+	float rate = std::min(1.0f, brush.strength * deltaTime);
+	for (int i = rect.i0; i <= rect.i1; i++) {
+		for (int j = rect.j0; j <= rect.j1; j++) {
+			float distance2 = (i - gridCentre.x) * (i - gridCentre.x) + (j - gridCentre.y) * (j - gridCentre.y);
+			float fade = 1.0f - distance2 / (gridRadius * gridRadius);
+			if (fade <= 0.0f) continue;
+			float weight = fade * fade;
+			float &height = heights[i * resolution + j];
+			switch (brush.mode) {
+				case BrushMode::Raise:
+					height += brush.strength * deltaTime * weight;
+					break;
+				case BrushMode::Lower:
+					height -= brush.strength * deltaTime * weight;
+					break;
+				case BrushMode::Smooth: {
+					float average = 0.0f;
+					for (int di = -1; di <= 1; di++) {
+						for (int dj = -1; dj <= 1; dj++) {
+							average += beforeAt(i + di, j + dj);
+						}
+					}
+					height = mix(height, average / 9.0f, rate * weight);
+					break;
+				}
+				case BrushMode::Flatten:
+					height = mix(height, flattenHeight, rate * weight);
+					break;
+			}
+		}
+	}
+	return rect;
+}
+
+
+GridRect updateNormals(const vector<float> &heights, int resolution, float meshScale, const GridRect &changed,
+					   vector<vec3> &normals) {
+	GridRect rect = changed.expanded(1, resolution);
+	heightNormals(heights, resolution, 2.0f * meshScale / (resolution - 1.0f), rect, normals);
+	return rect;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "grid_indices.hpp"
+
+
+enum class BrushMode { Raise, Lower, Smooth, Flatten };
+
+// Sculpting brush. The effect fades from the centre to the radius.
+struct BrushSettings {
+	BrushMode mode = BrushMode::Raise;
+	float radius = 2.0f; // World units.
+	// Raise and lower: height change per second at the centre, in world units. Smooth and flatten: how fast the
+	// heights move towards their target, per second.
+	float strength = 4.0f;
+};
+
+// Applies the brush at world position centre for deltaTime seconds to a resolution x resolution grid of heights
+// spanning -meshScale to meshScale. Flatten pulls the heights towards flattenHeight. Returns the vertices it changed.
+GridRect applyBrush(std::vector<float> &heights, int resolution, float meshScale, glm::vec2 centre,
+					const BrushSettings &brush, float deltaTime, float flattenHeight);
+
+// Recomputes the normals that depend on the heights in changed (the rect and one vertex around it) with heightNormals.
+// Returns the vertices whose normals were recomputed.
+GridRect updateNormals(const std::vector<float> &heights, int resolution, float meshScale, const GridRect &changed,
+					   std::vector<glm::vec3> &normals);
@@ -0,0 +1,177 @@
+// std
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// project
+#include "terrain_simplify.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+namespace {
+	// Corners of one triangle of the hierarchy in grid coordinates. c is the right angle and a to b the hypotenuse.
+	struct Triangle {
+		int ax, ay, bx, by, cx, cy;
+	};
+
+	// Where a triangle lies relative to the grid, which may only cover a corner of the hierarchy.
+	enum class Coverage { Inside, Outside, Partial };
+
+	Coverage coverage(const Triangle &t, int last) {
+		if (std::min({ t.ax, t.bx, t.cx }) >= last || std::min({ t.ay, t.by, t.cy }) >= last) return Coverage::Outside;
+		if (std::max({ t.ax, t.bx, t.cx }) > last || std::max({ t.ay, t.by, t.cy }) > last) return Coverage::Partial;
+		return Coverage::Inside;
+	}
+
+	// Height differences as a fraction of the error allowed there.
+	struct Tolerance {
+		float waterHeight, maxError, underwaterError;
+
+		float scaled(float actual, float approximated) const {
+			float allowed = std::max(actual, approximated) < waterHeight ? underwaterError : maxError;
+			return abs(approximated - actual) / allowed;
+		}
+	};
+
+	// Largest scaled difference between the grid and the plane through the corners of a triangle, over every vertex
+	// the triangle covers.
+	float triangleError(const vector<float> &heights, int resolution, const Tolerance &tolerance, ivec2 a, ivec2 b,
+						ivec2 c) {
+		auto cross = [](ivec2 u, ivec2 v) { return u.x * v.y - u.y * v.x; };
+		int area = cross(b - a, c - a);
+		float ha = heights[a.x * resolution + a.y];
+		float hb = heights[b.x * resolution + b.y];
+		float hc = heights[c.x * resolution + c.y];
+		ivec2 low = min(min(a, b), c), high = max(max(a, b), c);
+		float error = 0.0f;
+		for (int i = low.x; i <= high.x; i++) {
+			for (int j = low.y; j <= high.y; j++) {
+				// Barycentric weights times the area, all with the sign of the area inside the triangle.
+				ivec2 p(i, j);
+				int wa = cross(c - b, p - b), wb = cross(a - c, p - c), wc = cross(b - a, p - a);
+				if (area > 0 ? (wa < 0 || wb < 0 || wc < 0) : (wa > 0 || wb > 0 || wc > 0)) continue;
+				float plane = (wa * ha + wb * hb + wc * hc) / area;
+				error = std::max(error, tolerance.scaled(heights[i * resolution + j], plane));
+			}
+		}
+		return error;
+	}
+}
+
+
+cgra::mesh_data simplifyTerrain(const vector<float> &heights, const vector<vec3> &normals, int resolution,
+								float meshScale, float waterHeight, const SimplifySettings &settings) {
+	// Smallest 2^k quads square that covers the grid.
+	int size = 1;
+	while (size < resolution - 1) size *= 2;
+	int gridSize = size + 1;
+	int last = resolution - 1;
+	Tolerance tolerance{ waterHeight, std::max(settings.maxError, 1e-6f), std::max(settings.underwaterError, 1e-6f) };
+
+	// Error of splitting the triangles either side of the hypotenuse a to b at its midpoint, as a fraction of the
+	// allowed error. Each midpoint also takes the errors of the midpoints of the legs (the next finer splits), so a
+	// triangle is split whenever anything inside it needs to be. Triangles partly off the grid are always split, the
+	// parts on the grid end up fully inside it and the rest is dropped.
+	vector<float> errors(size_t(gridSize) * gridSize, 0.0f);
+	auto splitError = [&](ivec2 a, ivec2 b, ivec2 c0, ivec2 c1, bool hasChildren, bool hasInterior) {
+		ivec2 m = (a + b) / 2;
+		float &error = errors[m.x * gridSize + m.y];
+		ivec2 corners[2];
+		int cornerCount = 0;
+		for (ivec2 c : { c0, c1 }) {
+			if (c.x < 0 || c.y < 0 || c.x > size || c.y > size) continue;
+			Coverage cover = coverage(Triangle{ a.x, a.y, b.x, b.y, c.x, c.y }, last);
+			if (cover == Coverage::Partial) {
+				error = numeric_limits<float>::max();
+				return;
+			}
+			if (cover == Coverage::Inside) corners[cornerCount++] = c;
+		}
+		if (cornerCount == 0) return;
+
+		// The midpoint against the hypotenuse first, which is all that's needed if the triangles are split anyway.
+		float interpolated = 0.5f * (heights[a.x * resolution + a.y] + heights[b.x * resolution + b.y]);
+		error = tolerance.scaled(heights[m.x * resolution + m.y], interpolated);
+		for (int k = 0; k < cornerCount && hasChildren; k++) {
+			ivec2 left = (a + corners[k]) / 2, right = (b + corners[k]) / 2;
+			error = std::max({ error, errors[left.x * gridSize + left.y], errors[right.x * gridSize + right.y] });
+		}
+		// Otherwise the triangles may be drawn as they are, so every vertex inside them has to be within the error
+		// too (vertices on the legs already are, through the finer splits).
+		if (error <= 1.0f && hasInterior) {
+			for (int k = 0; k < cornerCount; k++) {
+				error = std::max(error, triangleError(heights, resolution, tolerance, a, b, corners[k]));
+			}
+		}
+	};
+
+	// Finest splits first. The hierarchy alternates between splitting a cell along its diagonal and splitting the
+	// triangles either side of a cell edge. Cell diagonals point at the centre of the cell one level up.
+	for (int s = 2; s <= size; s *= 2) {
+		int h = s / 2;
+		// Edges of the s cells, with the centres of the cells either side as the right angles. Triangles at the finest
+		// level have no vertices inside them.
+		for (int x = 0; x <= size; x += h) {
+			bool vertical = x % s == 0;
+			for (int y = vertical ? h : 0; y <= size; y += s) {
+				if (vertical) {
+					splitError(ivec2(x, y - h), ivec2(x, y + h), ivec2(x - h, y), ivec2(x + h, y), s >= 4, s >= 4);
+				} else {
+					splitError(ivec2(x - h, y), ivec2(x + h, y), ivec2(x, y - h), ivec2(x, y + h), s >= 4, s >= 4);
+				}
+			}
+		}
+		// Diagonals of the s cells, with the other two corners as the right angles.
+		for (int x = h; x < size; x += s) {
+			for (int y = h; y < size; y += s) {
+				if (((x - h) / s + (y - h) / s) % 2 == 0) {
+					splitError(ivec2(x - h, y - h), ivec2(x + h, y + h), ivec2(x + h, y - h), ivec2(x - h, y + h), true, s >= 4);
+				} else {
+					splitError(ivec2(x + h, y - h), ivec2(x - h, y + h), ivec2(x - h, y - h), ivec2(x + h, y + h), true, s >= 4);
+				}
+			}
+		}
+	}
+
+	// Walk down from the two halves of the square, stopping at the first triangles within the error. Vertices are
+	// added the first time a triangle uses them.
+	mesh_data mesh;
+	vector<unsigned int> remap(heights.size(), restart_index);
+	auto addVertex = [&](int i, int j) {
+		int vertIndex = i * resolution + j;
+		if (remap[vertIndex] == restart_index) {
+			remap[vertIndex] = unsigned(mesh.vertices.size());
+			float u = i / (resolution - 1.0f);
+			float v = j / (resolution - 1.0f);
+			vec3 pos((-1.0f + 2.0f * u) * meshScale, heights[vertIndex], (-1.0f + 2.0f * v) * meshScale);
+			mesh.vertices.push_back(mesh_vertex{ pos, normals[vertIndex], vec2(u, v) });
+		}
+		mesh.indices.push_back(remap[vertIndex]);
+	};
+
+	vector<Triangle> stack = { Triangle{ 0, 0, size, size, size, 0 }, Triangle{ size, size, 0, 0, 0, size } };
+	while (!stack.empty()) {
+		Triangle t = stack.back();
+		stack.pop_back();
+		if (coverage(t, last) == Coverage::Outside) continue;
+		int mx = (t.ax + t.bx) >> 1;
+		int my = (t.ay + t.by) >> 1;
+		if (abs(t.ax - t.cx) + abs(t.ay - t.cy) > 1 && errors[mx * gridSize + my] > 1.0f) {
+			stack.push_back(Triangle{ t.cx, t.cy, t.ax, t.ay, mx, my });
+			stack.push_back(Triangle{ t.bx, t.by, t.cx, t.cy, mx, my });
+			continue;
+		}
+		// Same winding as the grid mesh (see gridIndices).
+		if ((t.bx - t.ax) * (t.cy - t.ay) - (t.by - t.ay) * (t.cx - t.ax) < 0) {
+			swap(t.bx, t.cx);
+			swap(t.by, t.cy);
+		}
+		addVertex(t.ax, t.ay);
+		addVertex(t.bx, t.by);
+		addVertex(t.cx, t.cy);
+	}
+	return mesh;
+}
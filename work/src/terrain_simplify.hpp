@@ -0,0 +1,27 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_vertex.hpp"
+
+
+// Settings of the simplified terrain mesh.
+struct SimplifySettings {
+	bool enabled = false;
+	float maxError = 0.02f; // Largest height difference to the full grid, in world units.
+	float underwaterError = 0.25f; // The same under the water plane, where the terrain is only seen through the water.
+};
+
+// Error-bounded triangulation of a resolution x resolution grid of heights (vertex (i, j) is i * resolution + j) as a
+// right-triangulated irregular network (RTIN). Triangles are split along their hypotenuse only while a grid vertex
+// they cover is further than the allowed error from them, so flat areas end up as a few large triangles. Every split is
+// forced on the neighbour across the hypotenuse as well, which keeps the mesh free of cracks and T-junctions.
+// Grids that aren't 2^k + 1 wide are treated as a corner of the next size up. Vertices below waterHeight use the
+// underwater error. The result only holds the vertices the triangles use, laid out like the full terrain mesh.
+cgra::mesh_data simplifyTerrain(const std::vector<float> &heights, const std::vector<glm::vec3> &normals, int resolution,
+								float meshScale, float waterHeight, const SimplifySettings &settings);
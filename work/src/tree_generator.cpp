@@ -3,6 +3,7 @@
 #include "cgra/cgra_image.hpp"
 #include "cgra/cgra_shader.hpp"
 #include "cgra/cgra_wavefront.hpp"
+#include <algorithm>
 #include <random>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -12,6 +13,13 @@ using namespace std;
 using namespace glm;
 using namespace cgra;
 
+TreeGenerator::TreeGenerator() {
+    // One species to start with, its branches more tapered and rounder than the L-system defaults
+    slots.resize(1);
+    slots[0].lSystem.cylinderSides = 12;
+    slots[0].lSystem.branchTaper = 0.65f;
+}
+
 TreeGenerator::~TreeGenerator() {
     // Clean up OpenGL resources
     if (instanceVBO != 0) {
@@ -52,215 +60,210 @@ void TreeGenerator::loadTextures() {
     leafShader = sb_leaf.build();
 }
 
-void TreeGenerator::regenerateTreeMesh() {
-    // Update L-system parameters
-    lSystem.cylinderSides = 12;
-    lSystem.branchTaper = branchTaper;
-
-    // Generate the tree mesh and collect end nodes and directions for leaves
-    string lSystemString = lSystem.generateString();
-    baseLeafPositions.clear();
-    baseLeafDirections.clear();
-    treeMesh = lSystem.generateTreeMesh(lSystemString, baseLeafPositions, baseLeafDirections);
-
-    // Generate leaf mesh
-    generateLeafMesh();
-
-    needsMeshRegeneration = false;
-}
-
-void TreeGenerator::setupInstancing() {
-    // Ensure we have a tree mesh
-    if (needsMeshRegeneration) {
-        regenerateTreeMesh();
-    }
-    
+// Uploads transforms to an instance buffer. The buffer keeps its storage while the count fits, so dragging a slider
+// that moves the instances is a sub-data update.
+static void uploadInstances(const vector<mat4>& transforms, GLuint& vbo, size_t& capacity) {
     // Create instance buffer if it doesn't exist
-    if (instanceVBO == 0) {
-        glGenBuffers(1, &instanceVBO);
+    if (vbo == 0) {
+        glGenBuffers(1, &vbo);
     }
-    
+
     // Upload instance data (transform matrices)
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferData(GL_ARRAY_BUFFER, 
-                 treeTransforms.size() * sizeof(mat4),
-                 treeTransforms.data(), 
-                 GL_DYNAMIC_DRAW);
-    
-    // Bind the tree mesh VAO and add instance attributes to it
-    glBindVertexArray(treeMesh.vao);
-    
-    // Bind instance buffer
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    
-    // Set up instance attributes
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (transforms.size() > capacity) {
+        glBufferData(GL_ARRAY_BUFFER, transforms.size() * sizeof(mat4), transforms.data(), GL_DYNAMIC_DRAW);
+        capacity = transforms.size();
+    } else {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, transforms.size() * sizeof(mat4), transforms.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Makes the instance buffer, from transform first on, the per-instance model matrix (attributes 3 to 6) of vao.
+// GL 3.3 can't offset the instances in the draw call, so the offset goes into the attributes instead.
+static void attachInstances(GLuint vao, GLuint vbo, int first) {
+    // Bind the mesh VAO and add instance attributes to it
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
     size_t vec4Size = sizeof(vec4);
     for (unsigned int i = 0; i < 4; i++) {
         unsigned int attribLocation = 3 + i;
         glEnableVertexAttribArray(attribLocation);
-        glVertexAttribPointer(attribLocation, 4, GL_FLOAT, GL_FALSE, 
-                             sizeof(mat4), 
-                             (void*)(i * vec4Size));
+        glVertexAttribPointer(attribLocation, 4, GL_FLOAT, GL_FALSE,
+                             sizeof(mat4),
+                             (void*)(first * sizeof(mat4) + i * vec4Size));
         glVertexAttribDivisor(attribLocation, 1); // This tells OpenGL this is per-instance data
     }
-    
-    // Unbind
     glBindVertexArray(0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void TreeGenerator::updateInstanceBuffer() {
-    if (instanceVBO == 0 || treeTransforms.empty()) return;
-    
-    // Update only the buffer data without recreating it
-    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, 
-                    treeTransforms.size() * sizeof(mat4),
-                    treeTransforms.data());
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+// Most iterations of lSystem (up to 8) that stay within maxSegments
+static int maxIterations(const LSystem& lSystem, uint64_t maxSegments) {
+    int iterations = 1;
+    while (iterations < 8 &&
+           lSystem.expandedCount('F', iterations + 1) + lSystem.expandedCount('[', iterations + 1) <= maxSegments) {
+        iterations++;
+    }
+    return iterations;
 }
 
-void TreeGenerator::generateLeafMesh() {
-    // Create cross-quad billboard geometry (two perpendicular quads forming an X)
-    mesh_builder mb;
-
-    float size = 1.0f; // Will be scaled by leafSize in transforms
-
-    // First quad (aligned with XY plane)
-    // Vertices 0-3
-    mb.push_vertex({vec3(-size, 0, 0), vec3(0, 1, 0), vec2(0, 0)}); // Bottom left
-    mb.push_vertex({vec3(size, 0, 0), vec3(0, 1, 0), vec2(1, 0)});  // Bottom right
-    mb.push_vertex({vec3(size, size*2, 0), vec3(0, 1, 0), vec2(1, 1)}); // Top right
-    mb.push_vertex({vec3(-size, size*2, 0), vec3(0, 1, 0), vec2(0, 1)}); // Top left
-
-    // Second quad (aligned with ZY plane, perpendicular to first)
-    // Vertices 4-7
-    mb.push_vertex({vec3(0, 0, -size), vec3(1, 0, 0), vec2(0, 0)}); // Bottom left
-    mb.push_vertex({vec3(0, 0, size), vec3(1, 0, 0), vec2(1, 0)});  // Bottom right
-    mb.push_vertex({vec3(0, size*2, size), vec3(1, 0, 0), vec2(1, 1)}); // Top right
-    mb.push_vertex({vec3(0, size*2, -size), vec3(1, 0, 0), vec2(0, 1)}); // Top left
-
-    // First quad faces (both sides for proper visibility)
-    mb.push_indices({0, 1, 2});
-    mb.push_indices({0, 2, 3});
-    mb.push_indices({0, 2, 1}); // Back face
-    mb.push_indices({0, 3, 2}); // Back face
-
-    // Second quad faces (both sides)
-    mb.push_indices({4, 5, 6});
-    mb.push_indices({4, 6, 7});
-    mb.push_indices({4, 6, 5}); // Back face
-    mb.push_indices({4, 7, 6}); // Back face
-
-    leafMesh = mb.build();
+// The L-system a slot builds. Switching to a denser tree type can leave the iterations above its budget, which only
+// clamps what is built, so switching back finds the species it had before in the cache.
+LSystem TreeGenerator::buildable(const LSystem& lSystem) const {
+    LSystem built = lSystem;
+    built.iterations = std::min(built.iterations, ::maxIterations(built, maxSegments));
+    return built;
 }
 
-void TreeGenerator::setupLeafInstancing() {
-    if (leafTransforms.empty()) return;
+shared_ptr<TreeSpecies> TreeGenerator::findSpecies(const SpeciesKey& key) {
+    auto cached = cache.find(key);
+    if (cached == cache.end()) return nullptr;
+    lru.splice(lru.begin(), lru, cached->second.lruPosition);
+    return cached->second.species;
+}
 
-    // Create instance buffer if it doesn't exist
-    if (leafInstanceVBO == 0) {
-        glGenBuffers(1, &leafInstanceVBO);
+void TreeGenerator::insertSpecies(const SpeciesKey& key, shared_ptr<TreeSpecies> species) {
+    auto cached = cache.find(key);
+    if (cached != cache.end()) {
+        lru.erase(cached->second.lruPosition);
+        cache.erase(cached);
     }
+    lru.push_front(key);
+    cache.emplace(key, CachedSpecies{move(species), lru.begin()});
 
-    // Upload instance data
-    glBindBuffer(GL_ARRAY_BUFFER, leafInstanceVBO);
-    glBufferData(GL_ARRAY_BUFFER,
-                 leafTransforms.size() * sizeof(mat4),
-                 leafTransforms.data(),
-                 GL_DYNAMIC_DRAW);
-
-    // Setup instance attributes for leaf mesh
-    glBindVertexArray(leafMesh.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, leafInstanceVBO);
-
-    size_t vec4Size = sizeof(vec4);
-    for (unsigned int i = 0; i < 4; i++) {
-        unsigned int attribLocation = 3 + i;
-        glEnableVertexAttribArray(attribLocation);
-        glVertexAttribPointer(attribLocation, 4, GL_FLOAT, GL_FALSE,
-                             sizeof(mat4),
-                             (void*)(i * vec4Size));
-        glVertexAttribDivisor(attribLocation, 1);
+    // Slots still drawing an evicted species keep it alive through their own pointer
+    while (cache.size() > size_t(speciesCacheSize)) {
+        cache.erase(lru.back());
+        lru.pop_back();
     }
-
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void TreeGenerator::generateTreesOnTerrain(PerlinNoise* perlinNoise) {
-    // Clear only the transforms, not the mesh
-    treeTransforms.clear();
-    leafTransforms.clear();
-
-    // Mark that we need to regenerate the mesh if L-system parameters changed
-    if (needsMeshRegeneration) {
-        regenerateTreeMesh();
+void TreeGenerator::updateSpecies() {
+    // Each slot draws its species straight from the cache when it's there, the rest are built together
+    vector<LSystem> missing;
+    vector<SpeciesKey> missingKeys;
+    for (SpeciesSlot& slot : slots) {
+        LSystem built = buildable(slot.lSystem);
+        SpeciesKey key(built);
+        if (shared_ptr<TreeSpecies> species = findSpecies(key)) {
+            slot.drawn = species;
+        } else if (find(missingKeys.begin(), missingKeys.end(), key) == missingKeys.end()) {
+            missing.push_back(built);
+            missingKeys.push_back(key);
+        }
     }
 
-    // Random placement
-    mt19937 rng(42);
-    float meshSize = perlinNoise->meshScale;
-    uniform_real_distribution<float> positionDist(-meshSize * 0.8f, meshSize * 0.8f);
-    uniform_real_distribution<float> scaleDist(minTreeScale, maxTreeScale);
-    uniform_real_distribution<float> rotationDist(0.0f, 2.0f * pi<float>());
-
-    for (int i = 0; i < treeCount; i++) {
-        vec2 position(positionDist(rng), positionDist(rng));
-        vec3 terrainPoint = perlinNoise->sampleVertex(position);
-
-        float scale = scaleDist(rng);
-        float rotation = randomRotation ? rotationDist(rng) : 0.0f;
+    // The leaf mesh is the same for every tree, so it's only built once
+    if (leafMesh.vao == 0) {
+        leafMesh = build_mesh(leafMeshData());
+        leafInstancesAttached = false;
+    }
 
-        mat4 transform = translate(mat4(1.0f), terrainPoint) *
-                        rotate(mat4(1.0f), rotation, vec3(0, 1, 0)) *
-                        glm::scale(mat4(1.0f), vec3(scale));
+    // An older build finishing doesn't submit the one still running again
+    if (missing.empty() || (missingKeys == requested && builds.busy())) return;
+    requested = missingKeys;
+    builds.submit([this, missing, missingKeys]() -> RegenerationQueue::Apply {
+        auto geometry = make_shared<vector<SpeciesGeometry>>(buildSpecies(missing));
+        return [this, geometry, missingKeys]() {
+            for (size_t i = 0; i < missingKeys.size(); i++) {
+                SpeciesGeometry& built = (*geometry)[i];
+                auto species = make_shared<TreeSpecies>();
+                species->mesh = build_mesh(built.mesh);
+                species->leafPositions = move(built.leafPositions);
+                species->leafDirections = move(built.leafDirections);
+                insertSpecies(missingKeys[i], move(species));
+            }
+        };
+    });
+}
 
-        treeTransforms.push_back(transform);
+bool TreeGenerator::applyFinishedSpecies() {
+    return builds.applyFinished();
+}
 
-        // Create leaf transforms for this tree instance aligned with branch direction
-        for (size_t j = 0; j < baseLeafPositions.size(); j++) {
-            vec3 leafPos = baseLeafPositions[j];
-            vec3 branchDir = baseLeafDirections[j];
+void TreeGenerator::setSpeciesCount(int count) {
+    count = std::max(1, std::min(count, maxSpecies));
+    while (int(slots.size()) < count) {
+        slots.push_back(slots.back());
+        editedSpecies = int(slots.size()) - 1;
+        setTreeType((slots.back().treeType + 1) % 4);
+    }
+    slots.resize(count);
+    editedSpecies = std::min(editedSpecies, count - 1);
+}
 
-            // Transform position and direction to world space
-            vec3 worldLeafPos = vec3(transform * vec4(leafPos, 1.0f));
-            vec3 worldBranchDir = normalize(vec3(transform * vec4(branchDir, 0.0f)));
+TreePlacement TreeGenerator::placement() const {
+    TreePlacement placement;
+    placement.treeCount = treeCount;
+    placement.minScale = minTreeScale;
+    placement.maxScale = maxTreeScale;
+    placement.randomRotation = randomRotation;
+    placement.leafSize = leafSize;
+    placement.leafOffset = leafOffset;
+    return placement;
+}
 
-            worldLeafPos -= worldBranchDir * (scale * leafSize * this->leafOffset);
+void TreeGenerator::placeTrees(const Heightfield& heightfield) {
+    // Scatter the trees over the terrain's eligible ground
+    ::placeTrees(placement(), heightfield, treeTransforms);
+}
 
-            // Create rotation matrix to align leaf with branch direction
-            // The leaf mesh grows along the branch direction (Y-axis in local space)
-            vec3 up = worldBranchDir;
-            vec3 right = normalize(cross(vec3(0, 1, 0), up));
-            if (length(right) < 0.001f) {
-                right = normalize(cross(vec3(1, 0, 0), up));
+// Orders the transforms by the species the trees draw, slots sharing a species sharing its batch. Trees of a slot
+// whose first species isn't built yet are left out until it is.
+void TreeGenerator::groupTrees() {
+    batches.clear();
+    batchedTransforms.clear();
+    for (const SpeciesSlot& slot : slots) {
+        const TreeSpecies* species = slot.drawn.get();
+        if (!species) continue;
+        auto grouped = find_if(batches.begin(), batches.end(), [&](const TreeBatch& batch) {
+            return batch.species == species;
+        });
+        if (grouped != batches.end()) continue;
+
+        TreeBatch batch{species, int(batchedTransforms.size()), 0};
+        for (size_t i = 0; i < treeTransforms.size(); i++) {
+            if (slots[i % slots.size()].drawn.get() == species) {
+                batchedTransforms.push_back(treeTransforms[i]);
+                batch.count++;
             }
-            vec3 forward = normalize(cross(up, right));
-
-            // Construct orientation matrix
-            mat4 orientation = mat4(
-                vec4(right, 0),
-                vec4(up, 0),
-                vec4(forward, 0),
-                vec4(0, 0, 0, 1)
-            );
-
-            // Combine position, orientation, and scale
-            mat4 leafTransform = translate(mat4(1.0f), worldLeafPos) *
-                                orientation *
-                                glm::scale(mat4(1.0f), vec3(scale * leafSize));
-
-            leafTransforms.push_back(leafTransform);
         }
+        batches.push_back(batch);
     }
+}
+
+void TreeGenerator::placeLeaves() {
+    groupTrees();
+    leafTransforms.clear();
+    vector<mat4> batchLeaves;
+    for (const TreeBatch& batch : batches) {
+        vector<mat4> trees(batchedTransforms.begin() + batch.first, batchedTransforms.begin() + batch.first + batch.count);
+        ::placeLeaves(placement(), trees, batch.species->leafPositions, batch.species->leafDirections, batchLeaves);
+        leafTransforms.insert(leafTransforms.end(), batchLeaves.begin(), batchLeaves.end());
+    }
+}
 
-    // Set up instancing with the new transforms
-    setupInstancing();
-    setupLeafInstancing();
+void TreeGenerator::uploadTreeInstances() {
+    // All species share the one instance buffer, each reading its own run of it
+    groupTrees();
+    uploadInstances(batchedTransforms, instanceVBO, instanceCapacity);
+    for (const TreeBatch& batch : batches) {
+        attachInstances(batch.species->mesh.vao, instanceVBO, batch.first);
+    }
+}
+
+void TreeGenerator::uploadLeafInstances() {
+    uploadInstances(leafTransforms, leafInstanceVBO, leafInstanceCapacity);
+    if (!leafInstancesAttached) {
+        attachInstances(leafMesh.vao, leafInstanceVBO, 0);
+        leafInstancesAttached = true;
+    }
 }
 
 void TreeGenerator::setTreeType(int type) {
+    LSystem& lSystem = slots[editedSpecies].lSystem;
+    slots[editedSpecies].treeType = type;
     lSystem.rules.clear();
     
     switch(type) {
@@ -282,8 +285,37 @@ void TreeGenerator::setTreeType(int type) {
             lSystem.rules['F'] = "F[+&F][-&F][^F][/F]";
             break;
     }
-    
-    needsMeshRegeneration = true;
+}
+
+int TreeGenerator::maxIterations() const {
+    return ::maxIterations(slots[editedSpecies].lSystem, maxSegments);
+}
+
+uint64_t TreeGenerator::segmentCount() const {
+    LSystem built = buildable(slots[editedSpecies].lSystem);
+    return built.expandedCount('F', built.iterations) + built.expandedCount('[', built.iterations);
+}
+
+void TreeGenerator::drawTreeInstances() const {
+    for (const TreeBatch& batch : batches) {
+        glBindVertexArray(batch.species->mesh.vao);
+        glDrawElementsInstanced(GL_TRIANGLES,
+                               batch.species->mesh.index_count,
+                               GL_UNSIGNED_INT,
+                               0,
+                               batch.count);
+    }
+    glBindVertexArray(0);
+}
+
+void TreeGenerator::drawLeafInstances() const {
+    glBindVertexArray(leafMesh.vao);
+    glDrawElementsInstanced(GL_TRIANGLES,
+                           leafMesh.index_count,
+                           GL_UNSIGNED_INT,
+                           0,
+                           leafTransforms.size());
+    glBindVertexArray(0);
 }
 
 void TreeGenerator::drawLeaves(const mat4& view, const mat4& proj,
@@ -333,13 +365,7 @@ void TreeGenerator::drawLeaves(const mat4& view, const mat4& proj,
     glDisable(GL_CULL_FACE);
 
     // Draw all leaf instances
-    glBindVertexArray(leafMesh.vao);
-    glDrawElementsInstanced(GL_TRIANGLES,
-                           leafMesh.index_count,
-                           GL_UNSIGNED_INT,
-                           0,
-                           leafTransforms.size());
-    glBindVertexArray(0);
+    drawLeafInstances();
 
     // Restore previous state
     if (!blendEnabled) glDisable(GL_BLEND);
@@ -352,13 +378,7 @@ void TreeGenerator::draw(const mat4& view, const mat4& proj,
                          GLuint shadowMapTexture,
                          bool enableShadows,
                          bool usePCF) {
-    if (treeTransforms.empty()) return;
-
-    // Ensure mesh is generated
-    if (needsMeshRegeneration) {
-        regenerateTreeMesh();
-        setupInstancing();
-    }
+    if (batches.empty()) return;
 
     glUseProgram(shader);
 
@@ -403,14 +423,8 @@ void TreeGenerator::draw(const mat4& view, const mat4& proj,
         }
     }
 
-    // Bind VAO and draw all instances with one call
-    glBindVertexArray(treeMesh.vao);
-    glDrawElementsInstanced(GL_TRIANGLES,
-                           treeMesh.index_count,
-                           GL_UNSIGNED_INT,
-                           0,
-                           treeTransforms.size());
-    glBindVertexArray(0);
+    // Draw all instances with one call per species
+    drawTreeInstances();
 
     // Draw leaves after trees
     drawLeaves(view, proj, lightDir, lightColor, lightSpaceMatrix, shadowMapTexture, enableShadows, usePCF);
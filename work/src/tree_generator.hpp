@@ -2,18 +2,44 @@
 
 #include "l_system.hpp"
 #include "perlin_noise.hpp"
+#include "regeneration.hpp"
+#include "tree_geometry.hpp"
+#include "tree_species.hpp"
 #include <glm/glm.hpp>
+#include <list>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
+// An uploaded species: the mesh of one tree and the branch ends its leaves grow from. Shared by the cache and every
+// species slot drawing it, so evicting it from the cache doesn't delete a mesh that is still drawn.
+struct TreeSpecies {
+    cgra::gl_mesh mesh;
+    std::vector<glm::vec3> leafPositions;
+    std::vector<glm::vec3> leafDirections;
+
+    TreeSpecies() = default;
+    TreeSpecies(const TreeSpecies&) = delete;
+    TreeSpecies& operator=(const TreeSpecies&) = delete;
+    ~TreeSpecies() { mesh.destroy(); }
+};
+
 class TreeGenerator {
 public:
-    // L-System parameters
-    LSystem lSystem;
+    // Placement parameters
     int treeCount = 5;
     float minTreeScale = 0.5f;
     float maxTreeScale = 1.0f;
     bool randomRotation = true;
-    float branchTaper = 0.65f;
+    // The forest mixes up to maxSpecies L-systems, tree i growing as species i % speciesCount(). The GUI edits one
+    // species at a time.
+    static const int maxSpecies = 4;
+    int editedSpecies = 0;
+    // Built species kept for reuse, least recently used dropped first. At least maxSpecies, so a whole forest fits.
+    static const int speciesCacheSize = 8;
+    // Most cylinders (forward steps and branch collars) one tree may have. The string is expanded while the mesh is
+    // built, so the mesh is what grows with the iterations, by the rule's number of steps each time.
+    uint64_t maxSegments = 200000;
 
     // Rendering
     GLuint shader = 0;
@@ -30,21 +56,41 @@ public:
     float leafOffset = 0.3f; // Offset backwards along branch to prevent floating appearance
     bool renderLeaves = true;
 
-    TreeGenerator() = default;
+    TreeGenerator();
     ~TreeGenerator();  // Need clean up OpenGL resources
 
     // Load bark textures
     void loadTextures();
 
 
-    void markMeshDirty() { needsMeshRegeneration = true; }
-    // Generate trees on terrain
-    void generateTreesOnTerrain(PerlinNoise* perlinNoise);
-    void regenerateOnTerrain(PerlinNoise* perlinNoise) {
-        generateTreesOnTerrain(perlinNoise);
-    }
+    // Generating trees on terrain is these steps, each only redone when what it uses changed (the application
+    // tracks that, see DerivedGraph). The species follow the L-system settings, the tree transforms the terrain
+    // and the placement settings, the leaf transforms the tree transforms, the species' branch ends and the leaf
+    // settings, and each instance buffer its transforms and species.
+    // updateSpecies picks each slot's species from the cache and builds the missing ones in the background, the
+    // slots drawing their previous species meanwhile. Once applyFinishedSpecies returns true the species changed
+    // again and updateSpecies needs to run again.
+    void updateSpecies();
+    bool applyFinishedSpecies();
+    void placeTrees(const Heightfield& heightfield);
+    void placeLeaves();
+    void uploadTreeInstances();
+    void uploadLeafInstances();
+
+    // Species slots. New slots start as the last one with the next tree type.
+    int speciesCount() const { return int(slots.size()); }
+    void setSpeciesCount(int count);
+    // L-system and tree type of the edited species
+    LSystem& lSystem() { return slots[editedSpecies].lSystem; }
+    int treeType() const { return slots[editedSpecies].treeType; }
     void setTreeType(int type);
-    // Draw all trees
+    // Most iterations (up to 8) that keep the edited species under maxSegments, and the segments it currently makes
+    int maxIterations() const;
+    uint64_t segmentCount() const;
+    // Cache stats for the GUI
+    int cachedSpecies() const { return int(cache.size()); }
+    bool buildingSpecies() const { return builds.busy(); }
+    // Draw every tree, one instanced call per species, then the leaves
     void draw(const glm::mat4& view, const glm::mat4& proj,
               const glm::vec3& lightDir = glm::vec3(0, -1, -1),
               const glm::vec3& lightColor = glm::vec3(1),
@@ -52,27 +98,56 @@ public:
               GLuint shadowMapTexture = 0,
               bool enableShadows = false,
               bool usePCF = true);
+    // The same draw calls with whatever shader is bound (the shadow pass)
+    void drawTreeInstances() const;
+    void drawLeafInstances() const;
 
-    cgra::gl_mesh treeMesh;
     std::vector<glm::mat4> treeTransforms;
 
     cgra::gl_mesh leafMesh;
     std::vector<glm::mat4> leafTransforms;
 
 private:
+    struct SpeciesSlot {
+        LSystem lSystem;
+        int treeType = 3;
+        std::shared_ptr<TreeSpecies> drawn; // Null until its first species is built
+    };
+    std::vector<SpeciesSlot> slots;
+
+    struct CachedSpecies {
+        std::shared_ptr<TreeSpecies> species;
+        std::list<SpeciesKey>::iterator lruPosition;
+    };
+    std::unordered_map<SpeciesKey, CachedSpecies, SpeciesKeyHash> cache;
+    std::list<SpeciesKey> lru;              // Most recently used at the front
+    std::vector<SpeciesKey> requested;      // Species the latest build was submitted for
+
+    // The trees grouped by species, each batch's transforms a contiguous run of the instance buffer
+    struct TreeBatch {
+        const TreeSpecies* species;
+        int first;
+        int count;
+    };
+    std::vector<TreeBatch> batches;
+    std::vector<glm::mat4> batchedTransforms;
+
     GLuint instanceVBO = 0;
-    bool needsMeshRegeneration = true;
+    size_t instanceCapacity = 0;           // Transforms the instance buffer has room for
 
     // Leaf data
-    std::vector<glm::vec3> baseLeafPositions;   // End nodes from single tree
-    std::vector<glm::vec3> baseLeafDirections;  // Branch directions at end nodes
     GLuint leafInstanceVBO = 0;
+    size_t leafInstanceCapacity = 0;
+    bool leafInstancesAttached = false;
+
+    // Species builds, declared last so it stops before the cache its results go into
+    RegenerationQueue builds;
 
-    void setupInstancing();
-    void updateInstanceBuffer();
-    void regenerateTreeMesh();
-    void generateLeafMesh();
-    void setupLeafInstancing();
+    TreePlacement placement() const;
+    LSystem buildable(const LSystem& lSystem) const;
+    std::shared_ptr<TreeSpecies> findSpecies(const SpeciesKey& key);
+    void insertSpecies(const SpeciesKey& key, std::shared_ptr<TreeSpecies> species);
+    void groupTrees();
     void drawLeaves(const glm::mat4& view, const glm::mat4& proj,
                     const glm::vec3& lightDir, const glm::vec3& lightColor,
                     const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f),
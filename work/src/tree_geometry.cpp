@@ -0,0 +1,114 @@
+// std
+#include <random>
+
+// glm
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+// project
+#include "tree_geometry.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+void placeTrees(const TreePlacement &placement, const Heightfield &heightfield, vector<mat4> &treeTransforms) {
+	treeTransforms.clear();
+	if (heightfield.empty()) return;
+
+	// Random placement
+	mt19937 rng(placement.seed);
+	float meshSize = heightfield.meshScale();
+	uniform_real_distribution<float> positionDist(-meshSize * 0.8f, meshSize * 0.8f);
+	uniform_real_distribution<float> scaleDist(placement.minScale, placement.maxScale);
+	uniform_real_distribution<float> rotationDist(0.0f, 2.0f * pi<float>());
+
+	for (int i = 0; i < placement.treeCount; i++) {
+		vec2 position(positionDist(rng), positionDist(rng));
+		// Positions that are underwater or on a peak move to the closest vertex where trees can grow, then slightly
+		// into the ground.
+		vec3 terrainPoint(0.0f);
+		heightfield.nearestEligible(position, terrainPoint);
+		terrainPoint.y -= 0.2f;
+
+		float scale = scaleDist(rng);
+		float rotation = placement.randomRotation ? rotationDist(rng) : 0.0f;
+
+		mat4 transform = translate(mat4(1.0f), terrainPoint) *
+						 rotate(mat4(1.0f), rotation, vec3(0, 1, 0)) *
+						 glm::scale(mat4(1.0f), vec3(scale));
+
+		treeTransforms.push_back(transform);
+	}
+}
+
+
+void placeLeaves(const TreePlacement &placement, const vector<mat4> &treeTransforms,
+				 const vector<vec3> &leafPositions, const vector<vec3> &leafDirections, vector<mat4> &leafTransforms) {
+	// Every tree has the same leaves, so tree k's leaves start at k * leafCount and the trees can fill theirs in parallel.
+	int leafCount = int(leafPositions.size());
+	leafTransforms.resize(treeTransforms.size() * leafCount);
+
+	parallelFor(0, int(treeTransforms.size()), [&](int begin, int end) {
+		for (int k = begin; k < end; k++) {
+			const mat4 &transform = treeTransforms[k];
+			// Trees are scaled uniformly, so any axis gives the scale.
+			float scale = length(vec3(transform[0]));
+
+			// Create leaf transforms for this tree instance aligned with branch direction
+			for (int j = 0; j < leafCount; j++) {
+				// Transform position and direction to world space
+				vec3 worldLeafPos = vec3(transform * vec4(leafPositions[j], 1.0f));
+				vec3 worldBranchDir = normalize(vec3(transform * vec4(leafDirections[j], 0.0f)));
+
+				worldLeafPos -= worldBranchDir * (scale * placement.leafSize * placement.leafOffset);
+
+				// Create rotation matrix to align leaf with branch direction
+				// The leaf mesh grows along the branch direction (Y-axis in local space)
+				vec3 up = worldBranchDir;
+				vec3 right = normalize(cross(vec3(0, 1, 0), up));
+				if (length(right) < 0.001f) {
+					right = normalize(cross(vec3(1, 0, 0), up));
+				}
+				vec3 forward = normalize(cross(up, right));
+				mat4 orientation = mat4(vec4(right, 0), vec4(up, 0), vec4(forward, 0), vec4(0, 0, 0, 1));
+
+				// Combine position, orientation, and scale
+				leafTransforms[size_t(k) * leafCount + j] = translate(mat4(1.0f), worldLeafPos) *
+															 orientation *
+															 glm::scale(mat4(1.0f), vec3(scale * placement.leafSize));
+			}
+		}
+	});
+}
+
+
+mesh_data leafMeshData() {
+	mesh_data mesh;
+	float size = 1.0f; // Will be scaled by leafSize in transforms
+
+	mesh.vertices = {
+		// First quad (aligned with XY plane)
+		{ vec3(-size, 0, 0), vec3(0, 1, 0), vec2(0, 0) }, // Bottom left
+		{ vec3(size, 0, 0), vec3(0, 1, 0), vec2(1, 0) }, // Bottom right
+		{ vec3(size, size * 2, 0), vec3(0, 1, 0), vec2(1, 1) }, // Top right
+		{ vec3(-size, size * 2, 0), vec3(0, 1, 0), vec2(0, 1) }, // Top left
+
+		// Second quad (aligned with ZY plane, perpendicular to first)
+		{ vec3(0, 0, -size), vec3(1, 0, 0), vec2(0, 0) }, // Bottom left
+		{ vec3(0, 0, size), vec3(1, 0, 0), vec2(1, 0) }, // Bottom right
+		{ vec3(0, size * 2, size), vec3(1, 0, 0), vec2(1, 1) }, // Top right
+		{ vec3(0, size * 2, -size), vec3(1, 0, 0), vec2(0, 1) }, // Top left
+	};
+
+	// Both sides of each quad, for proper visibility
+	mesh.indices = {
+		0, 1, 2, 0, 2, 3,
+		0, 2, 1, 0, 3, 2, // Back faces
+		4, 5, 6, 4, 6, 7,
+		4, 6, 5, 4, 7, 6, // Back faces
+	};
+	return mesh;
+}
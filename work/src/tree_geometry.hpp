@@ -0,0 +1,35 @@
+#pragma once
+
+// std
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_vertex.hpp"
+#include "heightfield.hpp"
+
+
+// How trees are scattered over the terrain.
+struct TreePlacement {
+	int treeCount = 5;
+	float minScale = 0.5f;
+	float maxScale = 1.0f;
+	bool randomRotation = true;
+	float leafSize = 0.4f;
+	float leafOffset = 0.3f; // Offset backwards along branch to prevent floating appearance.
+	unsigned seed = 42;
+};
+
+// Instance transforms for every tree, moved onto eligible ground of the heightfield. Doesn't use the leaf settings.
+void placeTrees(const TreePlacement &placement, const Heightfield &heightfield, std::vector<glm::mat4> &treeTransforms);
+// Instance transforms for the leaves of every placed tree, aligned with the branches they grow from. leafPositions and
+// leafDirections are the branch ends of a single tree (see LSystem::generateTreeMesh). Only uses the leaf settings,
+// so changing them doesn't move the trees.
+void placeLeaves(const TreePlacement &placement, const std::vector<glm::mat4> &treeTransforms,
+				 const std::vector<glm::vec3> &leafPositions, const std::vector<glm::vec3> &leafDirections,
+				 std::vector<glm::mat4> &leafTransforms);
+
+// Cross-quad billboard (two perpendicular quads forming an X, both sides) that every leaf instance draws.
+cgra::mesh_data leafMeshData();
@@ -0,0 +1,64 @@
+// project
+#include "tree_species.hpp"
+#include "parallel.hpp"
+
+using namespace std;
+using namespace glm;
+using namespace cgra;
+
+
+namespace {
+	uint64_t fnv1a(const void *data, size_t size, uint64_t hash) {
+		const unsigned char *bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	// Strings are hashed with their length, so the boundaries between them count too.
+	uint64_t hashString(const string &text, uint64_t hash) {
+		uint64_t length = text.size();
+		hash = fnv1a(&length, sizeof(length), hash);
+		return fnv1a(text.data(), text.size(), hash);
+	}
+}
+
+
+SpeciesKey::SpeciesKey(const LSystem &lSystem)
+	: axiom(lSystem.axiom), rules(lSystem.rules), iterations(lSystem.iterations), angle(lSystem.angle),
+	  stepLength(lSystem.stepLength), branchTaper(lSystem.branchTaper), initialRadius(lSystem.initialRadius),
+	  cylinderSides(lSystem.cylinderSides) {}
+
+
+uint64_t SpeciesKey::hash() const {
+	uint64_t h = hashString(axiom, 14695981039346656037ull);
+	for (const auto &rule : rules) {
+		h = fnv1a(&rule.first, sizeof(rule.first), h);
+		h = hashString(rule.second, h);
+	}
+	int32_t ints[] = { iterations, cylinderSides };
+	float floats[] = { angle, stepLength, branchTaper, initialRadius };
+	h = fnv1a(ints, sizeof(ints), h);
+	return fnv1a(floats, sizeof(floats), h);
+}
+
+
+bool SpeciesKey::operator==(const SpeciesKey &other) const {
+	return axiom == other.axiom && rules == other.rules && iterations == other.iterations && angle == other.angle &&
+		stepLength == other.stepLength && branchTaper == other.branchTaper && initialRadius == other.initialRadius &&
+		cylinderSides == other.cylinderSides;
+}
+
+
+vector<SpeciesGeometry> buildSpecies(const vector<LSystem> &lSystems) {
+	vector<SpeciesGeometry> species(lSystems.size());
+	parallelFor(0, int(lSystems.size()), [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			LSystem lSystem = lSystems[i];
+			SpeciesGeometry &geometry = species[i];
+			geometry.mesh = lSystem.generateTreeMesh(geometry.leafPositions, geometry.leafDirections);
+		}
+	});
+	return species;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+// std
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// glm
+#include <glm/glm.hpp>
+
+// project
+#include "cgra/cgra_vertex.hpp"
+#include "l_system.hpp"
+
+
+// Everything the mesh of one tree species depends on, taken from its L-system. Two L-systems with equal keys build
+// the same tree, so a species is only ever built once while it stays cached.
+struct SpeciesKey {
+	std::string axiom;
+	std::map<char, std::string> rules;
+	int32_t iterations = 0;
+	float angle = 0.0f;
+	float stepLength = 0.0f;
+	float branchTaper = 0.0f;
+	float initialRadius = 0.0f;
+	int32_t cylinderSides = 0;
+
+	explicit SpeciesKey(const LSystem &lSystem);
+
+	uint64_t hash() const;
+	bool operator==(const SpeciesKey &other) const;
+};
+
+struct SpeciesKeyHash {
+	size_t operator()(const SpeciesKey &key) const { return size_t(key.hash()); }
+};
+
+// CPU side of a species: the mesh of one tree and its branch ends, where the leaves grow.
+struct SpeciesGeometry {
+	cgra::mesh_data mesh;
+	std::vector<glm::vec3> leafPositions;
+	std::vector<glm::vec3> leafDirections;
+};
+
+// Builds the trees of several species at once, one species per thread (see parallelFor).
+std::vector<SpeciesGeometry> buildSpecies(const std::vector<LSystem> &lSystems);
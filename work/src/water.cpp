@@ -8,14 +8,15 @@
 #include "cgra/cgra_geometry.hpp"
 #include "cgra/cgra_mesh.hpp"
 #include "water.hpp"
+#include "grid_mesh.hpp"
 #include "cgra/cgra_image.hpp"
 
 using namespace std;
 using namespace glm;
 using namespace cgra;
 
-// Initially generate the mesh and load the textures. Initialise shader and color separately.
-Water::Water() {
+// Load the textures and start the animation clock. Initialise shader and mesh separately.
+void Water::loadTextures() {
 	// Enable tranparency, so the water can use alpha channel.
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -132,18 +133,21 @@ void Water::draw(const mat4& view, const mat4& proj,
 // Create water mesh which is essentially a plane.
 void Water::createMesh() {
 	// Create the vertices which have positions, normals and UVs.
+	float extent = meshExtent > 0.0f ? meshExtent : meshScale;
 	vector<mesh_vertex> vertices(meshResolution * meshResolution);
 	for (int i = 0; i < meshResolution; ++i) {
 		for (int j = 0; j < meshResolution; ++j) {
 			// Get u and v offset on mesh and map to range -noiseSize to noiseSize for x and z.
 			float u = i / (meshResolution - 1.0f);
 			float v = j / (meshResolution - 1.0f);
-			float x = (-1.0f + 2.0f * u) * meshScale;
-			float z = (-1.0f + 2.0f * v) * meshScale;
+			float x = meshCentre.x + (-1.0f + 2.0f * u) * extent;
+			float z = meshCentre.y + (-1.0f + 2.0f * v) * extent;
 
 			// Position, normal, and uv. Simple upwards normal and zero height because the waves are generated in the shader.
+			// UVs come from the world position (0 to 1 across the terrain), so the waves and the terrain heightmap
+			// stay in place when the plane is moved or resized.
 			vec3 pos = vec3(x, 0, z);
-			vec2 uv(u, v);
+			vec2 uv = (vec2(x, z) / meshScale + 1.0f) * 0.5f;
 			vec3 norm = vec3(0, 1, 0);
 
 			// Each increase in i is a whole loop of j over meshResolution.
@@ -152,29 +156,7 @@ void Water::createMesh() {
 		}
 	}
 
-	// Create the triangles. Ignore the final vertex (meshResolution - 1) as the quads/triangles are formed up to it.
-	mesh_builder mb;
-	unsigned int index = 0;
-	for (int i = 0; i < meshResolution - 1; ++i) {
-		for (int j = 0; j < meshResolution - 1; ++j) {
-			// Offset i by the rows of j that have been passed already. This is to index the vector properly.
-			int iOffset = i * meshResolution;
-
-			// Get vertices. 2D array alternative: vertices[i][j] to vertices[i+1][j+1].
-			mesh_vertex topLeft = vertices[iOffset + j];
-			mesh_vertex bottomLeft = vertices[iOffset + (j + 1)];
-			mesh_vertex topRight = vertices[(iOffset + meshResolution) + j];
-			mesh_vertex bottomRight = vertices[(iOffset + meshResolution) + (j + 1)];
-			// Add the two sets of three vertices for the left triangle and right triangle.
-			for (mesh_vertex v : { topLeft, topRight, bottomLeft, bottomLeft, topRight, bottomRight }) {
-				mb.push_vertex(v);
-			}
-
-			// Add all the indices of the quad in a one liner, instead of doing push_index() 6 times.
-			mb.push_indices({ index, index + 1, index + 2, index + 3, index + 4, index + 5 });
-			index += 6;
-		}
-	}
-	// Build and set gl_mesh.
-	waterMesh = mb.build();
+	// Create the triangles over the shared vertices. Each grid vertex is uploaded once and indexed by its neighbouring quads.
+	waterMesh.destroy();
+	waterMesh = buildGridMesh(vertices, meshResolution, meshResolution, meshTopology);
 }
\ No newline at end of file
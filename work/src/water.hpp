@@ -5,14 +5,15 @@
 
 // project
 #include "opengl.hpp"
+#include "grid_mesh.hpp"
 
 class Water {
 private:
 	cgra::gl_mesh waterMesh;
-	GLuint texture;
-	GLuint normalMap;
-	GLuint dudvMap;
-	float startTime;
+	GLuint texture = 0;
+	GLuint normalMap = 0;
+	GLuint dudvMap = 0;
+	float startTime = 0.0f;
 
 public:
 	GLuint shader = 0;
@@ -20,7 +21,10 @@ public:
 	float waterHeightProp = 0.4f; // Proportion of water level against terrain height.
 	float textureScale = 0.80f; // Size of texture.
 	float meshScale = 10.0f; // Overall size of mesh. Matches size of terrain.
+	float meshExtent = 0.0f; // Half size of the plane when it differs from meshScale (world mode), 0 to match it.
+	glm::vec2 meshCentre{ 0.0f }; // Where the plane is centred. Follows the camera in world mode.
 	int meshResolution = 100; // Square this to get total vertices.
+	GridTopology meshTopology = GridTopology::Triangles; // Matches the terrain.
 	float waterAlpha = 0.9f;
 	float waterSpeed = 0.15f;
 	float waterAmplitude = 0.01f;
@@ -29,8 +33,9 @@ public:
 	float metallic = 0.25f; // 0 = normal, 1 = metal.
 	bool useOrenNayar = true;
 
-	// Constructor and public methods.
-	Water();
+	// Constructor and public methods. The constructor needs no GL context, loadTextures does.
+	Water() {};
+	void loadTextures();
 	void draw(const glm::mat4& view, const glm::mat4& proj,
 			  const glm::vec3& lightDirection, const glm::vec3& lightColor,
 			  const glm::mat4& lightSpaceMatrix = glm::mat4(1.0f),